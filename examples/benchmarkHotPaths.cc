@@ -0,0 +1,611 @@
+/*
+ * LSST Data Management System
+ * Copyright 2008-2015 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/*
+ * Benchmarks of the ip_diffim hot paths on synthetic inputs.
+ *
+ * Usage: benchmarkHotPaths [nRepeat [frameSize]]
+ *
+ * Each measurement is written to stdout as one line of JSON, e.g.
+ *
+ *   {"benchmark": "StaticKernelSolution.build", "basis": "alard-lupton", "kernelSize": 19,
+ *    "nRepeat": 5, "secondsMean": 0.012, "secondsMin": 0.011, "pixelsPerSecond": 3.1e+05, ...}
+ *
+ * with the parameters of the case, the mean and minimum wall-clock time of
+ * a call, the throughput at the minimum time, and the counters of the
+ * Instrumentation phases the calls went through.  A case that throws is
+ * reported with an "error" field and the run continues.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "boost/shared_ptr.hpp"
+#include "Eigen/Core"
+
+#include "lsst/pex/exceptions.h"
+#include "lsst/pex/policy/Policy.h"
+#include "lsst/afw/geom.h"
+#include "lsst/afw/math.h"
+#include "lsst/afw/image.h"
+#include "lsst/afw/detection.h"
+#include "lsst/afw/detection/GaussianPsf.h"
+#include "lsst/afw/table.h"
+#include "lsst/ip/diffim.h"
+
+namespace afwDet    = lsst::afw::detection;
+namespace afwGeom   = lsst::afw::geom;
+namespace afwImage  = lsst::afw::image;
+namespace afwMath   = lsst::afw::math;
+namespace afwTable  = lsst::afw::table;
+namespace pexExcept = lsst::pex::exceptions;
+namespace pexPolicy = lsst::pex::policy;
+using namespace lsst::ip::diffim;
+
+typedef float PixelT;
+
+namespace {
+
+    double wallClock() {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+    }
+
+    /* One measurement, written as a line of JSON */
+    class Record {
+    public:
+        explicit Record(std::string const& benchmark) : _fields() {
+            add("benchmark", benchmark);
+        }
+
+        Record &add(std::string const& key, std::string const& value) {
+            _fields.push_back("\"" + key + "\": \"" + value + "\"");
+            return *this;
+        }
+        Record &add(std::string const& key, char const* value) {
+            return add(key, std::string(value));
+        }
+        Record &add(std::string const& key, int value) {
+            std::ostringstream os;
+            os << "\"" << key << "\": " << value;
+            _fields.push_back(os.str());
+            return *this;
+        }
+        Record &add(std::string const& key, bool value) {
+            _fields.push_back("\"" + key + "\": " + (value ? "true" : "false"));
+            return *this;
+        }
+        Record &add(std::string const& key, double value) {
+            std::ostringstream os;
+            os.precision(6);
+            os << "\"" << key << "\": ";
+            if (std::isfinite(value)) {
+                os << value;
+            } else {
+                os << "null";
+            }
+            _fields.push_back(os.str());
+            return *this;
+        }
+
+        /* The counters of the phases with calls since the last Instrumentation::reset() */
+        Record &addInstrumentation() {
+            for (int i = 0; i < Instrumentation::NPHASES; ++i) {
+                Instrumentation::Phase phase = static_cast<Instrumentation::Phase>(i);
+                int const nCalls = Instrumentation::getNCalls(phase);
+                if (nCalls == 0) {
+                    continue;
+                }
+                std::string const name = Instrumentation::getPhaseName(phase);
+                double const seconds = Instrumentation::getSeconds(phase);
+                add(name + ".nCalls", nCalls);
+                add(name + ".seconds", seconds);
+                add(name + ".bytes", Instrumentation::getBytes(phase));
+                add(name + ".flopsPerSecond",
+                    seconds > 0. ? Instrumentation::getFlops(phase) / seconds : 0.);
+            }
+            return *this;
+        }
+
+        void write(std::ostream &os) const {
+            os << "{";
+            for (std::size_t i = 0; i < _fields.size(); ++i) {
+                os << (i ? ", " : "") << _fields[i];
+            }
+            os << "}" << std::endl;
+        }
+
+    private:
+        std::vector<std::string> _fields;
+    };
+
+    /*
+     * Time nRepeat calls of func() after one untimed call, which fills
+     * caches and workspaces.  The Instrumentation counters cover the timed
+     * calls only.  Adds the timings and the throughput of nUnits per call,
+     * in unitsPerSecond, to record.
+     */
+    template <typename FuncT>
+    void timeCalls(FuncT &func, int nRepeat, Record &record, std::string const& units, double nUnits) {
+        func();
+        Instrumentation::reset();
+        Instrumentation::setEnabled(true);
+        double total = 0.;
+        double best  = 0.;
+        for (int i = 0; i < nRepeat; ++i) {
+            double const t0 = wallClock();
+            func();
+            double const dt = wallClock() - t0;
+            total += dt;
+            best   = (i == 0) ? dt : std::min(best, dt);
+        }
+        Instrumentation::setEnabled(false);
+
+        record.add("nRepeat", nRepeat);
+        record.add("secondsMean", total / nRepeat);
+        record.add("secondsMin", best);
+        record.add(units + "PerSecond", best > 0. ? nUnits / best : 0.);
+        record.addInstrumentation();
+    }
+
+    /* Runs one case, reporting rather than propagating a failure */
+    template <typename FuncT>
+    void runCase(FuncT &func, int nRepeat, Record record, std::string const& units, double nUnits) {
+        try {
+            timeCalls(func, nRepeat, record, units, nUnits);
+        } catch (pexExcept::Exception &e) {
+            Instrumentation::setEnabled(false);
+            record.add("error", "exception");
+            std::cerr << e.what() << std::endl;
+        }
+        record.write(std::cout);
+    }
+
+    /* An Alard-Lupton basis with the PsfMatchConfig default Gaussians */
+    afwMath::KernelList makeAlardLuptonBasis(int halfWidth) {
+        std::vector<double> sigGauss;
+        sigGauss.push_back(0.7);
+        sigGauss.push_back(1.5);
+        sigGauss.push_back(3.0);
+        std::vector<int> degGauss;
+        degGauss.push_back(4);
+        degGauss.push_back(2);
+        degGauss.push_back(2);
+        return makeAlardLuptonBasisList(halfWidth, sigGauss.size(), sigGauss, degGauss);
+    }
+
+    afwMath::KernelList makeBasis(std::string const& basisType, int kernelSize) {
+        if (basisType == "alard-lupton") {
+            return makeAlardLuptonBasis(kernelSize / 2);
+        }
+        return makeDeltaFunctionBasisList(kernelSize, kernelSize);
+    }
+
+    pexPolicy::Policy makePolicy(std::string const& basisType, int kernelSize) {
+        pexPolicy::Policy policy;
+        policy.set("kernelBasisSet", basisType);
+        policy.set("kernelSize", kernelSize);
+        policy.set("fitForBackground", true);
+        policy.set("usePcaForSpatialKernel", false);
+        policy.set("useCholeskyForSpatialKernel", false);
+        policy.set("spatialKernelRebuildInterval", 0);
+        policy.set("regularizationType", std::string("centralDifference"));
+        policy.set("centralRegularizationStencil", 9);
+        policy.add("forwardRegularizationOrders", 1);
+        policy.add("forwardRegularizationOrders", 2);
+        policy.set("regularizationBorderPenalty", 3.0);
+        policy.set("lambdaType", std::string("absolute"));
+        policy.set("lambdaValue", 0.2);
+        policy.set("lambdaScaling", 1.0e-4);
+        policy.set("lambdaStepType", std::string("log"));
+        policy.set("lambdaLogMin", -1.0);
+        policy.set("lambdaLogMax", 2.0);
+        policy.set("lambdaLogStep", 0.1);
+        policy.set("lambdaLinMin", 0.0);
+        policy.set("lambdaLinMax", 2.0);
+        policy.set("lambdaLinStep", 0.1);
+        policy.set("maxConditionNumber", 5.0e7);
+        return policy;
+    }
+
+    /* Adds a Gaussian of the given peak amplitude centred on (xc, yc), in parent pixel coordinates */
+    void addGaussian(afwImage::Image<PixelT> &image, double xc, double yc, double sigma, double amplitude) {
+        for (int y = 0; y < image.getHeight(); ++y) {
+            afwImage::Image<PixelT>::x_iterator ptr = image.row_begin(y);
+            double const dy = y + image.getY0() - yc;
+            for (int x = 0; x < image.getWidth(); ++x, ++ptr) {
+                double const dx = x + image.getX0() - xc;
+                *ptr += amplitude * std::exp(-0.5 * (dx * dx + dy * dy) / (sigma * sigma));
+            }
+        }
+    }
+
+    /*
+     * A template stamp with a star on a sky of 100 with Poisson-like noise,
+     * and a science stamp that is the template convolved with a Gaussian.
+     */
+    struct Stamps {
+        Stamps(int kernelSize, afwMath::Random &rand) :
+            templateImage(afwGeom::Extent2I(4 * kernelSize, 4 * kernelSize)),
+            scienceImage(templateImage.getDimensions()),
+            varianceEstimate(templateImage.getDimensions())
+        {
+            int const size = templateImage.getWidth();
+            afwMath::randomGaussianImage(&templateImage, rand);
+            templateImage *= 10.;
+            templateImage += 100.;
+            addGaussian(templateImage, 0.5 * size, 0.5 * size, 1.5, 1000.);
+
+            afwMath::AnalyticKernel kernel(kernelSize, kernelSize, afwMath::GaussianFunction2<double>(2.0, 2.0));
+            afwMath::convolve(scienceImage, templateImage, kernel, true);
+            varianceEstimate <<= scienceImage;
+        }
+
+        afwImage::Image<PixelT> templateImage;
+        afwImage::Image<PixelT> scienceImage;
+        afwImage::Image<afwImage::VariancePixel> varianceEstimate;
+    };
+
+    /**********************************************************************************************/
+
+    struct AlardLuptonBasisCase {
+        explicit AlardLuptonBasisCase(int halfWidth) : halfWidth(halfWidth), nBases(0) {}
+        void operator()() {
+            nBases = makeAlardLuptonBasis(halfWidth).size();
+        }
+        int halfWidth;
+        int nBases;
+    };
+
+    struct RegularizationMatrixCase {
+        explicit RegularizationMatrixCase(pexPolicy::Policy const& policy) : policy(policy) {}
+        void operator()() {
+            hMat = makeRegularizationMatrix(policy);
+        }
+        pexPolicy::Policy policy;
+        boost::shared_ptr<Eigen::MatrixXd> hMat;
+    };
+
+    struct StaticBuildCase {
+        StaticBuildCase(afwMath::KernelList const& basisList, Stamps const& stamps) :
+            basisList(basisList), stamps(stamps), workspace(new KernelBuildWorkspace()) {}
+        void operator()() {
+            solution.reset(new StaticKernelSolution<PixelT>(basisList, true));
+            solution->build(stamps.templateImage, stamps.scienceImage, stamps.varianceEstimate, workspace);
+        }
+        afwMath::KernelList basisList;
+        Stamps const& stamps;
+        KernelBuildWorkspace::Ptr workspace;
+        StaticKernelSolution<PixelT>::Ptr solution;
+    };
+
+    struct StaticSolveCase {
+        explicit StaticSolveCase(StaticKernelSolution<PixelT>::Ptr solution) : solution(solution) {}
+        void operator()() {
+            solution->solve();
+        }
+        StaticKernelSolution<PixelT>::Ptr solution;
+    };
+
+    struct EstimateRiskCase {
+        EstimateRiskCase(RegularizedKernelSolution<PixelT>::Ptr solution, double maxCond) :
+            solution(solution), maxCond(maxCond), lambda(0.) {}
+        void operator()() {
+            lambda = solution->estimateRisk(maxCond);
+        }
+        RegularizedKernelSolution<PixelT>::Ptr solution;
+        double maxCond;
+        double lambda;
+    };
+
+    /* The constraints of nCandidates candidates with the same M and B, spread over a frame */
+    struct SpatialAccumulateCase {
+        SpatialAccumulateCase(afwMath::KernelList const& basisList, pexPolicy::Policy const& policy,
+                              int spatialOrder, int nCandidates, int frameSize,
+                              boost::shared_ptr<Eigen::MatrixXd> qMat, boost::shared_ptr<Eigen::VectorXd> wVec,
+                              afwMath::Random &rand) :
+            basisList(basisList), policy(policy), spatialOrder(spatialOrder),
+            xCenter(nCandidates), yCenter(nCandidates), qMat(qMat), wVec(wVec) {
+            for (int i = 0; i < nCandidates; ++i) {
+                xCenter[i] = frameSize * rand.uniform();
+                yCenter[i] = frameSize * rand.uniform();
+            }
+        }
+        void operator()() {
+            afwMath::Kernel::SpatialFunctionPtr kFunction(new afwMath::PolynomialFunction2<double>(spatialOrder));
+            afwMath::Kernel::SpatialFunctionPtr bgFunction(new afwMath::PolynomialFunction2<double>(1));
+            solution.reset(new SpatialKernelSolution(basisList, kFunction, bgFunction, policy));
+            for (std::size_t i = 0; i < xCenter.size(); ++i) {
+                solution->addConstraint(xCenter[i], yCenter[i], qMat, wVec);
+            }
+        }
+        afwMath::KernelList basisList;
+        pexPolicy::Policy policy;
+        int spatialOrder;
+        std::vector<float> xCenter;
+        std::vector<float> yCenter;
+        boost::shared_ptr<Eigen::MatrixXd> qMat;
+        boost::shared_ptr<Eigen::VectorXd> wVec;
+        SpatialKernelSolution::Ptr solution;
+    };
+
+    struct SpatialSolveCase {
+        explicit SpatialSolveCase(SpatialKernelSolution::Ptr solution) : solution(solution) {}
+        void operator()() {
+            solution->solve();
+        }
+        SpatialKernelSolution::Ptr solution;
+    };
+
+    struct ConvolveAndSubtractCase {
+        ConvolveAndSubtractCase(afwImage::MaskedImage<PixelT> const& templateImage,
+                                afwImage::MaskedImage<PixelT> const& scienceImage,
+                                afwMath::Kernel const& kernel, bool maskedTemplate) :
+            templateImage(templateImage), scienceImage(scienceImage),
+            kernel(kernel), maskedTemplate(maskedTemplate) {}
+        void operator()() {
+            if (maskedTemplate) {
+                convolveAndSubtract(templateImage, scienceImage, kernel, 0.);
+            } else {
+                convolveAndSubtract(*templateImage.getImage(), scienceImage, kernel, 0.);
+            }
+        }
+        afwImage::MaskedImage<PixelT> const& templateImage;
+        afwImage::MaskedImage<PixelT> const& scienceImage;
+        afwMath::Kernel const& kernel;
+        bool maskedTemplate;
+    };
+
+    struct DipoleMeasureCase {
+        DipoleMeasureCase(PsfDipoleFlux const& algorithm, afwTable::SourceRecord &source,
+                          afwImage::Exposure<PixelT> const& exposure) :
+            algorithm(algorithm), source(source), exposure(exposure) {}
+        void operator()() {
+            algorithm.measure(source, exposure);
+        }
+        PsfDipoleFlux const& algorithm;
+        afwTable::SourceRecord &source;
+        afwImage::Exposure<PixelT> const& exposure;
+    };
+
+    /**********************************************************************************************/
+
+    void benchmarkBasisLists(int nRepeat) {
+        for (int halfWidth = 5; halfWidth <= 15; halfWidth += 5) {
+            AlardLuptonBasisCase basisCase(halfWidth);
+            basisCase();
+            runCase(basisCase, nRepeat,
+                    Record("makeAlardLuptonBasisList").add("kernelSize", 2 * halfWidth + 1)
+                    .add("nBases", basisCase.nBases),
+                    "bases", basisCase.nBases);
+        }
+
+        char const* types[] = {"centralDifference", "forwardDifference"};
+        for (int t = 0; t < 2; ++t) {
+            for (int kernelSize = 5; kernelSize <= 21; kernelSize += 8) {
+                pexPolicy::Policy policy = makePolicy("delta-function", kernelSize);
+                policy.set("regularizationType", std::string(types[t]));
+                RegularizationMatrixCase hCase(policy);
+                runCase(hCase, nRepeat,
+                        Record("makeRegularizationMatrix").add("regularizationType", types[t])
+                        .add("kernelSize", kernelSize),
+                        "bases", kernelSize * kernelSize);
+            }
+        }
+    }
+
+    void benchmarkStaticKernelSolution(int nRepeat, afwMath::Random &rand) {
+        char const* types[] = {"alard-lupton", "delta-function"};
+        for (int t = 0; t < 2; ++t) {
+            for (int kernelSize = 9; kernelSize <= 19; kernelSize += 10) {
+                afwMath::KernelList basisList = makeBasis(types[t], kernelSize);
+                Stamps stamps(kernelSize, rand);
+                int const nPix = stamps.templateImage.getWidth() * stamps.templateImage.getHeight();
+                int const nBases = basisList.size();
+
+                StaticBuildCase buildCase(basisList, stamps);
+                runCase(buildCase, nRepeat,
+                        Record("StaticKernelSolution.build").add("basis", types[t])
+                        .add("kernelSize", kernelSize).add("nBases", nBases).add("nPix", nPix),
+                        "pixels", nPix);
+
+                StaticSolveCase solveCase(buildCase.solution);
+                runCase(solveCase, nRepeat,
+                        Record("StaticKernelSolution.solve").add("basis", types[t])
+                        .add("kernelSize", kernelSize).add("nBases", nBases),
+                        "solves", 1.);
+            }
+        }
+    }
+
+    void benchmarkEstimateRisk(int nRepeat, afwMath::Random &rand) {
+        for (int kernelSize = 5; kernelSize <= 13; kernelSize += 4) {
+            pexPolicy::Policy policy = makePolicy("delta-function", kernelSize);
+            afwMath::KernelList basisList = makeBasis("delta-function", kernelSize);
+            boost::shared_ptr<Eigen::MatrixXd> hMat = makeRegularizationMatrix(policy);
+            Stamps stamps(kernelSize, rand);
+
+            Record record("RegularizedKernelSolution.estimateRisk");
+            record.add("kernelSize", kernelSize);
+            try {
+                /* estimateRisk works from the M and B of a solved solution */
+                RegularizedKernelSolution<PixelT>::Ptr solution(
+                    new RegularizedKernelSolution<PixelT>(basisList, true, hMat, policy));
+                solution->build(stamps.templateImage, stamps.scienceImage, stamps.varianceEstimate);
+                solution->solve();
+
+                EstimateRiskCase riskCase(solution, policy.getDouble("maxConditionNumber"));
+                int const nLambdas = static_cast<int>(
+                    std::floor((policy.getDouble("lambdaLogMax") - policy.getDouble("lambdaLogMin")) /
+                               policy.getDouble("lambdaLogStep"))) + 1;
+                record.add("nLambdas", nLambdas);
+                runCase(riskCase, nRepeat, record, "lambdas", nLambdas);
+            } catch (pexExcept::Exception &e) {
+                record.add("error", "exception").write(std::cout);
+                std::cerr << e.what() << std::endl;
+            }
+        }
+    }
+
+    void benchmarkSpatialKernelSolution(int nRepeat, int frameSize, afwMath::Random &rand) {
+        int const kernelSize = 19;
+        pexPolicy::Policy policy = makePolicy("alard-lupton", kernelSize);
+        afwMath::KernelList basisList = makeBasis("alard-lupton", kernelSize);
+        Stamps stamps(kernelSize, rand);
+        StaticKernelSolution<PixelT> single(basisList, true);
+        single.build(stamps.templateImage, stamps.scienceImage, stamps.varianceEstimate);
+
+        for (int spatialOrder = 0; spatialOrder <= 3; ++spatialOrder) {
+            for (int nCandidates = 25; nCandidates <= 400; nCandidates *= 4) {
+                SpatialAccumulateCase addCase(basisList, policy, spatialOrder, nCandidates, frameSize,
+                                              single.getM(), single.getB(), rand);
+                runCase(addCase, nRepeat,
+                        Record("SpatialKernelSolution.addConstraint").add("spatialOrder", spatialOrder)
+                        .add("nCandidates", nCandidates),
+                        "constraints", nCandidates);
+
+                SpatialSolveCase solveCase(addCase.solution);
+                runCase(solveCase, nRepeat,
+                        Record("SpatialKernelSolution.solve").add("spatialOrder", spatialOrder)
+                        .add("nCandidates", nCandidates).add("nTerms", static_cast<int>(addCase.solution->getM()->rows())),
+                        "solves", 1.);
+            }
+        }
+    }
+
+    void benchmarkConvolveAndSubtract(int nRepeat, int frameSize, afwMath::Random &rand) {
+        int const kernelSize = 19;
+        pexPolicy::Policy policy = makePolicy("alard-lupton", kernelSize);
+        afwMath::KernelList basisList = makeBasis("alard-lupton", kernelSize);
+
+        Record record("convolveAndSubtract");
+        try {
+            /* A spatially varying kernel, as fit to candidates across the frame */
+            Stamps stamps(kernelSize, rand);
+            StaticKernelSolution<PixelT> single(basisList, true);
+            single.build(stamps.templateImage, stamps.scienceImage, stamps.varianceEstimate);
+            SpatialAccumulateCase addCase(basisList, policy, 1, 25, frameSize,
+                                          single.getM(), single.getB(), rand);
+            addCase();
+            addCase.solution->solve();
+            afwMath::Kernel::Ptr kernel = addCase.solution->getSolutionPair().first;
+
+            afwImage::MaskedImage<PixelT> templateImage(afwGeom::Extent2I(frameSize, frameSize));
+            afwMath::randomGaussianImage(templateImage.getImage().get(), rand);
+            *templateImage.getVariance() = 1.;
+            afwImage::MaskedImage<PixelT> scienceImage(templateImage, true);
+            int const nPix = frameSize * frameSize;
+
+            for (int masked = 0; masked < 2; ++masked) {
+                ConvolveAndSubtractCase subtractCase(templateImage, scienceImage, *kernel, masked);
+                runCase(subtractCase, nRepeat,
+                        Record("convolveAndSubtract").add("frameSize", frameSize)
+                        .add("kernelSize", kernelSize).add("maskedTemplate", static_cast<bool>(masked)),
+                        "pixels", nPix);
+            }
+        } catch (pexExcept::Exception &e) {
+            record.add("error", "exception").write(std::cout);
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    void benchmarkPsfDipoleFlux(int nRepeat, afwMath::Random &rand) {
+        int const size = 128;
+        double const sigma = 2.0;
+        double const xc = 0.5 * size;
+        double const yc = 0.5 * size;
+        double const offset = 2.0;
+        double const amplitude = 100.;
+
+        afwImage::MaskedImage<PixelT> image(afwGeom::Extent2I(size, size));
+        afwMath::randomGaussianImage(image.getImage().get(), rand);
+        *image.getVariance() = 1.;
+        addGaussian(*image.getImage(), xc + offset, yc + offset, sigma, amplitude);
+        addGaussian(*image.getImage(), xc - offset, yc - offset, sigma, -amplitude);
+        afwImage::Exposure<PixelT> exposure(image);
+        exposure.setPsf(PTR(afwDet::Psf)(new afwDet::GaussianPsf(17, 17, sigma)));
+
+        int const halfBox = 20;
+        PTR(afwDet::Footprint) footprint(
+            new afwDet::Footprint(afwGeom::Box2I(afwGeom::Point2I(size / 2 - halfBox, size / 2 - halfBox),
+                                                 afwGeom::Extent2I(2 * halfBox, 2 * halfBox))));
+        footprint->addPeak(xc + offset, yc + offset, amplitude);
+        footprint->addPeak(xc - offset, yc - offset, -amplitude);
+
+        for (int oversample = 0; oversample <= 4; oversample += 4) {
+            for (int linear = 0; linear < 2; ++linear) {
+                PsfDipoleFluxControl ctrl;
+                ctrl.psfCacheOversample = oversample;
+                ctrl.fitFluxesLinearly = linear;
+
+                afwTable::Schema schema = afwTable::SourceTable::makeMinimalSchema();
+                schema.addField<double>("centroid_x", "centroid x");
+                schema.addField<double>("centroid_y", "centroid y");
+                schema.addField<afwTable::Flag>("centroid_flag", "centroid flag");
+                schema.getAliasMap()->set("slot_Centroid", "centroid");
+                PsfDipoleFlux algorithm(ctrl, "ip_diffim_PsfDipoleFlux", schema);
+                afwTable::SourceCatalog catalog(schema);
+                PTR(afwTable::SourceRecord) source = catalog.addNew();
+                source->setFootprint(footprint);
+
+                DipoleMeasureCase measureCase(algorithm, *source, exposure);
+                runCase(measureCase, nRepeat,
+                        Record("PsfDipoleFlux.measure").add("psfCacheOversample", oversample)
+                        .add("fitFluxesLinearly", static_cast<bool>(linear))
+                        .add("nPix", static_cast<int>(footprint->getArea())),
+                        "sources", 1.);
+            }
+        }
+    }
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    int nRepeat   = 5;
+    int frameSize = 2048;
+    if (argc > 1) {
+        nRepeat = std::atoi(argv[1]);
+    }
+    if (argc > 2) {
+        frameSize = std::atoi(argv[2]);
+    }
+    if ((nRepeat < 1) || (frameSize < 64)) {
+        std::cerr << "Usage: " << argv[0] << " [nRepeat [frameSize]]" << std::endl;
+        return 1;
+    }
+
+    afwMath::Random rand(afwMath::Random::MT19937, 1);
+
+    benchmarkBasisLists(nRepeat);
+    benchmarkStaticKernelSolution(nRepeat, rand);
+    benchmarkEstimateRisk(nRepeat, rand);
+    benchmarkSpatialKernelSolution(nRepeat, frameSize, rand);
+    benchmarkConvolveAndSubtract(nRepeat, frameSize, rand);
+    benchmarkPsfDipoleFlux(nRepeat, rand);
+    return 0;
+}
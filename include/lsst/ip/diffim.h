@@ -31,9 +31,11 @@
 #include "lsst/ip/diffim/ImageSubtract.h"
 #include "lsst/ip/diffim/ImageStatistics.h"
 #include "lsst/ip/diffim/FindSetBits.h"
+#include "lsst/ip/diffim/Instrumentation.h"
 
 #include "lsst/ip/diffim/KernelSolution.h"
 #include "lsst/ip/diffim/KernelCandidate.h"
+#include "lsst/ip/diffim/KernelCandidateRegistry.h"
 #include "lsst/ip/diffim/KernelCandidateDetection.h"
 
 #include "lsst/ip/diffim/KernelPca.h"
@@ -41,6 +43,7 @@
 #include "lsst/ip/diffim/BuildSingleKernelVisitor.h"
 #include "lsst/ip/diffim/BuildSpatialKernelVisitor.h"
 #include "lsst/ip/diffim/KernelSumVisitor.h"
+#include "lsst/ip/diffim/PsfMatchSolver.h"
 
 #include "lsst/ip/diffim/DipoleAlgorithms.h"
 
@@ -35,11 +35,15 @@ namespace detail {
             );
         virtual ~AssessSpatialKernelVisitor() {};
 
-        void reset() {_nGood = 0; _nRejected = 0; _nProcessed = 0;}
+        void reset() {_nGood = 0; _nRejected = 0; _nProcessed = 0; _nFailed = 0;}
 
         int getNGood() {return _nGood;}
         int getNRejected() {return _nRejected;}
         int getNProcessed() {return _nProcessed;}
+        /* Set BAD because their residuals could not be measured */
+        int getNFailed() {return _nFailed;}
+        /* Uninitialized candidates are rejected unless assessing e.g. a prior spatial kernel */
+        void setAssessUninitialized(bool assess) {_assessUninitialized = assess;}
         void processCandidate(lsst::afw::math::SpatialCellCandidate *candidate);
 
     private:
@@ -50,9 +54,11 @@ namespace detail {
         int _nGood;                           ///< Number of good candidates remaining
         int _nRejected;                       ///< Number of candidates rejected during processCandidate()
         int _nProcessed;                      ///< Number of candidates processed during processCandidate()
+        int _nFailed;                         ///< Number of candidates whose statistics failed
        
         bool _useCoreStats;                   ///< Extracted from policy
         int _coreRadius;                      ///< Extracted from policy
+        bool _assessUninitialized;            ///< Assess candidates without a kernel solution
     };
 
     template<typename PixelT>
@@ -12,6 +12,9 @@
 #ifndef LSST_IP_DIFFIM_BASISSETS_H
 #define LSST_IP_DIFFIM_BASISSETS_H
 
+#include <map>
+#include <string>
+
 #include "boost/shared_ptr.hpp"
 
 #include "Eigen/Core"
@@ -109,6 +112,29 @@ namespace diffim {
         lsst::afw::math::KernelList const &kernelListIn
         );
 
+    /**
+     * @brief Orthonormalize a list of basis kernels
+     *
+     * @note The first kernel keeps Ksum_0 = 1.0 and all others Ksum_i = 0.0;
+     * K_i.dot.K_j = delta_ij for i,j > 0 and K_0.dot.K_i = 0.0 under the
+     * chosen inner product.  This removes the near-degeneracy of the kernel
+     * images themselves; the normal matrix C^T W C also depends on the
+     * template each basis is convolved with and on the weights, so it is not
+     * diagonal in general.
+     * @note Output list of shared pointers to FixedKernels; linearly dependent
+     * kernels are dropped, so it may be shorter than the input list
+     *
+     * @param kernelListIn input list of basis kernels
+     * @param weightSigma  if > 0, width of a Gaussian weight about the kernel
+     * center used in the inner product; otherwise all pixels have unit weight
+     *
+     * @ingroup ip_diffim
+     */
+    lsst::afw::math::KernelList orthonormalizeKernelList(
+        lsst::afw::math::KernelList const &kernelListIn,
+        double weightSigma = 0.
+        );
+
     /**
      * @brief Build a set of Alard/Lupton basis kernels
      *
@@ -129,6 +155,103 @@ namespace diffim {
         std::vector<int>    const& degGauss    ///< local spatial variation of gaussians
         );
 
+    /**
+     * @brief Compact description of a delta-function ("pixel") basis set
+     *
+     * @note Records only the kernel dimensions, center, and the pixel set by
+     * each basis function.  Code paths that recognise it turn coefficient
+     * vectors directly into kernel images (a reshape), and basis convolutions
+     * into image shifts, without visiting the individual DeltaFunctionKernels.
+     *
+     * @ingroup ip_diffim
+     */
+    class PixelBasis {
+    public:
+        typedef boost::shared_ptr<PixelBasis> Ptr;
+
+        PixelBasis(int width,
+                   int height,
+                   lsst::afw::geom::Point2I const& ctr,
+                   std::vector<lsst::afw::geom::Point2I> const& pixels);
+        virtual ~PixelBasis() {};
+
+        /* Returns an empty pointer if basisList is not made of DeltaFunctionKernels */
+        static Ptr fromKernelList(lsst::afw::math::KernelList const& basisList);
+
+        int getWidth() const {return _width;}
+        int getHeight() const {return _height;}
+        int getNBases() const {return _pixels.size();}
+        lsst::afw::geom::Point2I getCtr() const {return _ctr;}
+        lsst::afw::geom::Point2I getPixel(int i) const {return _pixels[i];}
+
+        /* Fill image with the kernel defined by the first getNBases() coefficients; returns the kernel sum */
+        double computeImage(lsst::afw::image::Image<lsst::afw::math::Kernel::Pixel> &image,
+                            Eigen::VectorXd const& coeffs) const;
+
+    private:
+        int _width;
+        int _height;
+        lsst::afw::geom::Point2I _ctr;
+        std::vector<lsst::afw::geom::Point2I> _pixels;
+    };
+
+    /**
+     * @brief Process-wide cache of basis lists and regularization matrices
+     *
+     * @note Basis lists and regularization matrices depend only on a handful of
+     * configuration values, but are expensive to build.  The cache returns
+     * copies of the objects it holds for identical inputs, so callers may
+     * change what they get.  It may be used from several threads.
+     *
+     * @note If a persistence directory is set, cache misses are first looked
+     * up on disk, and newly built objects are written there, so that separate
+     * processes (e.g. one per CCD) only pay the construction cost once.
+     *
+     * @ingroup ip_diffim
+     */
+    class BasisCache {
+    public:
+        static lsst::afw::math::KernelList getDeltaFunctionBasisList(
+            int width,
+            int height
+            );
+
+        /* If orthonormalize, the basis is passed through orthonormalizeKernelList(basis, orthonormalizeSigma) */
+        static lsst::afw::math::KernelList getAlardLuptonBasisList(
+            int halfWidth,
+            int nGauss,
+            std::vector<double> const& sigGauss,
+            std::vector<int>    const& degGauss,
+            bool orthonormalize = false,
+            double orthonormalizeSigma = 0.
+            );
+
+        static boost::shared_ptr<Eigen::MatrixXd> getRegularizationMatrix(
+            lsst::pex::policy::Policy policy
+            );
+
+        /* Directory for on-disk persistence; empty string disables it */
+        static void setPersistenceDir(std::string const& dir);
+        static std::string getPersistenceDir();
+
+        static void clear();
+        static int getNHits();
+        static int getNMisses();
+
+    private:
+        static std::map<std::string, lsst::afw::math::KernelList> _basisLists;
+        static std::map<std::string, boost::shared_ptr<Eigen::MatrixXd> > _hMats;
+        static std::string _persistenceDir;
+        static int _nHits;
+        static int _nMisses;
+
+        static std::string _getPath(std::string const& key);
+        static bool _readBasisList(std::string const& key, lsst::afw::math::KernelList &basisList);
+        static void _writeBasisList(std::string const& key, lsst::afw::math::KernelList const& basisList);
+        static boost::shared_ptr<Eigen::MatrixXd> _readMatrix(std::string const& key);
+        static void _writeMatrix(std::string const& key, Eigen::MatrixXd const& mat);
+    };
+
 }}} // end of namespace lsst::ip::diffim
 
 #endif
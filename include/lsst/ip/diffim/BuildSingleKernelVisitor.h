@@ -20,6 +20,7 @@
 #include "lsst/pex/policy/Policy.h"
 
 #include "lsst/ip/diffim/ImageStatistics.h"
+#include "lsst/ip/diffim/KernelSolution.h"
 
 namespace lsst { 
 namespace ip { 
@@ -55,6 +56,9 @@ namespace detail {
         int getNRejected()    {return _nRejected;}
         int getNProcessed()   {return _nProcessed;}
         void reset()          {_nRejected = 0; _nProcessed = 0;}
+
+        /* Buffers reused by all the builds of this visitor */
+        KernelBuildWorkspace::Ptr getWorkspace() {return _workspace;}
         
         void processCandidate(lsst::afw::math::SpatialCellCandidate *candidate);
 
@@ -67,6 +71,7 @@ namespace detail {
         int _nRejected;                       ///< Number of candidates rejected during processCandidate()
         int _nProcessed;                      ///< Number of candidates processed during processCandidate()
         bool _useRegularization;              ///< Regularize if delta function basis
+        KernelBuildWorkspace::Ptr _workspace; ///< Scratch for the candidate builds
 
         bool _useCoreStats;                   ///< Extracted from _policy
         int _coreRadius;                      ///< Extracted from _policy
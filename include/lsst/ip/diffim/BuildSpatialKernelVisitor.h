@@ -12,6 +12,8 @@
 #ifndef LSST_IP_DIFFIM_BUILDSPATIALKERNELVISITOR_H
 #define LSST_IP_DIFFIM_BUILDSPATIALKERNELVISITOR_H
 
+#include <map>
+
 #include "Eigen/Core"
 #include "lsst/afw/math.h"
 #include "lsst/afw/image.h"
@@ -35,6 +37,9 @@ namespace detail {
             );
 
         int getNCandidates() {return _nCandidates;}
+        /* Constraints added to / removed from the solution in the last pass */
+        int getNAdded() {return _nAdded;}
+        int getNRemoved() {return _nRemoved;}
 
         void processCandidate(lsst::afw::math::SpatialCellCandidate *candidate);
 
@@ -46,8 +51,25 @@ namespace detail {
                   lsst::afw::math::Kernel::SpatialFunctionPtr> getSolutionPair();
 
     private:
+        /* A candidate's contribution to _kernelSolution */
+        struct Constraint {
+            int epoch;                                ///< KernelCandidate::getEpoch() when added
+            float xCenter;
+            float yCenter;
+            boost::shared_ptr<Eigen::MatrixXd> qMat;
+            boost::shared_ptr<Eigen::VectorXd> wVec;
+            bool visited;                             ///< Visited in the current pass
+        };
+
         boost::shared_ptr<SpatialKernelSolution> _kernelSolution;
-        int _nCandidates;                  ///< Number of candidates visited
+        std::map<int, Constraint> _constraints;   ///< Constraints in _kernelSolution, by candidate id
+        bool _newPass;                            ///< Next visit starts a new pass
+        int _nCandidates;                         ///< Number of candidates visited
+        int _nAdded;                              ///< Constraints added this pass
+        int _nRemoved;                            ///< Constraints removed this pass
+
+        void _beginPass();
+        void _removeConstraint(typename std::map<int, Constraint>::iterator iter);
     };
 
     template<typename PixelT>
@@ -68,8 +68,24 @@ public:
     LSST_CONTROL_FIELD(stepSizeFlux, float, "Default initial step size for flux in non-linear fitter");
     LSST_CONTROL_FIELD(errorDef, double, "How many sigma the error bars of the non-linear fitter represent");
     LSST_CONTROL_FIELD(maxFnCalls, int, "Maximum function calls for non-linear fitter; 0 = unlimited");
+    LSST_CONTROL_FIELD(psfCacheOversample, int, "Sub-pixel steps per pixel of the cached Psf realisations "
+                       "interpolated (bicubic) during the fit; <= 0 evaluates the Psf model at every step. "
+                       "On by default: the interpolation error is O(oversample**-3), below 1e-4 of the "
+                       "peak for a Gaussian Psf of width 2 pixels at the default of 4, so fitted values "
+                       "differ slightly from those with the exact Psf");
+    LSST_CONTROL_FIELD(fitFluxesLinearly, bool, "Fit only the lobe centroids non-linearly, solving for the "
+                       "sign-constrained fluxes by linear least squares at each step");
+    LSST_CONTROL_FIELD(seedFromNaive, bool, "Start the fit from the naive lobe centroids, with fluxes from "
+                       "a linear fit at those centroids, rather than from the footprint peaks");
+    LSST_CONTROL_FIELD(naiveCentroidName, std::string, "Name of the naive dipole centroid fields used by "
+                       "seedFromNaive");
+    LSST_CONTROL_FIELD(naiveFluxName, std::string, "Name of the naive dipole flux fields used by "
+                       "seedFromNaive when the linear flux fit fails; ignored if not in the schema");
     PsfDipoleFluxControl() : DipoleFluxControl(),
-                             stepSizeCoord(0.1), stepSizeFlux(1.0), errorDef(1.0), maxFnCalls(100000) {}
+                             stepSizeCoord(0.1), stepSizeFlux(1.0), errorDef(1.0), maxFnCalls(100000),
+                             psfCacheOversample(4), fitFluxesLinearly(false), seedFromNaive(false),
+                             naiveCentroidName("ip_diffim_NaiveDipoleCentroid"),
+                             naiveFluxName("ip_diffim_NaiveDipoleFlux") {}
 };
 
 /**
@@ -308,6 +324,9 @@ private:
 
 
 
+struct PsfDipoleFitSeed;
+struct PsfDipoleFitResult;
+
 /**
  * Implementation of Psf dipole flux
  */
@@ -328,6 +347,16 @@ public:
         _posCentroid = meas::base::CentroidResultKey(schema[name+"_pos_centroid"]);
         _negCentroid = meas::base::CentroidResultKey(schema[name+"_neg_centroid"]);
         _avgCentroid = meas::base::CentroidResultKey(schema[name+"_centroid"]);
+        if (ctrl.seedFromNaive) {
+            _naivePosCentroid = meas::base::CentroidResultKey(schema[ctrl.naiveCentroidName+"_pos"]);
+            _naiveNegCentroid = meas::base::CentroidResultKey(schema[ctrl.naiveCentroidName+"_neg"]);
+            try {
+                _naivePosFlux = meas::base::FluxResultKey(schema[ctrl.naiveFluxName+"_pos"]);
+                _naiveNegFlux = meas::base::FluxResultKey(schema[ctrl.naiveFluxName+"_neg"]);
+            } catch (pex::exceptions::NotFoundError &) {
+                // Optional; the naive fluxes may not be measured, or not yet
+            }
+        }
     }
     std::pair<double,int> chi2(afw::table::SourceRecord & source,
                 afw::image::Exposure<float> const & exposure,
@@ -335,11 +364,33 @@ public:
                 double posCenterX, double poCenterY, double posFlux
                 ) const;
 
+    /// Derivatives of chi2 with respect to the fit parameters, in the order of the chi2 arguments
+    std::vector<double> gradient(afw::table::SourceRecord & source,
+                                 afw::image::Exposure<float> const & exposure,
+                                 double negCenterX, double negCenterY, double negFlux,
+                                 double posCenterX, double posCenterY, double posFlux
+                                 ) const;
+
     void measure(
         afw::table::SourceRecord & measRecord,
         afw::image::Exposure<float> const & exposure
     ) const;
 
+    /**
+     *  @brief Measure every source in the catalog, fitting concurrently
+     *
+     *  Equivalent to calling measure (and fail, on error) for each record in
+     *  turn.  The fits run on nThreads threads (<= 0 for one per core); data
+     *  extraction and writing of the results stay serial and in catalog order.
+     *  Sources are processed in chunks of a few per thread, so memory held
+     *  for the fits does not grow with the size of the catalog.
+     */
+    void measureAll(
+        afw::table::SourceCatalog & sources,
+        afw::image::Exposure<float> const & exposure,
+        int nThreads=0
+    ) const;
+
     void fail(
         afw::table::SourceRecord & measRecord,
         meas::base::MeasurementError * error=NULL
@@ -347,11 +398,19 @@ public:
 
 private:
 
+    /// Starting point from the footprint peaks; false if there is only one peak
+    bool _makeSeed(afw::table::SourceRecord const & source, PsfDipoleFitSeed & seed) const;
+    void _setResult(afw::table::SourceRecord & source, PsfDipoleFitResult const & fit) const;
+
     Control _ctrl;
     afw::table::Key<float> _chi2dofKey;
     meas::base::CentroidResultKey  _avgCentroid;
     meas::base::CentroidResultKey  _negCentroid;
     meas::base::CentroidResultKey  _posCentroid;
+    meas::base::CentroidResultKey  _naiveNegCentroid;
+    meas::base::CentroidResultKey  _naivePosCentroid;
+    meas::base::FluxResultKey  _naiveNegFlux;
+    meas::base::FluxResultKey  _naivePosFlux;
 
 };
 
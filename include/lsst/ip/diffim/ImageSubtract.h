@@ -104,6 +104,37 @@ namespace diffim {
     Eigen::MatrixXi maskToEigenMatrix(
         lsst::afw::image::Mask<lsst::afw::image::MaskPixel> const& mask
         );
+
+    /**
+     * @brief Type of the read-only Eigen view returned by imageToEigenMap
+     *
+     * @ingroup ip_diffim
+     */
+    template <typename PixelT>
+    struct EigenImageMap {
+        typedef Eigen::Map<Eigen::Matrix<PixelT, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> const,
+                           Eigen::Unaligned, Eigen::OuterStride<> > Type;
+    };
+
+    /**
+     * @brief Views the pixels of a 2-d Image (or Mask) as an Eigen Matrix, without copying
+     *
+     * @note Unlike imageToEigenMatrix, rows of the view run with image y, so
+     * that (row, col) of the view is the LOCAL (y, x) of the image.  The view
+     * is only valid as long as the image's pixels are.
+     *
+     * @param img  Image whose pixels are viewed
+     *
+     * @ingroup ip_diffim
+     */
+    template <typename PixelT>
+    typename EigenImageMap<PixelT>::Type imageToEigenMap(
+        lsst::afw::image::ImageBase<PixelT> const& img
+        ) {
+        return typename EigenImageMap<PixelT>::Type(img.getArray().getData(),
+                                                    img.getHeight(), img.getWidth(),
+                                                    Eigen::OuterStride<>(img.getArray().getStrides()[0]));
+    }
     
 }}} // end of namespace lsst::ip::diffim
 
@@ -0,0 +1,111 @@
+// -*- lsst-c++ -*-
+/**
+ * @file Instrumentation.h
+ *
+ * @brief Declaration of Instrumentation
+ *
+ * @ingroup ip_diffim
+ */
+
+#ifndef LSST_IP_DIFFIM_INSTRUMENTATION_H
+#define LSST_IP_DIFFIM_INSTRUMENTATION_H
+
+#include <string>
+
+namespace lsst {
+namespace ip {
+namespace diffim {
+
+    /**
+     * @brief Process-wide wall-clock timers and counters for the image subtraction hot paths
+     *
+     * @note Each phase accumulates the number of calls, the wall-clock time,
+     * the bytes of the matrices and images filled (whether newly allocated or
+     * reused from a KernelBuildWorkspace) and an estimate of the floating
+     * point operations.  Flop counts are the leading terms of the operation
+     * counts, e.g. n k^2 for the upper triangle of a k x k normal matrix
+     * over n pixels; they are for comparing runs, not hardware counters.
+     *
+     * @note Disabled by default; a disabled Timer reads no clock and records
+     * nothing, so the cost is a test of one flag per call.  That flag is read
+     * without a lock, so setEnabled() may only be called while no other thread
+     * is using Instrumentation (e.g. not during PsfDipoleFlux::measureAll).
+     * Recording and reading the counters are locked.
+     *
+     * @code
+        Instrumentation::setEnabled(true);
+        {
+            Instrumentation::Timer timer(Instrumentation::SOLVE);
+            ...
+            timer.addFlops(2. * n * n * n / 3.);
+        }
+        double seconds = Instrumentation::getSeconds(Instrumentation::SOLVE);
+     * @endcode
+     *
+     * @ingroup ip_diffim
+     */
+    class Instrumentation {
+    public:
+        enum Phase {
+            BASIS_CONVOLUTION  = 0,   ///< Template convolved with the basis, into C
+            NORMAL_EQUATIONS   = 1,   ///< M = C^T W C and B = C^T W I
+            SOLVE              = 2,   ///< Single kernel and spatial normal equations solved
+            RESIDUALS          = 3,   ///< Difference images, by convolveAndSubtract
+            SPATIAL_ACCUMULATE = 4,   ///< Candidate constraints added to or removed from the spatial fit
+            NPHASES            = 5
+        };
+
+        /* Only while single-threaded; see above */
+        static void setEnabled(bool enabled) {_enabled = enabled;}
+        static bool isEnabled() {return _enabled;}
+        /* Zero all the counters */
+        static void reset();
+
+        static std::string getPhaseName(Phase phase);
+        static int getNCalls(Phase phase);
+        static double getSeconds(Phase phase);
+        static double getBytes(Phase phase);
+        static double getFlops(Phase phase);
+
+        /**
+         * @brief Times one call of a phase, from construction to destruction
+         *
+         * @note Bytes and flops added to the timer are recorded with the call
+         */
+        class Timer {
+        public:
+            explicit Timer(Phase phase);
+            ~Timer();
+
+            bool isActive() const {return _active;}
+            /* Seconds since the call started; 0 if not active */
+            double elapsed() const;
+            void addBytes(double nBytes) {_bytes += nBytes;}
+            void addFlops(double nFlops) {_flops += nFlops;}
+            /* Ends the call before the timer goes out of scope */
+            void stop();
+
+        private:
+            Phase _phase;
+            bool _active;
+            double _start;
+            double _bytes;
+            double _flops;
+
+            Timer(Timer const&);
+            Timer& operator=(Timer const&);
+        };
+
+    private:
+        static bool _enabled;
+        static int _nCalls[NPHASES];
+        static double _seconds[NPHASES];
+        static double _bytes[NPHASES];
+        static double _flops[NPHASES];
+
+        static void _record(Phase phase, double seconds, double nBytes, double nFlops);
+    };
+
+}}} // end of namespace lsst::ip::diffim
+
+#endif
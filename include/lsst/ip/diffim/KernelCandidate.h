@@ -12,6 +12,8 @@
 #ifndef LSST_IP_DIFFIM_KERNELCANDIDATE_H
 #define LSST_IP_DIFFIM_KERNELCANDIDATE_H
 
+#include <cstddef>
+
 #include "boost/shared_ptr.hpp"
 #include "Eigen/Core"
 
@@ -91,8 +93,20 @@ namespace diffim {
          * @brief Return Candidate rating
          *
          * @note Required method for use by SpatialCell; e.g. total flux
+         *
+         * @note Unless supplied, the mean of the science image core is
+         * measured on the first call, not on construction.  A SpatialCell
+         * sorts by rating, so inserting into an occupied cell measures it;
+         * supply the rating to avoid that.  A stamp that cannot be measured
+         * is rated 0; its status is left to BuildSingleKernelVisitor.
          */
-        double getCandidateRating() const { return _coreFlux; }
+        double getCandidateRating() const;
+        /**
+         * @brief Supply the rating, e.g. from a catalog flux column, rather than measure it
+         *
+         * @note Must be called before the candidate is inserted into a SpatialCell
+         */
+        void setCandidateRating(double rating) {_coreFlux = rating; _hasRating = true;}
         /**
          * @brief Return the original source
          */
@@ -113,6 +127,14 @@ namespace diffim {
         PTR(ImageT) getKernelImage(CandidateSwitch cand) const;
         CONST_PTR(ImageT) getImage() const; // For SpatialCellImageCandidate
         boost::shared_ptr<StaticKernelSolution<PixelT> > getKernelSolution(CandidateSwitch cand) const;
+        /**
+         * @brief Adopt a previously solved kernel solution, e.g. from a checkpoint
+         *
+         * @note Setting ORIG initializes the candidate as build() would; counts
+         * as a build for getEpoch()
+         */
+        void setKernelSolution(CandidateSwitch cand,
+                               boost::shared_ptr<StaticKernelSolution<PixelT> > solution);
 
         /**
          * @brief Calculate associated difference image using internal solutions
@@ -131,6 +153,29 @@ namespace diffim {
 
         bool isInitialized() const {return _isInitialized;}
 
+        /**
+         * @brief Number of times build() has been called on this candidate
+         *
+         * @note Visitors that keep per-candidate results between passes
+         * compare this to the value they recorded to decide whether the
+         * candidate's kernel solution has changed since.
+         */
+        int getEpoch() const {return _epoch;}
+
+        /**
+         * @brief Free the memory held for the kernel solutions down to level
+         *
+         * @note build() applies the kernelSolutionRetention level of the
+         * policy, but never below NORMAL_EQUATIONS since the spatial fit needs
+         * M and B; COEFFICIENTS is applied once the spatial fit is done.
+         */
+        void release(KernelSolution::RetentionLevel level);
+
+        /**
+         * @brief Bytes held by the kernel solutions and the variance estimate
+         */
+        std::size_t getBytesRetained() const;
+
 
         /**
          * @brief Core functionality of KernelCandidate, to build and fill a KernelSolution
@@ -185,6 +230,12 @@ namespace diffim {
             afw::math::KernelList const& basisList,
             boost::shared_ptr<Eigen::MatrixXd> hMat
             );
+        /* Draws its matrices and convolution image from workspace */
+        void build(
+            afw::math::KernelList const& basisList,
+            boost::shared_ptr<Eigen::MatrixXd> hMat,
+            KernelBuildWorkspace::Ptr workspace
+            );
 
     private:
         MaskedImagePtr _templateMaskedImage;                ///< Subimage around which you build kernel
@@ -192,8 +243,10 @@ namespace diffim {
         VariancePtr _varianceEstimate;                      ///< Estimate of the local variance
         pex::policy::Policy _policy;                  ///< Policy
         SourcePtr _source;
-        double _coreFlux;                                   ///< Mean S/N in the science image
+        mutable double _coreFlux;                           ///< Mean S/N in the science image
+        mutable bool _hasRating;                            ///< _coreFlux supplied or measured
         bool _isInitialized;                                ///< Has the kernel been built
+        int _epoch;                                         ///< Incremented by each build
         bool _useRegularization;                            ///< Use regularization?
         bool _fitForBackground;
 
@@ -203,11 +256,30 @@ namespace diffim {
         /* with Pca basis */
         boost::shared_ptr<StaticKernelSolution<PixelT> > _kernelSolutionPca;  ///< Most recent  solution
 
+        void _measureRating() const;
         void _buildKernelSolution(afw::math::KernelList const& basisList,
-                                  boost::shared_ptr<Eigen::MatrixXd> hMat);
+                                  boost::shared_ptr<Eigen::MatrixXd> hMat,
+                                  KernelBuildWorkspace::Ptr workspace);
     };
 
 
+    /**
+     * @brief Total KernelCandidate::getBytesRetained() over all candidates of a cell set
+     *
+     * @ingroup ip_diffim
+     */
+    template <typename PixelT>
+    std::size_t getBytesRetained(afw::math::SpatialCellSet &kernelCellSet);
+
+    /**
+     * @brief KernelCandidate::release() all candidates of a cell set
+     *
+     * @ingroup ip_diffim
+     */
+    template <typename PixelT>
+    void releaseKernelSolutions(afw::math::SpatialCellSet &kernelCellSet,
+                                KernelSolution::RetentionLevel level);
+
     /**
      * @brief Return a KernelCandidate pointer of the right sort
      *
@@ -233,6 +305,35 @@ namespace diffim {
                                                                                  policy));
     }
 
+    /**
+     * @brief Return a KernelCandidate pointer of the right sort, with the rating supplied
+     *
+     * @param xCenter  X-center of candidate
+     * @param yCenter  Y-center of candidate
+     * @param templateMaskedImage  Template subimage 
+     * @param scienceMaskedImage  Science image subimage
+     * @param policy   Policy file
+     * @param rating   Candidate rating, e.g. a catalog flux; the image is not measured
+     *
+     * @ingroup ip_diffim
+     */
+    template <typename PixelT>
+    boost::shared_ptr<KernelCandidate<PixelT> >
+    makeKernelCandidate(float const xCenter,
+                        float const yCenter,
+                        boost::shared_ptr<afw::image::MaskedImage<PixelT> > const& templateMaskedImage,
+                        boost::shared_ptr<afw::image::MaskedImage<PixelT> > const& scienceMaskedImage,
+                        pex::policy::Policy const& policy,
+                        double rating){
+
+        typename KernelCandidate<PixelT>::Ptr candidate(new KernelCandidate<PixelT>(xCenter, yCenter,
+                                                                                    templateMaskedImage,
+                                                                                    scienceMaskedImage,
+                                                                                    policy));
+        candidate->setCandidateRating(rating);
+        return candidate;
+    }
+
     /**
      * @brief Return a KernelCandidate pointer of the right sort
      *
@@ -43,6 +43,12 @@ namespace diffim {
 
         void apply(MaskedImagePtr const& templateMaskedImage,
                    MaskedImagePtr const& scienceMaskedImage);
+
+        void apply(MaskedImagePtr const& templateMaskedImage,
+                   MaskedImagePtr const& scienceMaskedImage,
+                   int sizeCellX,
+                   int sizeCellY,
+                   int nStarPerCell);
         
         bool growCandidate(lsst::afw::detection::Footprint::Ptr fp,
                            int fpGrowPix,
@@ -53,6 +59,9 @@ namespace diffim {
 
     private:
         lsst::pex::policy::Policy _policy;
+        boost::shared_ptr<std::vector<lsst::afw::detection::Footprint::Ptr> > _detect(
+            MaskedImagePtr const& templateMaskedImage,
+            MaskedImagePtr const& scienceMaskedImage);
         lsst::afw::image::MaskPixel _badBitMask;
         std::vector<lsst::afw::detection::Footprint::Ptr> _footprints;
     };
@@ -0,0 +1,92 @@
+// -*- lsst-c++ -*-
+/**
+ * @file KernelCandidateRegistry.h
+ *
+ * @brief Declaration of KernelCandidateRegistry
+ *
+ * @ingroup ip_diffim
+ */
+
+#ifndef LSST_IP_DIFFIM_KERNELCANDIDATEREGISTRY_H
+#define LSST_IP_DIFFIM_KERNELCANDIDATEREGISTRY_H
+
+#include <vector>
+
+#include "boost/shared_ptr.hpp"
+
+#include "lsst/afw/math.h"
+
+#include "lsst/ip/diffim/KernelCandidate.h"
+
+namespace lsst {
+namespace ip {
+namespace diffim {
+
+    /**
+     * @brief Structure-of-arrays copy of the scalars of the KernelCandidates in a SpatialCellSet
+     *
+     * @note Each candidate is cast once, on construction, and its position,
+     * status, chi2, kernel sum, background, id and cell kept in contiguous
+     * arrays.  These are ordered by cell and then by rating within the cell,
+     * the order in which SpatialCellSet::visitCandidates visits them.
+     * Aggregations such as kernel sum clipping then run as loops over the
+     * arrays instead of visitor passes.
+     *
+     * @note Visitors still change the candidates themselves; sync() copies
+     * their state back into the arrays.  setStatus() writes through to the
+     * candidate.  Like a visitor, the registry holds plain pointers to the
+     * candidates, and the cell set must not gain or lose candidates while it
+     * is in use.
+     *
+     * @note The kernel sum and background are of the ORIG solution, and NaN
+     * if the candidate has none.
+     *
+     * @ingroup ip_diffim
+     */
+    template <typename PixelT>
+    class KernelCandidateRegistry {
+    public:
+        typedef boost::shared_ptr<KernelCandidateRegistry<PixelT> > Ptr;
+
+        explicit KernelCandidateRegistry(lsst::afw::math::SpatialCellSet &kernelCellSet);
+        virtual ~KernelCandidateRegistry() {};
+
+        /* Refresh all candidates */
+        void sync();
+        /* Refresh the candidates visitCandidates(visitor, nMaxPerCell) would visit; returns their indices */
+        std::vector<int> sync(int nMaxPerCell);
+
+        int size() const {return _candidates.size();}
+        int getNCells() const {return _nCells;}
+        int countStatus(lsst::afw::math::SpatialCellCandidate::Status status) const;
+
+        std::vector<double> const& getXCenter() const {return _xCenter;}
+        std::vector<double> const& getYCenter() const {return _yCenter;}
+        std::vector<int> const& getStatus() const {return _status;}
+        std::vector<double> const& getChi2() const {return _chi2;}
+        std::vector<double> const& getKsum() const {return _kSum;}
+        std::vector<double> const& getBackground() const {return _background;}
+        std::vector<int> const& getId() const {return _id;}
+        std::vector<int> const& getCellIndex() const {return _cellIndex;}
+
+        void setStatus(int index, lsst::afw::math::SpatialCellCandidate::Status status);
+        KernelCandidate<PixelT> *getCandidate(int index) const {return _candidates[index];}
+
+    private:
+        std::vector<KernelCandidate<PixelT> *> _candidates; ///< Owned by the cell set
+        int _nCells;                                        ///< Cells in the cell set
+        std::vector<double> _xCenter;                       ///< Candidate positions
+        std::vector<double> _yCenter;
+        std::vector<int> _status;                           ///< SpatialCellCandidate::Status
+        std::vector<double> _chi2;
+        std::vector<double> _kSum;                          ///< Of the ORIG solution
+        std::vector<double> _background;                    ///< Of the ORIG solution
+        std::vector<int> _id;
+        std::vector<int> _cellIndex;                        ///< Index into the cell list
+
+        void _sync(int index);
+    };
+
+}}} // end of namespace lsst::ip::diffim
+
+#endif
@@ -20,20 +20,49 @@ namespace ip {
 namespace diffim { 
 namespace detail {
 
+    /**
+     * @brief Principal component analysis of kernel images
+     *
+     * @note Uses the snapshot method: the n x n Gram matrix of the n input
+     * images is eigendecomposed, and only the leading nComponents eigenimages
+     * are formed (all of them if nComponents is ALL_COMPONENTS).  Kernels
+     * typically have many more pixels than there are candidates, so this is
+     * much cheaper than working in pixel space.  All images carry equal
+     * weight; a KernelPca may not be constructed with constantWeight false.
+     *
+     * @note The results are kept in KernelPca itself and read through its own
+     * getEigenValues() and getEigenImages(), which hide those of the ImagePca
+     * base.  The base accessors are not filled in by analyze().
+     */
     template <typename ImageT>
     class KernelPca : public lsst::afw::image::ImagePca<ImageT> {
         typedef typename lsst::afw::image::ImagePca<ImageT> Super; ///< Base class
     public:
         typedef typename boost::shared_ptr<KernelPca<ImageT> > Ptr;
-        using lsst::afw::image::ImagePca<ImageT>::getEigenImages;
-        using lsst::afw::image::ImagePca<ImageT>::getEigenValues;
+        typedef typename Super::ImageList ImageList;
         using lsst::afw::image::ImagePca<ImageT>::addImage;
 
-        /// Ctor
-        explicit KernelPca(bool constantWeight=true) : Super(constantWeight) {}
+        enum {ALL_COMPONENTS = -1};
+
+        /// Ctor; throws if constantWeight is false, which is not supported
+        explicit KernelPca(bool constantWeight=true, int nComponents=ALL_COMPONENTS);
         
         /// Generate eigenimages that are normalised 
         virtual void analyze();
+
+        /// Number of eigenimages to generate; ALL_COMPONENTS (or any negative value) for all
+        void setNComponents(int nComponents) {_nComponents = nComponents;}
+        int getNComponents() const {return _nComponents;}
+
+        /// All eigenvalues, in decreasing order
+        std::vector<double> const& getEigenValues() const {return _eigenValues;}
+        /// The leading eigenimages, in order of decreasing eigenvalue
+        ImageList const& getEigenImages() const {return _eigenImages;}
+
+    private:
+        int _nComponents;
+        std::vector<double> _eigenValues;
+        ImageList _eigenImages;
     };
     
     template<typename PixelT>
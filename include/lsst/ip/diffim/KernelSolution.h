@@ -12,13 +12,21 @@
 #ifndef LSST_IP_DIFFIM_KERNELSOLUTION_H
 #define LSST_IP_DIFFIM_KERNELSOLUTION_H
 
+#include <cstddef>
+#include <list>
+#include <string>
+#include <vector>
+
 #include "boost/shared_ptr.hpp"
 #include "Eigen/Core"
+#include "Eigen/Cholesky"
 
 #include "lsst/afw/math.h"
 #include "lsst/afw/geom.h"
 #include "lsst/afw/image.h"
 
+#include "lsst/ip/diffim/BasisLists.h"
+
 namespace lsst { 
 namespace ip { 
 namespace diffim {
@@ -46,6 +54,15 @@ namespace diffim {
             SVD        = 1
         };
 
+        /* 
+         * @brief What to keep once solved; see release()
+         */
+        enum RetentionLevel {
+            FULL             = 0,   ///< Everything used to build the solution
+            NORMAL_EQUATIONS = 1,   ///< M, B and the solution
+            COEFFICIENTS     = 2    ///< The solution only
+        };
+
         explicit KernelSolution(boost::shared_ptr<Eigen::MatrixXd> mMat,
                                 boost::shared_ptr<Eigen::VectorXd> bVec,
                                 bool fitForBackground);
@@ -62,11 +79,25 @@ namespace diffim {
 
         inline boost::shared_ptr<Eigen::MatrixXd> getM() {return _mMat;}
         inline boost::shared_ptr<Eigen::VectorXd> getB() {return _bVec;}
+        inline boost::shared_ptr<Eigen::VectorXd> getA() {return _aVec;}
         void printM() {std::cout << *_mMat << std::endl;}
         void printB() {std::cout << *_bVec << std::endl;}
         void printA() {std::cout << *_aVec << std::endl;}
         inline int getId() const { return _id; }
 
+        /* Free the matrices not needed at level; they cannot be rebuilt */
+        virtual void release(RetentionLevel level);
+        /* Bytes held in matrices and vectors */
+        virtual std::size_t getBytesRetained() const;
+        /* From "full", "normal-equations" or "coefficients" */
+        static RetentionLevel getRetentionLevel(std::string const& level);
+
+        /* Adopt a solution made elsewhere (e.g. a checkpoint) instead of building and solving; M and B may be empty */
+        virtual void restore(boost::shared_ptr<Eigen::MatrixXd> mMat,
+                             boost::shared_ptr<Eigen::VectorXd> bVec,
+                             boost::shared_ptr<Eigen::VectorXd> aVec,
+                             KernelSolvedBy solvedBy);
+
     protected:
         int _id;                                                ///< Unique ID for object
         boost::shared_ptr<Eigen::MatrixXd> _mMat;               ///< Derived least squares M matrix
@@ -78,6 +109,58 @@ namespace diffim {
 
     };
 
+    /**
+     * @brief Reusable scratch and output buffers for StaticKernelSolution::build
+     *
+     * @note Buffers are handed out by exact size and reused once no one else
+     * holds them, so that a steady state of candidate builds (the same stamp
+     * sizes, with released or replaced solutions) allocates no new storage.
+     * Buffers still held by a solution are never handed out again.
+     *
+     * @note Idle buffers are kept, least recently used first to go, up to
+     * maxIdleBytes.  The convolution image only ever grows.
+     *
+     * @note Not thread safe; use one per thread (e.g. one per
+     * BuildSingleKernelVisitor).
+     *
+     * @ingroup ip_diffim
+     */
+    class KernelBuildWorkspace {
+    public:
+        typedef boost::shared_ptr<KernelBuildWorkspace> Ptr;
+        typedef lsst::afw::image::Image<KernelSolution::PixelT> ImageT;
+
+        explicit KernelBuildWorkspace(std::size_t maxIdleBytes = 64 << 20);
+        virtual ~KernelBuildWorkspace() {};
+
+        /* View of the given dimensions (XY0 = 0,0) to convolve into; valid until the next call */
+        ImageT getConvolvedImage(lsst::afw::geom::Extent2I const& dimensions);
+        /* Buffers of exactly the requested size held by no one else; contents are undefined */
+        boost::shared_ptr<Eigen::MatrixXd> getMatrix(int rows, int cols);
+        boost::shared_ptr<Eigen::VectorXd> getVector(int size);
+
+        void setMaxIdleBytes(std::size_t maxIdleBytes) {_maxIdleBytes = maxIdleBytes;}
+        std::size_t getMaxIdleBytes() const {return _maxIdleBytes;}
+        /* Bytes in buffers held only by the workspace */
+        std::size_t getBytesIdle() const;
+        int getNAllocations() const {return _nAllocations;}
+        int getNReused() const {return _nReused;}
+
+    private:
+        std::size_t _maxIdleBytes;                                ///< Idle buffers kept up to this size
+        boost::shared_ptr<ImageT> _cimage;                        ///< Largest convolution image so far
+        std::list<boost::shared_ptr<Eigen::MatrixXd> > _matrices; ///< Most recently used first
+        std::list<boost::shared_ptr<Eigen::VectorXd> > _vectors;  ///< Most recently used first
+        int _nAllocations;                                        ///< Buffers allocated
+        int _nReused;                                             ///< Buffers handed out again
+
+        template <typename T>
+        boost::shared_ptr<T> _acquire(std::list<boost::shared_ptr<T> > &pool, int rows, int cols);
+        template <typename T>
+        std::size_t _trimPool(std::list<boost::shared_ptr<T> > &pool, std::size_t nBytesIdle);
+        void _trim();
+    };
+
     template <typename InputT>
     class StaticKernelSolution : public KernelSolution {
     public:
@@ -93,13 +176,22 @@ namespace diffim {
         /* Used by RegularizedKernelSolution */
         virtual void build(lsst::afw::image::Image<InputT> const &templateImage,
                            lsst::afw::image::Image<InputT> const &scienceImage,
-                           lsst::afw::image::Image<lsst::afw::image::VariancePixel> const &varianceEstimate);
+                           lsst::afw::image::Image<lsst::afw::image::VariancePixel> const &varianceEstimate,
+                           KernelBuildWorkspace::Ptr workspace = KernelBuildWorkspace::Ptr());
         virtual lsst::afw::math::Kernel::Ptr getKernel();
         virtual lsst::afw::image::Image<lsst::afw::math::Kernel::Pixel>::Ptr makeKernelImage();
         virtual double getBackground();
         virtual double getKsum();
         virtual std::pair<boost::shared_ptr<lsst::afw::math::Kernel>, double> getSolutionPair();
 
+        /* Overrides KernelSolution */
+        virtual void release(RetentionLevel level);
+        virtual std::size_t getBytesRetained() const;
+        virtual void restore(boost::shared_ptr<Eigen::MatrixXd> mMat,
+                             boost::shared_ptr<Eigen::VectorXd> bVec,
+                             boost::shared_ptr<Eigen::VectorXd> aVec,
+                             KernelSolvedBy solvedBy);
+
     protected:
         boost::shared_ptr<Eigen::MatrixXd> _cMat;               ///< K_i x R
         boost::shared_ptr<Eigen::VectorXd> _iVec;               ///< Vectorized I
@@ -108,6 +200,7 @@ namespace diffim {
         lsst::afw::math::Kernel::Ptr _kernel;                   ///< Derived single-object convolution kernel
         double _background;                                     ///< Derived differential background estimate
         double _kSum;                                           ///< Derived kernel sum
+        PixelBasis::Ptr _pixelBasis;                            ///< Set if the basis is delta functions
 
         void _setKernel();                                      ///< Set kernel after solution
         void _setKernelUncertainty();                           ///< Not implemented
@@ -132,7 +225,8 @@ namespace diffim {
                                    lsst::afw::image::Image<InputT> const &scienceImage,
                                    lsst::afw::image::Image<lsst::afw::image::VariancePixel> 
                                    const &varianceEstimate,
-                                   lsst::afw::image::Mask<lsst::afw::image::MaskPixel> const &pixelMask);
+                                   lsst::afw::image::Mask<lsst::afw::image::MaskPixel> const &pixelMask,
+                                   KernelBuildWorkspace::Ptr workspace = KernelBuildWorkspace::Ptr());
 
         virtual void buildSingleMaskOrig(lsst::afw::image::Image<InputT> const &templateImage,
                                          lsst::afw::image::Image<InputT> const &scienceImage,
@@ -161,6 +255,14 @@ namespace diffim {
         /* Include additive term (_lambda * _hMat) in M matrix? */
         boost::shared_ptr<Eigen::MatrixXd> getM(bool includeHmat = true);
 
+        using StaticKernelSolution<InputT>::restore;
+        /* Restore a solution found with regularization strength lambda */
+        void restore(boost::shared_ptr<Eigen::MatrixXd> mMat,
+                     boost::shared_ptr<Eigen::VectorXd> bVec,
+                     boost::shared_ptr<Eigen::VectorXd> aVec,
+                     KernelSolution::KernelSolvedBy solvedBy,
+                     double lambda);
+
     private:
         boost::shared_ptr<Eigen::MatrixXd> _hMat;               ///< Regularization weights
         double _lambda;                                         ///< Overall regularization strength
@@ -186,8 +288,29 @@ namespace diffim {
         void addConstraint(float xCenter, float yCenter,
                            boost::shared_ptr<Eigen::MatrixXd> qMat,
                            boost::shared_ptr<Eigen::VectorXd> wVec);
+        /* Undo an addConstraint made with the same arguments */
+        void removeConstraint(float xCenter, float yCenter,
+                              boost::shared_ptr<Eigen::MatrixXd> qMat,
+                              boost::shared_ptr<Eigen::VectorXd> wVec);
+        /* Swap the constraint of a rebuilt candidate */
+        void replaceConstraint(float xCenter, float yCenter,
+                               boost::shared_ptr<Eigen::MatrixXd> qMatOld,
+                               boost::shared_ptr<Eigen::VectorXd> wVecOld,
+                               boost::shared_ptr<Eigen::MatrixXd> qMatNew,
+                               boost::shared_ptr<Eigen::VectorXd> wVecNew);
+        int getNConstraints() const {return _nConstraints;}
+        /* Number of solves that updated the cached factorization instead of refactoring M */
+        int getNUpdatedSolves() const {return _nUpdatedSolves;}
+        /* Rebuild M and B from the current constraints; returns the largest change in M */
+        double rebuild();
+        int getNRebuilds() const {return _nRebuilds;}
 
         void solve();
+        /* Overrides KernelSolution; incremental updates start afresh */
+        virtual void restore(boost::shared_ptr<Eigen::MatrixXd> mMat,
+                             boost::shared_ptr<Eigen::VectorXd> bVec,
+                             boost::shared_ptr<Eigen::VectorXd> aVec,
+                             KernelSolvedBy solvedBy);
         lsst::afw::image::Image<lsst::afw::math::Kernel::Pixel>::Ptr makeKernelImage(lsst::afw::geom::Point2D const& pos);
         std::pair<lsst::afw::math::LinearCombinationKernel::Ptr,
                   lsst::afw::math::Kernel::SpatialFunctionPtr> getSolutionPair();
@@ -199,15 +322,53 @@ namespace diffim {
         lsst::afw::math::LinearCombinationKernel::Ptr _kernel;   ///< Spatial convolution kernel
         lsst::afw::math::Kernel::SpatialFunctionPtr _background; ///< Spatial background model
         double _kSum;                                            ///< Derived kernel sum
+        PixelBasis::Ptr _pixelBasis;                             ///< Set if the basis is delta functions
 
         lsst::pex::policy::Policy _policy;                       ///< Policy to control processing
         int _nbases;                                             ///< Number of basis functions
         int _nkt;                                                ///< Number of kernel terms
         int _nbt;                                                ///< Number of background terms
         int _nt;                                                 ///< Total number of terms
+        int _nConstraints;                                       ///< Number of constraints in M and B
+
+        /* A constraint currently accumulated into M and B */
+        struct Constraint {
+            float xCenter;
+            float yCenter;
+            boost::shared_ptr<Eigen::MatrixXd> qMat;
+            boost::shared_ptr<Eigen::VectorXd> wVec;
+        };
+        std::vector<Constraint> _constraints;                    ///< Constraints making up M and B
+        int _rebuildInterval;                                    ///< Downdated solves between rebuilds
+        bool _downdated;                                         ///< Constraint removed since last solve
+        int _nDowndatedSolves;                                   ///< Downdated solves since last rebuild
+        int _nRebuilds;                                          ///< Number of rebuilds of M and B
+
+        /* A constraint added to or removed from M since the last factorization */
+        struct PendingUpdate {
+            float xCenter;
+            float yCenter;
+            boost::shared_ptr<Eigen::MatrixXd> qMat;
+            double weight;                                       ///< +1 added, -1 removed
+        };
+        bool _useCholesky;                                       ///< Factor and cache M by Cholesky
+        boost::shared_ptr<Eigen::LLT<Eigen::MatrixXd> > _llt;    ///< Factorization of M at the last solve
+        std::vector<PendingUpdate> _pendingUpdates;              ///< Changes to M not yet in _llt
+        int _pendingRank;                                        ///< Upper bound on rank of the changes
+        int _nUpdatedSolves;                                     ///< Solves that reused _llt
 
+        void _recordUpdate(float xCenter, float yCenter,
+                           boost::shared_ptr<Eigen::MatrixXd> qMat,
+                           double weight);
+        bool _applyUpdates();                                    ///< Rank-k update of _llt
+        Eigen::MatrixXd _makePMatrix(float xCenter, float yCenter); ///< Maps candidate terms to M terms
+        void _accumulateConstraint(float xCenter, float yCenter,
+                                   Eigen::MatrixXd const& qMat,
+                                   Eigen::VectorXd const& wVec,
+                                   double weight);             ///< Add weight x constraint to M and B
         void _setKernel();                                       ///< Set kernel after solution
         void _setKernelUncertainty();                            ///< Not implemented
+        Eigen::VectorXd _evaluateCoefficients(lsst::afw::geom::Point2D const& pos); ///< Basis coeffs at pos
     };
 
 }}} // end of namespace lsst::ip::diffim
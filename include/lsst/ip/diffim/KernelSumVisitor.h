@@ -17,6 +17,8 @@
 #include "lsst/afw/image.h"
 #include "lsst/pex/policy/Policy.h"
 
+#include "lsst/ip/diffim/KernelCandidateRegistry.h"
+
 namespace lsst { 
 namespace ip { 
 namespace diffim { 
@@ -42,6 +44,10 @@ namespace detail {
         void resetKernelSum();
         void processCandidate(lsst::afw::math::SpatialCellCandidate *candidate);
         void processKsumDistribution();
+
+        /* The AGGREGATE and REJECT passes over the registry's active candidates, from sync(nStarPerCell) */
+        void aggregate(KernelCandidateRegistry<PixelT> const& registry, std::vector<int> const& active);
+        void reject(KernelCandidateRegistry<PixelT> &registry, std::vector<int> const& active);
         
     private:
         Mode _mode;                  ///< Processing mode; AGGREGATE or REJECT
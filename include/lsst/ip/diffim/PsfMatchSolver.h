@@ -0,0 +1,155 @@
+// -*- lsst-c++ -*-
+/**
+ * @file PsfMatchSolver.h
+ *
+ * @brief Declaration of PsfMatchSolver
+ *
+ * @ingroup ip_diffim
+ */
+
+#ifndef LSST_IP_DIFFIM_PSFMATCHSOLVER_H
+#define LSST_IP_DIFFIM_PSFMATCHSOLVER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "boost/shared_ptr.hpp"
+#include "Eigen/Core"
+
+#include "lsst/afw/math.h"
+#include "lsst/pex/policy/Policy.h"
+
+#include "lsst/ip/diffim/KernelSolution.h"
+
+namespace lsst {
+namespace ip {
+namespace diffim {
+
+namespace detail {
+    template<typename PixelT> class BuildSpatialKernelVisitor;
+}
+
+    /**
+     * @brief Iterative determination of a spatially varying Psf-matching kernel
+     *
+     * @note Drives the visitors over a SpatialCellSet of KernelCandidates:
+     * single kernel fits, kernel sum clipping, optional Pca of the kernels, the
+     * spatial fit and its assessment, repeating until no candidate is rejected
+     * or maxSpatialIterations is reached.
+     *
+     * @note The spatial fit is updated incrementally between passes that
+     * share a basis: only candidates that were added, rebuilt or rejected
+     * since the previous pass change the spatial solution.
+     *
+     * @note If the policy's kernelSolutionRetention is "coefficients", the
+     * candidates' normal equations are released once the spatial fit is
+     * final.
+     *
+     * @note Per-pass counters record the number of candidates rejected at each
+     * stage; a pass ends early (with later stages reported as 0) when a stage
+     * rejects candidates and the pass must restart.
+     *
+     * @note writeCheckpoint() saves the solved cell set (candidate status,
+     * their kernel solutions and the spatial solution) so that
+     * restoreCheckpoint() can skip the fit when the same cell set is
+     * reprocessed with the same configuration.  The checkpoint records a
+     * fingerprint of the basis, regularization matrix and policy, and a
+     * checksum of each candidate's template and science stamps; any
+     * difference fails the restore.
+     *
+     * @note With a prior spatial solution (setPrior(), e.g. from an earlier
+     * visit of the field), the candidates are first assessed against it and
+     * those with poor residuals rejected before any single kernel is built;
+     * the candidates that replace them are assessed in turn.  If
+     * spatialKernelClipping is on, so that the prior can reject kernel sum
+     * outliers, and no single kernel fit then brings in an unassessed
+     * replacement, the first pass skips the kernel sum clipping.
+     *
+     * @param basisList  Basis for the single kernel fits
+     * @param policy     Policy from the PsfMatchConfig
+     * @param hMat       Regularization matrix for delta function bases
+     *
+     * @ingroup ip_diffim
+     */
+    template <typename PixelT>
+    class PsfMatchSolver {
+    public:
+        typedef boost::shared_ptr<PsfMatchSolver<PixelT> > Ptr;
+
+        PsfMatchSolver(lsst::afw::math::KernelList const& basisList,
+                       lsst::pex::policy::Policy const& policy);
+        PsfMatchSolver(lsst::afw::math::KernelList const& basisList,
+                       lsst::pex::policy::Policy const& policy,
+                       boost::shared_ptr<Eigen::MatrixXd> hMat);
+        virtual ~PsfMatchSolver() {};
+
+        void solve(lsst::afw::math::SpatialCellSet &kernelCellSet);
+
+        /* Screen candidates against a prior solution in later calls to solve() */
+        void setPrior(lsst::afw::math::LinearCombinationKernel::Ptr kernel,
+                      lsst::afw::math::Kernel::SpatialFunctionPtr background);
+        void clearPrior();
+        bool hasPrior() {return _priorKernel.get() != NULL;}
+
+        /* Save the state left by solve(); written to a temporary file and renamed */
+        void writeCheckpoint(std::string const& path, lsst::afw::math::SpatialCellSet &kernelCellSet);
+        /* Restore a checkpoint instead of solve(); throws if it does not match kernelCellSet or the policy */
+        void restoreCheckpoint(std::string const& path, lsst::afw::math::SpatialCellSet &kernelCellSet);
+
+        SpatialKernelSolution::Ptr getKernelSolution() {return _kernelSolution;}
+        std::pair<lsst::afw::math::LinearCombinationKernel::Ptr,
+                  lsst::afw::math::Kernel::SpatialFunctionPtr> getSolutionPair();
+        /* Basis of the spatial fit; the Pca basis if usePcaForSpatialKernel */
+        lsst::afw::math::KernelList getSpatialBasisList() {return _spatialBasisList;}
+
+        int getNIterations() {return _nIterations;}
+        int getNPasses() {return _nRejectedSingle.size();}
+        /* Rejected by the prior before the first pass */
+        int getNRejectedPrior() {return _nRejectedPrior;}
+        /* The first pass relied on the prior instead of kernel sum clipping */
+        bool getSkippedKsum() {return _skippedKsum;}
+        std::vector<int> getNRejectedSingle() {return _nRejectedSingle;}
+        std::vector<int> getNRejectedKsum() {return _nRejectedKsum;}
+        std::vector<int> getNRejectedPca() {return _nRejectedPca;}
+        std::vector<int> getNRejectedSpatial() {return _nRejectedSpatial;}
+        std::vector<int> getNGoodSpatial() {return _nGoodSpatial;}
+        /* Per pass: constraints added to / removed from the spatial solution */
+        std::vector<int> getNAddedSpatial() {return _nAddedSpatial;}
+        std::vector<int> getNRemovedSpatial() {return _nRemovedSpatial;}
+        /* Bytes held by the candidates' solutions at the end of solve() */
+        std::size_t getBytesRetained() {return _bytesRetained;}
+
+    private:
+        lsst::afw::math::KernelList const _basisList;     ///< Basis set
+        lsst::pex::policy::Policy _policy;                ///< Policy controlling behavior
+        boost::shared_ptr<Eigen::MatrixXd> _hMat;         ///< Regularization matrix
+
+        SpatialKernelSolution::Ptr _kernelSolution;       ///< Result of the last spatial fit
+        lsst::afw::math::KernelList _spatialBasisList;    ///< Basis of the last spatial fit
+        boost::shared_ptr<detail::BuildSpatialKernelVisitor<PixelT> > _spatialkv; ///< Incremental spatial fit
+
+        lsst::afw::math::LinearCombinationKernel::Ptr _priorKernel;      ///< Prior spatial kernel
+        lsst::afw::math::Kernel::SpatialFunctionPtr _priorBackground;    ///< Prior spatial background
+
+        int _nIterations;                                 ///< Spatial fits that rejected candidates
+        int _nRejectedPrior;                              ///< Rejected by the prior
+        bool _skippedKsum;                                ///< Kernel sum clipping skipped
+        std::vector<int> _nRejectedSingle;                ///< Per pass: rejected by the single kernel fit
+        std::vector<int> _nRejectedKsum;                  ///< Per pass: rejected by kernel sum clipping
+        std::vector<int> _nRejectedPca;                   ///< Per pass: rejected by the Pca kernel fit
+        std::vector<int> _nRejectedSpatial;               ///< Per pass: rejected by the spatial fit
+        std::vector<int> _nGoodSpatial;                   ///< Per pass: used in the spatial fit
+        std::vector<int> _nAddedSpatial;                  ///< Per pass: constraints added to the spatial fit
+        std::vector<int> _nRemovedSpatial;                ///< Per pass: constraints removed from the spatial fit
+        std::size_t _bytesRetained;                       ///< Held by the candidates after solve()
+
+        void _resetCounters();
+        std::string _getCheckpointKey(lsst::afw::math::SpatialCellSet const& kernelCellSet);
+        int _createPcaBasis(lsst::afw::math::SpatialCellSet &kernelCellSet, int nStarPerCell);
+        void _buildSpatialKernel(lsst::afw::math::SpatialCellSet &kernelCellSet, int nStarPerCell);
+    };
+
+}}} // end of namespace lsst::ip::diffim
+
+#endif
@@ -36,6 +36,9 @@ Python bindings for lsst::ip::diffim code
 %ignore lsst::ip::diffim::FindSetBits::operator();
 %ignore lsst::ip::diffim::ImageStatistics::operator();
 
+// Timers are scoped to a C++ call; Python reads the accumulated counters
+%ignore lsst::ip::diffim::Instrumentation::Timer;
+
 // Reference for this file is at http://dev.lsstcorp.org/trac/wiki/SwigFAQ 
 // Nice practical example is at
 //     http://dev.lsstcorp.org/trac/browser/DMS/afw/trunk/python/lsst/afw/image/imageLib.i 
@@ -161,6 +164,14 @@ namespace boost {
 
 /******************************************************************************/
 
+%{
+#include "lsst/ip/diffim/Instrumentation.h"
+%}
+
+%include "lsst/ip/diffim/Instrumentation.h"
+
+/******************************************************************************/
+
 %{
 #include "lsst/ip/diffim/KernelSolution.h"
 %}
@@ -180,6 +191,7 @@ namespace boost {
 
 %shared_ptr(lsst::ip::diffim::KernelSolution);
 %shared_ptr(lsst::ip::diffim::SpatialKernelSolution);
+%shared_ptr(lsst::ip::diffim::KernelBuildWorkspace);
 
 %KernelSolutionPtrs(F, float);
 
@@ -220,6 +232,8 @@ lsst::afw::image::Image<PIXTYPE>
 %define %KernelCandidate(NAME, TYPE)
 %template(KernelCandidate##NAME) lsst::ip::diffim::KernelCandidate<TYPE>;
 %template(makeKernelCandidate) lsst::ip::diffim::makeKernelCandidate<TYPE>;
+%template(getBytesRetained##NAME) lsst::ip::diffim::getBytesRetained<TYPE>;
+%template(releaseKernelSolutions##NAME) lsst::ip::diffim::releaseKernelSolutions<TYPE>;
 %inline %{
     lsst::ip::diffim::KernelCandidate<TYPE>::Ptr
         cast_KernelCandidate##NAME(lsst::afw::math::SpatialCellCandidate::Ptr candidate) {
@@ -237,10 +251,24 @@ lsst::afw::image::Image<PIXTYPE>
 
 /******************************************************************************/
 
+%{
+#include "lsst/ip/diffim/KernelCandidateRegistry.h"
+%}
+
+%shared_ptr(lsst::ip::diffim::KernelCandidateRegistry<float>);
+
+%include "lsst/ip/diffim/KernelCandidateRegistry.h"
+
+%template(KernelCandidateRegistryF) lsst::ip::diffim::KernelCandidateRegistry<float>;
+
+/******************************************************************************/
+
 %{
 #include "lsst/ip/diffim/BasisLists.h"
 %}
 
+%shared_ptr(lsst::ip::diffim::PixelBasis);
+
 %include "lsst/ip/diffim/BasisLists.h"
 
 
@@ -251,3 +279,23 @@ lsst::afw::image::Image<PIXTYPE>
 %include "lsst/ip/diffim/detail.i"
 
 /******************************************************************************/
+
+%{
+#include "lsst/ip/diffim/PsfMatchSolver.h"
+%}
+
+%define %PsfMatchSolverPtr(NAME, TYPE)
+%shared_ptr(lsst::ip::diffim::PsfMatchSolver<TYPE>);
+%enddef
+
+%define %PsfMatchSolver(NAME, TYPE)
+%template(PsfMatchSolver##NAME) lsst::ip::diffim::PsfMatchSolver<TYPE>;
+%enddef
+
+%PsfMatchSolverPtr(F, float);
+
+%include "lsst/ip/diffim/PsfMatchSolver.h"
+
+%PsfMatchSolver(F, float);
+
+/******************************************************************************/
@@ -270,6 +270,25 @@ def writeKernelCellSet(kernelCellSet, psfMatchingKernel, backgroundModel, outdir
                 sdmi  = cand.getDifferenceImage(sk, sbg)
                 sdmi.writeFits(os.path.join(outdir, 'sdiffim_c%d_x%d_y%d.fits' % (idCand, xCand, yCand)))
 
+def getInstrumentation():
+    """Return the counters of the diffimLib.Instrumentation hot path timers
+
+    Returns a dict keyed by phase name (e.g. "basisConvolution") of dicts with
+    the number of calls, wall-clock seconds, bytes filled and estimated flops
+    accumulated since the last diffimLib.Instrumentation.reset().  Counters
+    only accumulate while diffimLib.Instrumentation.setEnabled(True).
+    """
+    Instrumentation = diffimLib.Instrumentation
+    counters = {}
+    for phase in range(Instrumentation.NPHASES):
+        counters[Instrumentation.getPhaseName(phase)] = {
+            "nCalls": Instrumentation.getNCalls(phase),
+            "seconds": Instrumentation.getSeconds(phase),
+            "bytes": Instrumentation.getBytes(phase),
+            "flops": Instrumentation.getFlops(phase),
+            }
+    return counters
+
 #######
 # Converting types
 #######
@@ -294,7 +294,7 @@ And finally provide some optional debugging displays:
     @pipeBase.timeMethod
     def matchExposures(self, templateExposure, scienceExposure,
                        templateFwhmPix=None, scienceFwhmPix=None,
-                       candidateList=None, doWarping=True, convolveTemplate=True):
+                       candidateList=None, doWarping=True, convolveTemplate=True, dataId=None):
         """!Warp and PSF-match an exposure to the reference
 
         Do the following, in order:
@@ -317,6 +317,8 @@ And finally provide some optional debugging displays:
         @param convolveTemplate: convolve the template image or the science image
             - if True, templateExposure is warped if doWarping, templateExposure is convolved
             - if False, templateExposure is warped if doWarping, scienceExposure is convolved
+        @param dataId: data id of the science exposure, used to name the kernel checkpoint
+            (see PsfMatchConfig.kernelCheckpointFile)
 
         @return a pipeBase.Struct containing these fields:
         - matchedImage: the PSF-matched exposure =
@@ -360,11 +362,11 @@ And finally provide some optional debugging displays:
         if convolveTemplate:
             results = self.matchMaskedImages(
                 templateExposure.getMaskedImage(), scienceExposure.getMaskedImage(), candidateList,
-                templateFwhmPix=templateFwhmPix, scienceFwhmPix=scienceFwhmPix)
+                templateFwhmPix=templateFwhmPix, scienceFwhmPix=scienceFwhmPix, dataId=dataId)
         else:
             results = self.matchMaskedImages(
                 scienceExposure.getMaskedImage(), templateExposure.getMaskedImage(), candidateList,
-                templateFwhmPix=scienceFwhmPix, scienceFwhmPix=templateFwhmPix)
+                templateFwhmPix=scienceFwhmPix, scienceFwhmPix=templateFwhmPix, dataId=dataId)
 
         psfMatchedExposure = afwImage.makeExposure(results.matchedImage, scienceExposure.getWcs())
         psfMatchedExposure.setFilter(templateExposure.getFilter())
@@ -375,7 +377,7 @@ And finally provide some optional debugging displays:
 
     @pipeBase.timeMethod
     def matchMaskedImages(self, templateMaskedImage, scienceMaskedImage, candidateList,
-                          templateFwhmPix=None, scienceFwhmPix=None):
+                          templateFwhmPix=None, scienceFwhmPix=None, dataId=None):
         """!PSF-match a MaskedImage (templateMaskedImage) to a reference MaskedImage (scienceMaskedImage)
 
         Do the following, in order:
@@ -391,6 +393,8 @@ And finally provide some optional debugging displays:
         @param candidateList: a list of footprints/maskedImages for kernel candidates; 
                               if None then source detection is run.
             - Currently supported: list of Footprints or measAlg.PsfCandidateF
+        @param dataId: data id of the science exposure, used to name the kernel checkpoint
+            (see PsfMatchConfig.kernelCheckpointFile)
 
         @return a pipeBase.Struct containing these fields:
         - psfMatchedMaskedImage: the PSF-matched masked image =
@@ -455,7 +459,8 @@ And finally provide some optional debugging displays:
             basisList = makeKernelBasisList(self.kConfig, templateFwhmPix, scienceFwhmPix,
                                             metadata=self.metadata)
 
-        spatialSolution, psfMatchingKernel, backgroundModel = self._solve(kernelCellSet, basisList)
+        spatialSolution, psfMatchingKernel, backgroundModel = self._solve(kernelCellSet, basisList,
+                                                                          dataId=dataId)
 
 
 
@@ -473,7 +478,7 @@ And finally provide some optional debugging displays:
     @pipeBase.timeMethod
     def subtractExposures(self, templateExposure, scienceExposure,
                           templateFwhmPix=None, scienceFwhmPix=None,
-                          candidateList=None, doWarping=True, convolveTemplate=True):
+                          candidateList=None, doWarping=True, convolveTemplate=True, dataId=None):
         """!Register, Psf-match and subtract two Exposures
 
         Do the following, in order:
@@ -496,6 +501,8 @@ And finally provide some optional debugging displays:
         @param convolveTemplate: convolve the template image or the science image
             - if True, templateExposure is warped if doWarping, templateExposure is convolved
             - if False, templateExposure is warped if doWarping, scienceExposure is convolved
+        @param dataId: data id of the science exposure, used to name the kernel checkpoint
+            (see PsfMatchConfig.kernelCheckpointFile)
 
         @return a pipeBase.Struct containing these fields:
         - subtractedExposure: subtracted Exposure = scienceExposure - (matchedImage + backgroundModel)
@@ -512,7 +519,8 @@ And finally provide some optional debugging displays:
             scienceFwhmPix=scienceFwhmPix,
             candidateList=candidateList,
             doWarping=doWarping,
-            convolveTemplate=convolveTemplate
+            convolveTemplate=convolveTemplate,
+            dataId=dataId,
         )
 
         subtractedExposure = afwImage.ExposureF(scienceExposure, True)
@@ -556,7 +564,7 @@ And finally provide some optional debugging displays:
 
     @pipeBase.timeMethod
     def subtractMaskedImages(self, templateMaskedImage, scienceMaskedImage, candidateList,
-            templateFwhmPix=None, scienceFwhmPix=None):
+            templateFwhmPix=None, scienceFwhmPix=None, dataId=None):
         """!Psf-match and subtract two MaskedImages
 
         Do the following, in order:
@@ -572,6 +580,8 @@ And finally provide some optional debugging displays:
         @param candidateList: a list of footprints/maskedImages for kernel candidates;
                               if None then source detection is run.
             - Currently supported: list of Footprints or measAlg.PsfCandidateF
+        @param dataId: data id of the science exposure, used to name the kernel checkpoint
+            (see PsfMatchConfig.kernelCheckpointFile)
 
         @return a pipeBase.Struct containing these fields:
         - subtractedMaskedImage = scienceMaskedImage - (matchedImage + backgroundModel)
@@ -589,6 +599,7 @@ And finally provide some optional debugging displays:
             candidateList=candidateList,
             templateFwhmPix=templateFwhmPix,
             scienceFwhmPix=scienceFwhmPix,
+            dataId=dataId,
             )
 
         subtractedMaskedImage  = afwImage.MaskedImageF(scienceMaskedImage, True)
@@ -34,7 +34,7 @@ def makeKernelBasisList(config, targetFwhmPix=None, referenceFwhmPix=None,
                                             metadata=metadata)
     elif config.kernelBasisSet == "delta-function":
         kernelSize = config.kernelSize
-        return diffimLib.makeDeltaFunctionBasisList(kernelSize, kernelSize)
+        return diffimLib.BasisCache.getDeltaFunctionBasisList(kernelSize, kernelSize)
     else:
         raise ValueError("Cannot generate %s basis set" % (config.kernelBasisSet))
 
@@ -69,7 +69,9 @@ def generateAlardLuptonBasisList(config, targetFwhmPix=None, referenceFwhmPix=No
             metadata.add("ALBasisSigGauss", basisSigmaGauss)
             metadata.add("ALKernelSize", kernelSize)
 
-        return diffimLib.makeAlardLuptonBasisList(kernelSize//2, basisNGauss, basisSigmaGauss, basisDegGauss)
+        return diffimLib.BasisCache.getAlardLuptonBasisList(kernelSize//2, basisNGauss, basisSigmaGauss,
+                                                            basisDegGauss, config.alardOrthonormalize,
+                                                            config.alardOrthonormalizeSigma)
 
     targetSigma    = targetFwhmPix / sigma2fwhm
     referenceSigma = referenceFwhmPix / sigma2fwhm
@@ -176,5 +178,7 @@ def generateAlardLuptonBasisList(config, targetFwhmPix=None, referenceFwhmPix=No
         metadata.add("ALBasisSigGauss", basisSigmaGauss)
         metadata.add("ALKernelSize", kernelSize)
 
-    return diffimLib.makeAlardLuptonBasisList(kernelSize//2, basisNGauss, basisSigmaGauss, basisDegGauss)
+    return diffimLib.BasisCache.getAlardLuptonBasisList(kernelSize//2, basisNGauss, basisSigmaGauss,
+                                                        basisDegGauss, config.alardOrthonormalize,
+                                                        config.alardOrthonormalizeSigma)
 
@@ -237,13 +237,15 @@ And finally provide optional debugging display of the Psf-matched (via the Psf m
         self.kConfig = self.config.kernel.active
 
     @pipeBase.timeMethod
-    def run(self, exposure, referencePsfModel, kernelSum=1.0):
+    def run(self, exposure, referencePsfModel, kernelSum=1.0, dataId=None):
         """!Psf-match an exposure to a model Psf
 
         @param exposure: Exposure to Psf-match to the reference Psf model;
             it must return a valid PSF model via exposure.getPsf()
         @param referencePsfModel: The Psf model to match to (an lsst.afw.detection.Psf)
         @param kernelSum: A multipicative factor to apply to the kernel sum (default=1.0)
+        @param dataId: data id of the exposure, used to name the kernel checkpoint
+            (see PsfMatchConfig.kernelCheckpointFile)
 
         @return
         - psfMatchedExposure: the Psf-matched Exposure.  This has the same parent bbox, Wcs, Calib and 
@@ -270,7 +272,8 @@ And finally provide optional debugging display of the Psf-matched (via the Psf m
         fwhm2 = s2 * sigma2fwhm # template Psf
 
         basisList = makeKernelBasisList(self.kConfig, fwhm1, fwhm2, metadata = self.metadata)
-        spatialSolution, psfMatchingKernel, backgroundModel = self._solve(kernelCellSet, basisList)
+        spatialSolution, psfMatchingKernel, backgroundModel = self._solve(kernelCellSet, basisList,
+                                                                          dataId=dataId)
 
         if psfMatchingKernel.isSpatiallyVarying():
             sParameters = num.array(psfMatchingKernel.getSpatialParameters())
@@ -403,7 +406,9 @@ And finally provide optional debugging display of the Psf-matched (via the Psf m
                 scienceMI     = afwImage.MaskedImageF(kernelImageS, kernelMaskS, kernelVarS)
 
                 # The image to convolve is the science image, to the reference Psf.
-                kc = diffimLib.makeKernelCandidate(posX, posY, scienceMI, referenceMI, policy)
+                # One candidate per cell, so ratings are never compared; supply one
+                # rather than have the stamp measured.
+                kc = diffimLib.makeKernelCandidate(posX, posY, scienceMI, referenceMI, policy, 1.0)
                 kernelCellSet.insertCandidate(kc)
         
         import lsstDebug
@@ -19,8 +19,8 @@
 # the GNU General Public License along with this program.  If not,
 # see <http://www.lsstcorp.org/LegalNotices/>.
 #
+import os
 import time
-import numpy as num
 import lsst.afw.image as afwImage
 import lsst.pex.logging as pexLog
 import lsst.pex.config as pexConfig
@@ -30,6 +30,7 @@ import lsst.pipe.base as pipeBase
 from lsst.meas.algorithms.detection import BackgroundConfig
 from . import utils as diUtils
 from . import diffimLib
+from .diffimTools import getInstrumentation
 
 class DetectionConfig(pexConfig.Config):
     """!Configuration for detecting sources on images for building a PSF-matching kernel
@@ -109,6 +110,15 @@ class DetectionConfig(pexConfig.Config):
         doc = "Scale fpGrowPix by input Fwhm?",
         default = True,
     )
+    nReservePerCell = pexConfig.Field(
+        dtype = int,
+        doc = """When selecting candidates cell by cell, the number of clean
+                 footprints to keep in each cell beyond nStarPerCell, to
+                 replace candidates rejected during kernel fitting.  Fainter
+                 footprints in a cell are not vetted once the cell is full.""",
+        default = 3,
+        check = lambda x : x >= 0
+    )
 
 
 class PsfMatchConfig(pexConfig.Config):
@@ -327,12 +337,53 @@ class PsfMatchConfig(pexConfig.Config):
             "EIGENVALUE" : "Use eigen values (faster)",
         }
     )
+    kernelSolutionRetention = pexConfig.ChoiceField(
+        dtype = str,
+        doc = "What each KernelCandidate keeps of its kernel solutions once solved",
+        default = "full",
+        allowed = {
+            "full" : "Keep the design matrix, data and weights as well as the normal equations",
+            "normal-equations" : "Keep only the normal equations M and B needed by the spatial fit",
+            "coefficients" : "As normal-equations until the spatial fit is final, then only the solution",
+        }
+    )
+    kernelCheckpointFile = pexConfig.Field(
+        dtype = str,
+        doc = """File in which to checkpoint the solved kernel cell set, with %(key)s fields filled in
+                 from the data id passed to the task (e.g. "kernel-%(visit)d-%(ccd)d.ckpt") so that each
+                 exposure has its own.  If it exists and matches the cell set, its pixels and the
+                 configuration the fit is restored from it rather than redone; otherwise it is
+                 (re)written after the fit.  Not used when no data id is given.  Empty to disable.""",
+        default = "",
+        check = lambda x : not x or "%(" in x
+    )
+    enableInstrumentation = pexConfig.Field(
+        dtype = bool,
+        doc = """Enable the wall-clock timers and counters of the hot paths (diffimLib.Instrumentation)
+                 while the kernel is solved, and record what they accumulate in the task metadata.  The
+                 global counters are not reset, and their enabled state is restored afterwards""",
+        default = False,
+    )
     maxSpatialConditionNumber = pexConfig.Field(
         dtype = float,
         doc = "Maximum condition number for a well conditioned spatial matrix",
         default = 1.0e10,
         check = lambda x : x >= 0.0
     )
+    useCholeskyForSpatialKernel = pexConfig.Field(
+        dtype = bool,
+        doc = """Solve the spatial kernel matrix by Cholesky decomposition and keep the factorization.
+                 Clipping iterations that add or remove only a few candidates then update it
+                 instead of refactoring.  Falls back to LU if the matrix is not positive definite.""",
+        default = False,
+    )
+    spatialKernelRebuildInterval = pexConfig.Field(
+        dtype = int,
+        doc = """Rebuild the spatial kernel matrix from its current candidates after this many
+                 solves that followed the removal of a candidate, discarding the round-off left
+                 by the incremental updates.  0 never rebuilds.""",
+        default = 3,
+    )
     iterateSingleKernel = pexConfig.Field(
         dtype = bool,
         doc = """Remake KernelCandidate using better variance estimate after first pass?
@@ -357,6 +408,12 @@ class PsfMatchConfig(pexConfig.Config):
         doc = """Use Bayesian Information Criterion to select the number of bases going into the kernel""",
         default = False,
     )
+    basisCacheDir = pexConfig.Field(
+        dtype = str,
+        doc = """Directory in which to persist basis lists and regularization matrices
+                 across processes; if empty they are only cached in memory""",
+        default = "",
+    )
 
 
 class PsfMatchConfigAL(PsfMatchConfig):
@@ -414,6 +471,19 @@ class PsfMatchConfigAL(PsfMatchConfig):
         default = 3,
         check = lambda x : x >= 1
     )
+    alardOrthonormalize = pexConfig.Field(
+        dtype = bool,
+        doc = """Orthonormalize the AL basis images, keeping the kernel sum in the first
+                 term; this removes near-degenerate basis images, though the normal matrix
+                 still depends on the template and weights""",
+        default = False,
+    )
+    alardOrthonormalizeSigma = pexConfig.Field(
+        dtype = float,
+        doc = """Width in pixels of the Gaussian weight about the kernel center used in the
+                 orthonormalization inner product; if <= 0, all pixels have unit weight""",
+        default = 0.0,
+    )
 
 
 
@@ -693,8 +763,11 @@ However, see \link lsst.ip.diffim.imagePsfMatch.ImagePsfMatchTask ImagePsfMatchT
         else:
             self.useRegularization = False
 
+        # Always set, so that a task does not inherit another task's directory
+        diffimLib.BasisCache.setPersistenceDir(self.kConfig.basisCacheDir)
+
         if self.useRegularization:
-            self.hMat = diffimLib.makeRegularizationMatrix(pexConfig.makePolicy(self.kConfig))
+            self.hMat = diffimLib.BasisCache.getRegularizationMatrix(pexConfig.makePolicy(self.kConfig))
 
     def _diagnostic(self, kernelCellSet, spatialSolution, spatialKernel, spatialBg):
         """!Provide logging diagnostics on quality of spatial kernel fit
@@ -829,68 +902,13 @@ However, see \link lsst.ip.diffim.imagePsfMatch.ImagePsfMatchTask ImagePsfMatchT
             diUtils.plotKernelSpatialModel(spatialKernel, kernelCellSet, showBadCandidates=showBadCandidates)
 
 
-    def _createPcaBasis(self, kernelCellSet, nStarPerCell, policy):
-        """!Create Principal Component basis
-
-        If a principal component analysis is requested, typically when using a delta function basis, 
-        perform the PCA here and return a new basis list containing the new principal components.
-
-        @param kernelCellSet: a SpatialCellSet containing KernelCandidates, from which components are derived
-        @param nStarPerCell: the number of stars per cell to visit when doing the PCA
-        @param policy: input policy controlling the single kernel visitor
-
-        @return
-        - nRejectedPca: number of KernelCandidates rejected during PCA loop
-        - spatialBasisList: basis list containing the principal shapes as Kernels
-
-        """
-        nComponents       = self.kConfig.numPrincipalComponents
-        imagePca          = diffimLib.KernelPcaD()
-        importStarVisitor = diffimLib.KernelPcaVisitorF(imagePca)
-        kernelCellSet.visitCandidates(importStarVisitor, nStarPerCell)
-        if self.kConfig.subtractMeanForPca:
-            importStarVisitor.subtractMean()
-        imagePca.analyze()
-
-        eigenValues  = imagePca.getEigenValues()
-        pcaBasisList = importStarVisitor.getEigenKernels()
-
-        eSum = num.sum(eigenValues)
-        if eSum == 0.0:
-            raise RuntimeError("Eigenvalues sum to zero")
-        for j in range(len(eigenValues)):
-            pexLog.Trace(self.log.getName()+"._solve", 6,
-                         "Eigenvalue %d : %f (%f)" % (j, eigenValues[j], eigenValues[j]/eSum))
-
-        nToUse = min(nComponents, len(eigenValues))
-        trimBasisList = afwMath.KernelList()
-        for j in range(nToUse):
-            # Check for NaNs?
-            kimage = afwImage.ImageD(pcaBasisList[j].getDimensions())
-            pcaBasisList[j].computeImage(kimage, False)
-            if not (True in num.isnan(kimage.getArray())):
-                trimBasisList.push_back(pcaBasisList[j])
-
-        # Put all the power in the first kernel, which will not vary spatially
-        spatialBasisList = diffimLib.renormalizeKernelList(trimBasisList)
-
-        # New Kernel visitor for this new basis list (no regularization explicitly)
-        singlekvPca = diffimLib.BuildSingleKernelVisitorF(spatialBasisList, policy)
-        singlekvPca.setSkipBuilt(False)
-        kernelCellSet.visitCandidates(singlekvPca, nStarPerCell)
-        singlekvPca.setSkipBuilt(True)
-        nRejectedPca = singlekvPca.getNRejected()
-
-        return nRejectedPca, spatialBasisList
-
-
     def _buildCellSet(self, *args):
         """!Fill a SpatialCellSet with KernelCandidates for the Psf-matching process;
         override in derived classes"""
         return
 
     @pipeBase.timeMethod
-    def _solve(self, kernelCellSet, basisList, returnOnExcept=False):
+    def _solve(self, kernelCellSet, basisList, returnOnExcept=False, priorSolution=None, dataId=None):
         """!Solve for the PSF matching kernel
 
         @param kernelCellSet: a SpatialCellSet to use in determining the matching kernel 
@@ -898,6 +916,11 @@ However, see \link lsst.ip.diffim.imagePsfMatch.ImagePsfMatchTask ImagePsfMatchT
         @param basisList: list of Kernels to be used in the decomposition of the spatially varying kernel 
           (typically as provided by makeKernelBasisList)
         @param returnOnExcept: if True then return (None, None) if an error occurs, else raise the exception
+        @param priorSolution: optional (spatialKernel, spatialBackground) from an earlier fit, e.g. of a
+          previous visit with the same template; candidates it does not fit are rejected before their
+          single kernels are built
+        @param dataId: optional data id (a dict) naming the kernel checkpoint file; without one no
+          checkpoint is used
 
         @return
         - psfMatchingKernel: PSF matching kernel
@@ -909,135 +932,64 @@ However, see \link lsst.ip.diffim.imagePsfMatch.ImagePsfMatchTask ImagePsfMatchT
         import lsstDebug
         display = lsstDebug.Info(__name__).display
 
-        maxSpatialIterations   = self.kConfig.maxSpatialIterations
-        nStarPerCell           = self.kConfig.nStarPerCell
-        usePcaForSpatialKernel = self.kConfig.usePcaForSpatialKernel
-
-        # Visitor for the single kernel fit
+        # The build / clip / Pca / spatial fit / assess loop runs in C++
         policy = pexConfig.makePolicy(self.kConfig)
         if self.useRegularization:
-            singlekv = diffimLib.BuildSingleKernelVisitorF(basisList, policy, self.hMat)
+            solver = diffimLib.PsfMatchSolverF(basisList, policy, self.hMat)
         else:
-            singlekv = diffimLib.BuildSingleKernelVisitorF(basisList, policy)
+            solver = diffimLib.PsfMatchSolverF(basisList, policy)
+        if priorSolution is not None:
+            solver.setPrior(*priorSolution)
 
-        # Visitor for the kernel sum rejection
-        ksv = diffimLib.KernelSumVisitorF(policy)
+        # The counters are global: record what this solve adds, and leave them as found
+        instrumentationEnabled = diffimLib.Instrumentation.isEnabled()
+        if self.kConfig.enableInstrumentation:
+            countersBefore = getInstrumentation()
+            diffimLib.Instrumentation.setEnabled(True)
 
-        # Main loop
         t0 = time.time()
-        try:
-            totalIterations = 0
-            thisIteration   = 0
-            while (thisIteration < maxSpatialIterations):
-
-                # Make sure there are no uninitialized candidates as active occupants of Cell
-                nRejectedSkf = -1
-                while (nRejectedSkf != 0):
-                    pexLog.Trace(self.log.getName()+"._solve", 2,
-                                 "Building single kernels...")
-                    kernelCellSet.visitCandidates(singlekv, nStarPerCell)
-                    nRejectedSkf = singlekv.getNRejected()
-                    pexLog.Trace(self.log.getName()+"._solve", 2,
-                                 "Iteration %d, rejected %d candidates due to initial kernel fit" %
-                                 (thisIteration, nRejectedSkf))
-
-                # Reject outliers in kernel sum 
-                ksv.resetKernelSum()
-                ksv.setMode(diffimLib.KernelSumVisitorF.AGGREGATE)
-                kernelCellSet.visitCandidates(ksv, nStarPerCell)
-                ksv.processKsumDistribution()
-                ksv.setMode(diffimLib.KernelSumVisitorF.REJECT)
-                kernelCellSet.visitCandidates(ksv, nStarPerCell)
-
-                nRejectedKsum = ksv.getNRejected()
+        checkpoint = None
+        if self.kConfig.kernelCheckpointFile:
+            if dataId is not None:
+                checkpoint = self.kConfig.kernelCheckpointFile % dict(dataId)
+            else:
                 pexLog.Trace(self.log.getName()+"._solve", 2,
-                             "Iteration %d, rejected %d candidates due to kernel sum" %
-                             (thisIteration, nRejectedKsum))
-
-
-                # Do we jump back to the top without incrementing thisIteration?
-                if nRejectedKsum > 0:
-                    totalIterations += 1
-                    continue
-
-                # At this stage we can either apply the spatial fit to
-                # the kernels, or we run a PCA, use these as a *new*
-                # basis set with lower dimensionality, and then apply
-                # the spatial fit to these kernels
-
-                if (usePcaForSpatialKernel):
-                    pexLog.Trace(self.log.getName()+"._solve", 1, "Building Pca basis")
-
-                    nRejectedPca, spatialBasisList = self._createPcaBasis(kernelCellSet, nStarPerCell, policy)
+                             "No data id given; not using a kernel checkpoint")
+        try:
+            restored = False
+            if checkpoint and os.path.exists(checkpoint):
+                try:
+                    solver.restoreCheckpoint(checkpoint, kernelCellSet)
+                    restored = True
+                except Exception as e:
                     pexLog.Trace(self.log.getName()+"._solve", 2,
-                                 "Iteration %d, rejected %d candidates due to Pca kernel fit" % (
-                            thisIteration, nRejectedPca))
-
-                    # We don't want to continue on (yet) with the
-                    # spatial modeling, because we have bad objects
-                    # contributing to the Pca basis.  We basically
-                    # need to restart from the beginning of this loop,
-                    # since the cell-mates of those objects that were
-                    # rejected need their original Kernels built by
-                    # singleKernelFitter.
-
-                    # Don't count against thisIteration
-                    if (nRejectedPca > 0):
-                        totalIterations += 1
-                        continue
-                else:
-                    spatialBasisList = basisList
-
-                # We have gotten on to the spatial modeling part
-                regionBBox = kernelCellSet.getBBox()
-                spatialkv  = diffimLib.BuildSpatialKernelVisitorF(spatialBasisList, regionBBox, policy)
-                kernelCellSet.visitCandidates(spatialkv, nStarPerCell)
-                spatialkv.solveLinearEquation()
-                pexLog.Trace(self.log.getName()+"._solve", 3,
-                             "Spatial kernel built with %d candidates" % (spatialkv.getNCandidates()))
-                spatialKernel, spatialBackground = spatialkv.getSolutionPair()
-
-                # Check the quality of the spatial fit (look at residuals)
-                assesskv   = diffimLib.AssessSpatialKernelVisitorF(spatialKernel, spatialBackground, policy)
-                kernelCellSet.visitCandidates(assesskv, nStarPerCell)
-                nRejectedSpatial = assesskv.getNRejected()
-                nGoodSpatial     = assesskv.getNGood()
-                pexLog.Trace(self.log.getName()+"._solve", 2,
-                             "Iteration %d, rejected %d candidates due to spatial kernel fit" % (
-                        thisIteration, nRejectedSpatial))
-                pexLog.Trace(self.log.getName()+"._solve", 2,
-                             "%d candidates used in fit" % (nGoodSpatial))
-
-                # If only nGoodSpatial == 0, might be other candidates in the cells
-                if nGoodSpatial == 0 and nRejectedSpatial == 0:
-                    raise RuntimeError("No kernel candidates for spatial fit")
-
-                if nRejectedSpatial == 0:
-                    # Nothing rejected, finished with spatial fit
-                    break
-
-                # Otherwise, iterate on...
-                thisIteration   += 1
-
-            # Final fit if above did not converge
-            if (nRejectedSpatial > 0) and (thisIteration == maxSpatialIterations):
-                pexLog.Trace(self.log.getName()+"._solve", 2, "Final spatial fit")
-                if (usePcaForSpatialKernel):
-                    nRejectedPca, spatialBasisList = self._createPcaBasis(kernelCellSet, nStarPerCell, policy)
-                regionBBox = kernelCellSet.getBBox()
-                spatialkv  = diffimLib.BuildSpatialKernelVisitorF(spatialBasisList, regionBBox, policy)
-                kernelCellSet.visitCandidates(spatialkv, nStarPerCell)
-                spatialkv.solveLinearEquation()
-                pexLog.Trace(self.log.getName()+"._solve", 3,
-                             "Spatial kernel built with %d candidates" % (spatialkv.getNCandidates()))
-                spatialKernel, spatialBackground = spatialkv.getSolutionPair()
-
-            spatialSolution = spatialkv.getKernelSolution()
+                                 "Not using kernel checkpoint %s : %s" % (checkpoint, e))
+            if not restored:
+                solver.solve(kernelCellSet)
+                if checkpoint:
+                    solver.writeCheckpoint(checkpoint, kernelCellSet)
+            spatialKernel, spatialBackground = solver.getSolutionPair()
+            spatialSolution = solver.getKernelSolution()
 
         except Exception as e:
             pexLog.Trace(self.log.getName()+"._solve", 1, "ERROR: Unable to calculate psf matching kernel")
             pexLog.Trace(self.log.getName()+"._solve", 2, str(e))
             raise e
+        finally:
+            diffimLib.Instrumentation.setEnabled(instrumentationEnabled)
+
+        pexLog.Trace(self.log.getName()+"._solve", 2,
+                     "Spatial fit took %d passes, %d rejecting iterations" % (
+                solver.getNPasses(), solver.getNIterations()))
+        if priorSolution is not None:
+            pexLog.Trace(self.log.getName()+"._solve", 2,
+                         "Prior solution rejected %d candidates" % (solver.getNRejectedPrior()))
+        self.metadata.set("kernelCandidateBytesRetained", int(solver.getBytesRetained()))
+        if self.kConfig.enableInstrumentation:
+            for phase, counters in getInstrumentation().iteritems():
+                for name, value in counters.iteritems():
+                    self.metadata.set("instrumentation.%s.%s" % (phase, name),
+                                      value - countersBefore[phase][name])
 
         t1 = time.time()
         pexLog.Trace(self.log.getName()+"._solve", 1,
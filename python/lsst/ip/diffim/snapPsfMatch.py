@@ -254,7 +254,7 @@ And finally provide optional debugging display of the Psf-matched (via the Psf m
     # Override ImagePsfMatchTask.subtractExposures to set doWarping on config.doWarping
     def subtractExposures(self, templateExposure, scienceExposure,
                           templateFwhmPix = None, scienceFwhmPix = None,
-                          candidateList = None):
+                          candidateList = None, dataId = None):
         return ImagePsfMatchTask.subtractExposures(self,
             templateExposure = templateExposure,
             scienceExposure = scienceExposure,
@@ -262,5 +262,6 @@ And finally provide optional debugging display of the Psf-matched (via the Psf m
             scienceFwhmPix = scienceFwhmPix,
             candidateList = candidateList,
             doWarping = self.config.doWarping,
+            dataId = dataId,
         )
 
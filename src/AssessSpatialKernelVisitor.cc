@@ -65,8 +65,10 @@ namespace detail {
         _nGood(0),
         _nRejected(0),
         _nProcessed(0),
+        _nFailed(0),
         _useCoreStats(_policy.getBool("useCoreStats")),
-        _coreRadius(_policy.getInt("candidateCoreRadius"))
+        _coreRadius(_policy.getInt("candidateCoreRadius")),
+        _assessUninitialized(false)
     {};
 
     template<typename PixelT>
@@ -79,7 +81,7 @@ namespace detail {
             throw LSST_EXCEPT(pexExcept::LogicError,
                               "Failed to cast SpatialCellCandidate to KernelCandidate");
         }
-        if (!(kCandidate->isInitialized())) {
+        if (!(kCandidate->isInitialized()) && !(_assessUninitialized)) {
             kCandidate->setStatus(afwMath::SpatialCellCandidate::BAD);
             pexLogging::TTrace<3>("lsst.ip.diffim.AssessSpatialKernelVisitor.processCandidate", 
                                   "Cannot process candidate %d, continuing", kCandidate->getId());
@@ -120,6 +122,7 @@ namespace detail {
             pexLogging::TTrace<3>("lsst.ip.diffim.AssessSpatialKernelVisitor.processCandidate", 
                                   "Unable to calculate imstats for Candidate %d", kCandidate->getId()); 
             kCandidate->setStatus(afwMath::SpatialCellCandidate::BAD);
+            _nFailed += 1;
             return;
         }
 
@@ -195,6 +198,7 @@ namespace detail {
                                       "Unable to calculate core imstats for Candidate %d", 
                                       kCandidate->getId()); 
                 kCandidate->setStatus(afwMath::SpatialCellCandidate::BAD);
+                _nFailed += 1;
                 return;
             }
             pexLogging::TTrace<4>("lsst.ip.diffim.AssessSpatialKernelVisitor.processCandidate",
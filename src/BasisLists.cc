@@ -9,9 +9,16 @@
  * @ingroup ip_diffim
  */
 #include <cmath> 
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
 #include <limits>
+#include <sstream>
+#include <unistd.h>
 
-#include "boost/timer.hpp" 
+#include "boost/format.hpp" 
+#include "boost/functional/hash.hpp" 
+#include "boost/thread/mutex.hpp"
 
 #include "lsst/pex/exceptions/Exception.h"
 #include "lsst/pex/policy/Policy.h"
@@ -507,6 +514,113 @@ namespace diffim {
         return kernelListOut;
     }
     
+   /** 
+    * @brief Orthonormalize an input set of kernels, keeping the kernel sum in the first term
+    *
+    * @return Vector of orthonormalized kernels
+    *
+    * @ingroup ip_diffim
+    */
+    lsst::afw::math::KernelList
+    orthonormalizeKernelList(
+        lsst::afw::math::KernelList const &kernelListIn, ///< Input list to be orthonormalized
+        double weightSigma                               ///< Sigma of Gaussian inner product weight
+        ) {
+        typedef afwMath::Kernel::Pixel Pixel;
+        typedef afwImage::Image<Pixel> Image;
+
+        /* 
+
+        Start from the renormalized bases, such that Sum(B_0) == 1.0 and
+        Sum(B_i) == 0.0.  Linear combinations of the B_i (i > 0) also sum to
+        0.0, so these may be orthonormalized among themselves (modified
+        Gram-Schmidt, applied twice for numerical stability) without moving
+        any power into them.  B_0 is then made orthogonal to the others by
+        subtracting its projections; this keeps Sum(B_0) == 1.0, and so B_0 is
+        not rescaled.
+
+        The inner product is <a, b> = Sum_xy w(x,y) a(x,y) b(x,y), with w = 1
+        if weightSigma <= 0, else a Gaussian of width weightSigma about the
+        kernel center.
+
+        Bases that are linearly dependent on the preceding ones (to within
+        float precision) are dropped.
+
+        */
+        afwMath::KernelList kernelListRenorm = renormalizeKernelList(kernelListIn);
+        afwMath::KernelList kernelListOut;
+        if (kernelListRenorm.size() == 0) {
+            return kernelListOut;
+        }
+
+        afwGeom::Extent2I dims = kernelListRenorm[0]->getDimensions();
+        afwGeom::Point2I ctr   = kernelListRenorm[0]->getCtr();
+        int const nPix         = dims.getX() * dims.getY();
+
+        Eigen::VectorXd weights = Eigen::VectorXd::Ones(nPix);
+        if (weightSigma > 0.) {
+            for (int y = 0, n = 0; y < dims.getY(); y++) {
+                for (int x = 0; x < dims.getX(); x++, n++) {
+                    double dx = x - ctr.getX();
+                    double dy = y - ctr.getY();
+                    weights(n) = std::exp(-0.5 * (dx * dx + dy * dy) / (weightSigma * weightSigma));
+                }
+            }
+        }
+
+        /* Vectorized images */
+        Image image(dims);
+        std::vector<Eigen::VectorXd> bases;
+        for (unsigned int i = 0; i < kernelListRenorm.size(); i++) {
+            (void)kernelListRenorm[i]->computeImage(image, false);
+            Eigen::VectorXd basis(nPix);
+            for (int y = 0, n = 0; y < image.getHeight(); y++) {
+                for (Image::x_iterator ptr = image.row_begin(y); ptr != image.row_end(y); ++ptr, n++) {
+                    basis(n) = *ptr;
+                }
+            }
+            bases.push_back(basis);
+        }
+
+        std::vector<Eigen::VectorXd> orthoBases;
+        for (unsigned int i = 1; i < bases.size(); i++) {
+            Eigen::VectorXd basis = bases[i];
+            double norm0 = std::sqrt(basis.cwiseProduct(weights).dot(basis));
+            for (int pass = 0; pass < 2; pass++) {
+                for (unsigned int j = 0; j < orthoBases.size(); j++) {
+                    basis -= orthoBases[j].cwiseProduct(weights).dot(basis) * orthoBases[j];
+                }
+            }
+            double norm = std::sqrt(basis.cwiseProduct(weights).dot(basis));
+            if ((norm0 == 0.) || (norm < std::numeric_limits<float>::epsilon() * norm0)) {
+                pexLogging::TTrace<3>("lsst.ip.diffim.BasisLists.orthonormalizeKernelList", 
+                                      "Dropping linearly dependent basis %d", i);
+                continue;
+            }
+            orthoBases.push_back(basis / norm);
+        }
+
+        Eigen::VectorXd basis0 = bases[0];
+        for (unsigned int j = 0; j < orthoBases.size(); j++) {
+            basis0 -= orthoBases[j].cwiseProduct(weights).dot(basis0) * orthoBases[j];
+        }
+        orthoBases.insert(orthoBases.begin(), basis0);
+
+        for (unsigned int i = 0; i < orthoBases.size(); i++) {
+            for (int y = 0, n = 0; y < image.getHeight(); y++) {
+                for (Image::x_iterator ptr = image.row_begin(y); ptr != image.row_end(y); ++ptr, n++) {
+                    *ptr = orthoBases[i](n);
+                }
+            }
+            boost::shared_ptr<afwMath::Kernel> 
+                kernelPtr(new afwMath::FixedKernel(image));
+            kernelListOut.push_back(kernelPtr);
+        }
+        pexLogging::TTrace<4>("lsst.ip.diffim.BasisLists.orthonormalizeKernelList", 
+                              "Orthonormalized %d of %d bases", 
+                              kernelListOut.size(), kernelListIn.size());
+        return kernelListOut;
+    }
     
     
    /** 
@@ -783,4 +897,381 @@ namespace diffim {
         return hMat;
     }
     
+    /*
+     * PixelBasis
+     */
+    PixelBasis::PixelBasis(
+        int width,
+        int height,
+        lsst::afw::geom::Point2I const& ctr,
+        std::vector<lsst::afw::geom::Point2I> const& pixels
+        ) :
+        _width(width),
+        _height(height),
+        _ctr(ctr),
+        _pixels(pixels)
+    {
+        if ((width < 1) || (height < 1)) {
+            throw LSST_EXCEPT(pexExcept::Exception, "width and height must be positive");
+        }
+        for (std::vector<afwGeom::Point2I>::const_iterator i = _pixels.begin(); i != _pixels.end(); ++i) {
+            if ((i->getX() < 0) || (i->getX() >= width) || (i->getY() < 0) || (i->getY() >= height)) {
+                throw LSST_EXCEPT(pexExcept::Exception, "Basis pixel outside of kernel");
+            }
+        }
+    }
+
+    PixelBasis::Ptr PixelBasis::fromKernelList(
+        lsst::afw::math::KernelList const& basisList
+        ) {
+        PixelBasis::Ptr pixelBasis;
+        if (basisList.size() == 0) {
+            return pixelBasis;
+        }
+        std::vector<afwGeom::Point2I> pixels;
+        pixels.reserve(basisList.size());
+        for (afwMath::KernelList::const_iterator k = basisList.begin(); k != basisList.end(); ++k) {
+            boost::shared_ptr<afwMath::DeltaFunctionKernel> deltaKernel = 
+                boost::dynamic_pointer_cast<afwMath::DeltaFunctionKernel>(*k);
+            if (!deltaKernel || 
+                (deltaKernel->getDimensions() != basisList[0]->getDimensions()) ||
+                (deltaKernel->getCtr() != basisList[0]->getCtr())) {
+                return pixelBasis;
+            }
+            pixels.push_back(deltaKernel->getPixel());
+        }
+        pixelBasis.reset(new PixelBasis(basisList[0]->getWidth(), basisList[0]->getHeight(),
+                                        basisList[0]->getCtr(), pixels));
+        return pixelBasis;
+    }
+
+    double PixelBasis::computeImage(
+        lsst::afw::image::Image<lsst::afw::math::Kernel::Pixel> &image,
+        Eigen::VectorXd const& coeffs
+        ) const {
+        if ((image.getWidth() != _width) || (image.getHeight() != _height)) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Image does not match kernel dimensions");
+        }
+        if (coeffs.size() < getNBases()) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Not enough coefficients for pixel basis");
+        }
+        image = 0.0;
+        double kSum = 0.0;
+        for (int i = 0; i < getNBases(); ++i) {
+            image(_pixels[i].getX(), _pixels[i].getY()) += coeffs(i);
+            kSum += coeffs(i);
+        }
+        return kSum;
+    }
+
+    /*
+     * BasisCache
+     */
+    std::map<std::string, afwMath::KernelList> BasisCache::_basisLists;
+    std::map<std::string, boost::shared_ptr<Eigen::MatrixXd> > BasisCache::_hMats;
+    std::string BasisCache::_persistenceDir = "";
+    int BasisCache::_nHits   = 0;
+    int BasisCache::_nMisses = 0;
+
+    namespace {
+        /* Guards all of BasisCache's state; held while a missing entry is built */
+        boost::mutex basisCacheMutex;
+
+        /* Callers get their own kernels, so nothing they do reaches the cache */
+        afwMath::KernelList copyKernelList(afwMath::KernelList const& basisList) {
+            afwMath::KernelList copy;
+            copy.reserve(basisList.size());
+            for (afwMath::KernelList::const_iterator k = basisList.begin(); k != basisList.end(); ++k) {
+                copy.push_back((*k)->clone());
+            }
+            return copy;
+        }
+    }
+
+    void BasisCache::setPersistenceDir(std::string const& dir) {
+        boost::mutex::scoped_lock lock(basisCacheMutex);
+        _persistenceDir = dir;
+    }
+
+    std::string BasisCache::getPersistenceDir() {
+        boost::mutex::scoped_lock lock(basisCacheMutex);
+        return _persistenceDir;
+    }
+
+    int BasisCache::getNHits() {
+        boost::mutex::scoped_lock lock(basisCacheMutex);
+        return _nHits;
+    }
+
+    int BasisCache::getNMisses() {
+        boost::mutex::scoped_lock lock(basisCacheMutex);
+        return _nMisses;
+    }
+
+    void BasisCache::clear() {
+        boost::mutex::scoped_lock lock(basisCacheMutex);
+        _basisLists.clear();
+        _hMats.clear();
+        _nHits   = 0;
+        _nMisses = 0;
+    }
+
+    afwMath::KernelList BasisCache::getDeltaFunctionBasisList(
+        int width,
+        int height
+        ) {
+        std::string key = (boost::format("delta-function:%d:%d") % width % height).str();
+        boost::mutex::scoped_lock lock(basisCacheMutex);
+        std::map<std::string, afwMath::KernelList>::const_iterator it = _basisLists.find(key);
+        if (it != _basisLists.end()) {
+            ++_nHits;
+            return copyKernelList(it->second);
+        }
+        ++_nMisses;
+
+        /* Cheap enough to build that it is not worth persisting */
+        afwMath::KernelList basisList = makeDeltaFunctionBasisList(width, height);
+        _basisLists[key] = basisList;
+        return copyKernelList(basisList);
+    }
+
+    afwMath::KernelList BasisCache::getAlardLuptonBasisList(
+        int halfWidth,
+        int nGauss,
+        std::vector<double> const& sigGauss,
+        std::vector<int>    const& degGauss,
+        bool orthonormalize,
+        double orthonormalizeSigma
+        ) {
+        std::ostringstream os;
+        os << std::setprecision(17) << "alard-lupton:" << halfWidth << ":" << nGauss;
+        for (std::vector<double>::const_iterator i = sigGauss.begin(); i != sigGauss.end(); ++i) {
+            os << ":" << *i;
+        }
+        for (std::vector<int>::const_iterator i = degGauss.begin(); i != degGauss.end(); ++i) {
+            os << ":" << *i;
+        }
+        if (orthonormalize) {
+            os << ":orthonormal:" << orthonormalizeSigma;
+        }
+        std::string key = os.str();
+
+        boost::mutex::scoped_lock lock(basisCacheMutex);
+        std::map<std::string, afwMath::KernelList>::const_iterator it = _basisLists.find(key);
+        if (it != _basisLists.end()) {
+            ++_nHits;
+            return copyKernelList(it->second);
+        }
+        ++_nMisses;
+
+        afwMath::KernelList basisList;
+        if (!_readBasisList(key, basisList)) {
+            basisList = makeAlardLuptonBasisList(halfWidth, nGauss, sigGauss, degGauss);
+            if (orthonormalize) {
+                basisList = orthonormalizeKernelList(basisList, orthonormalizeSigma);
+            }
+            _writeBasisList(key, basisList);
+        }
+        _basisLists[key] = basisList;
+        return copyKernelList(basisList);
+    }
+
+    boost::shared_ptr<Eigen::MatrixXd> BasisCache::getRegularizationMatrix(
+        lsst::pex::policy::Policy policy
+        ) {
+        std::string regularizationType = policy.getString("regularizationType");
+        std::ostringstream os;
+        os << std::setprecision(17) << "regularization:" << regularizationType
+           << ":" << policy.getInt("kernelSize")
+           << ":" << policy.getDouble("regularizationBorderPenalty")
+           << ":" << policy.getBool("fitForBackground");
+        if (regularizationType == "centralDifference") {
+            os << ":" << policy.getInt("centralRegularizationStencil");
+        }
+        else if (regularizationType == "forwardDifference") {
+            std::vector<int> orders = policy.getIntArray("forwardRegularizationOrders");
+            for (std::vector<int>::const_iterator i = orders.begin(); i != orders.end(); ++i) {
+                os << ":" << *i;
+            }
+        }
+        std::string key = os.str();
+
+        boost::mutex::scoped_lock lock(basisCacheMutex);
+        std::map<std::string, boost::shared_ptr<Eigen::MatrixXd> >::const_iterator it = _hMats.find(key);
+        if (it != _hMats.end()) {
+            ++_nHits;
+            return boost::shared_ptr<Eigen::MatrixXd>(new Eigen::MatrixXd(*(it->second)));
+        }
+        ++_nMisses;
+
+        boost::shared_ptr<Eigen::MatrixXd> hMat = _readMatrix(key);
+        if (!hMat) {
+            hMat = makeRegularizationMatrix(policy);
+            _writeMatrix(key, *hMat);
+        }
+        _hMats[key] = hMat;
+        return boost::shared_ptr<Eigen::MatrixXd>(new Eigen::MatrixXd(*hMat));
+    }
+
+    std::string BasisCache::_getPath(std::string const& key) {
+        boost::hash<std::string> hasher;
+        return (boost::format("%s/ipDiffimBasisCache_%016x.bin") % _persistenceDir % hasher(key)).str();
+    }
+
+    /* On-disk format : key length, key, nrows, ncols, then data in column-major order.
+     * The key is stored so that hash collisions are detected and treated as misses. */
+    namespace {
+        bool readHeader(std::ifstream &in, std::string const& key) {
+            std::string::size_type keyLength = 0;
+            in.read(reinterpret_cast<char *>(&keyLength), sizeof(keyLength));
+            if (!in || (keyLength != key.size())) {
+                return false;
+            }
+            std::string storedKey(keyLength, ' ');
+            in.read(&storedKey[0], keyLength);
+            return (in && (storedKey == key));
+        }
+
+        void writeHeader(std::ofstream &out, std::string const& key) {
+            std::string::size_type keyLength = key.size();
+            out.write(reinterpret_cast<char const *>(&keyLength), sizeof(keyLength));
+            out.write(key.data(), keyLength);
+        }
+    }
+
+    bool BasisCache::_readBasisList(
+        std::string const& key, 
+        afwMath::KernelList &basisList
+        ) {
+        if (_persistenceDir.empty()) {
+            return false;
+        }
+        std::ifstream in(_getPath(key).c_str(), std::ios::binary);
+        if (!in || !readHeader(in, key)) {
+            return false;
+        }
+
+        int nKernel = 0, width = 0, height = 0;
+        in.read(reinterpret_cast<char *>(&nKernel), sizeof(nKernel));
+        in.read(reinterpret_cast<char *>(&width), sizeof(width));
+        in.read(reinterpret_cast<char *>(&height), sizeof(height));
+        if (!in || (nKernel < 1) || (width < 1) || (height < 1)) {
+            return false;
+        }
+
+        afwMath::KernelList kernelList;
+        std::vector<afwMath::Kernel::Pixel> pixels(width * height);
+        for (int i = 0; i < nKernel; ++i) {
+            in.read(reinterpret_cast<char *>(&pixels[0]), pixels.size() * sizeof(afwMath::Kernel::Pixel));
+            if (!in) {
+                return false;
+            }
+            afwImage::Image<afwMath::Kernel::Pixel> image(afwGeom::Extent2I(width, height));
+            for (int y = 0, n = 0; y < height; ++y) {
+                for (afwImage::Image<afwMath::Kernel::Pixel>::x_iterator ptr = image.row_begin(y); 
+                     ptr != image.row_end(y); ++ptr, ++n) {
+                    *ptr = pixels[n];
+                }
+            }
+            kernelList.push_back(boost::shared_ptr<afwMath::Kernel>(new afwMath::FixedKernel(image)));
+        }
+        pexLogging::TTrace<3>("lsst.ip.diffim.BasisCache", 
+                              "Read %d basis kernels from %s", nKernel, _getPath(key).c_str());
+        basisList = kernelList;
+        return true;
+    }
+
+    void BasisCache::_writeBasisList(
+        std::string const& key, 
+        afwMath::KernelList const& basisList
+        ) {
+        if (_persistenceDir.empty() || (basisList.size() == 0)) {
+            return;
+        }
+        std::string path    = _getPath(key);
+        std::string tmpPath = (boost::format("%s.%d.tmp") % path % getpid()).str();
+        {
+            std::ofstream out(tmpPath.c_str(), std::ios::binary);
+            if (!out) {
+                pexLogging::TTrace<3>("lsst.ip.diffim.BasisCache", 
+                                      "Cannot write basis cache to %s", tmpPath.c_str());
+                return;
+            }
+            writeHeader(out, key);
+            int nKernel = basisList.size();
+            int width   = basisList[0]->getWidth();
+            int height  = basisList[0]->getHeight();
+            out.write(reinterpret_cast<char const *>(&nKernel), sizeof(nKernel));
+            out.write(reinterpret_cast<char const *>(&width), sizeof(width));
+            out.write(reinterpret_cast<char const *>(&height), sizeof(height));
+
+            afwImage::Image<afwMath::Kernel::Pixel> image(afwGeom::Extent2I(width, height));
+            for (afwMath::KernelList::const_iterator k = basisList.begin(); k != basisList.end(); ++k) {
+                (void)(*k)->computeImage(image, false);
+                for (int y = 0; y < height; ++y) {
+                    for (afwImage::Image<afwMath::Kernel::Pixel>::x_iterator ptr = image.row_begin(y); 
+                         ptr != image.row_end(y); ++ptr) {
+                        afwMath::Kernel::Pixel pixel = *ptr;
+                        out.write(reinterpret_cast<char const *>(&pixel), sizeof(pixel));
+                    }
+                }
+            }
+        }
+        /* Atomic with respect to other processes reading the cache */
+        std::rename(tmpPath.c_str(), path.c_str());
+    }
+
+    boost::shared_ptr<Eigen::MatrixXd> BasisCache::_readMatrix(
+        std::string const& key
+        ) {
+        boost::shared_ptr<Eigen::MatrixXd> mat;
+        if (_persistenceDir.empty()) {
+            return mat;
+        }
+        std::ifstream in(_getPath(key).c_str(), std::ios::binary);
+        if (!in || !readHeader(in, key)) {
+            return mat;
+        }
+        int rows = 0, cols = 0;
+        in.read(reinterpret_cast<char *>(&rows), sizeof(rows));
+        in.read(reinterpret_cast<char *>(&cols), sizeof(cols));
+        if (!in || (rows < 1) || (cols < 1)) {
+            return mat;
+        }
+        boost::shared_ptr<Eigen::MatrixXd> readMat(new Eigen::MatrixXd(rows, cols));
+        in.read(reinterpret_cast<char *>(readMat->data()), rows * cols * sizeof(double));
+        if (in) {
+            pexLogging::TTrace<3>("lsst.ip.diffim.BasisCache", 
+                                  "Read %d x %d matrix from %s", rows, cols, _getPath(key).c_str());
+            mat = readMat;
+        }
+        return mat;
+    }
+
+    void BasisCache::_writeMatrix(
+        std::string const& key, 
+        Eigen::MatrixXd const& mat
+        ) {
+        if (_persistenceDir.empty()) {
+            return;
+        }
+        std::string path    = _getPath(key);
+        std::string tmpPath = (boost::format("%s.%d.tmp") % path % getpid()).str();
+        {
+            std::ofstream out(tmpPath.c_str(), std::ios::binary);
+            if (!out) {
+                pexLogging::TTrace<3>("lsst.ip.diffim.BasisCache", 
+                                      "Cannot write basis cache to %s", tmpPath.c_str());
+                return;
+            }
+            writeHeader(out, key);
+            int rows = mat.rows();
+            int cols = mat.cols();
+            out.write(reinterpret_cast<char const *>(&rows), sizeof(rows));
+            out.write(reinterpret_cast<char const *>(&cols), sizeof(cols));
+            out.write(reinterpret_cast<char const *>(mat.data()), rows * cols * sizeof(double));
+        }
+        std::rename(tmpPath.c_str(), path.c_str());
+    }
+
 }}} // end of namespace lsst::ip::diffim
@@ -101,6 +101,7 @@ namespace detail {
         _nRejected(0),
         _nProcessed(0),
         _useRegularization(false),
+        _workspace(new KernelBuildWorkspace()),
         _useCoreStats(_policy.getBool("useCoreStats")),
         _coreRadius(_policy.getInt("candidateCoreRadius"))
     {};
@@ -121,6 +122,7 @@ namespace detail {
         _nRejected(0),
         _nProcessed(0),
         _useRegularization(true),
+        _workspace(new KernelBuildWorkspace()),
         _useCoreStats(_policy.getBool("useCoreStats")),
         _coreRadius(_policy.getInt("candidateCoreRadius"))
     {};
@@ -152,12 +154,29 @@ namespace detail {
                               kCandidate->getXCenter(), 
                               kCandidate->getYCenter());
                               
+        /* 
+         * Reject a stamp whose science core cannot be measured before its
+         * first build; the candidate rating does not change the status
+         */
+        if (!kCandidate->isInitialized()) {
+            try {
+                _imstats.apply(*(kCandidate->getScienceMaskedImage()), _coreRadius);
+            } catch (pexExcept::Exception& e) {
+                kCandidate->setStatus(afwMath::SpatialCellCandidate::BAD);
+                pexLogging::TTrace<4>("lsst.ip.diffim.BuildSingleKernelVisitor.processCandidate", 
+                                      "Unable to calculate core imstats for candidate %d", 
+                                      kCandidate->getId());
+                _nRejected += 1;
+                return;
+            }
+        }
+
         /* Build its kernel here */
         try {
             if (_useRegularization)
-                kCandidate->build(_basisList, _hMat);
+                kCandidate->build(_basisList, _hMat, _workspace);
             else
-                kCandidate->build(_basisList);
+                kCandidate->build(_basisList, boost::shared_ptr<Eigen::MatrixXd>(), _workspace);
 
         } catch (pexExcept::Exception &e) {
             kCandidate->setStatus(afwMath::SpatialCellCandidate::BAD);
@@ -9,8 +9,9 @@
  * @ingroup ip_diffim
  */
 
+#include <map>
+
 #include "boost/shared_ptr.hpp" 
-#include "boost/timer.hpp" 
 
 #include "Eigen/Core"
 #include "Eigen/Cholesky"
@@ -69,6 +70,12 @@ namespace detail {
      * matrices are the correct size, and that it is accessing the appropriate terms
      * in the matrices when creating the spatial models.
      * 
+     * @note The visitor may be reused for repeated passes over the same cell
+     * set; each call to solveLinearEquation() ends a pass.  Constraints are
+     * remembered by candidate id, so a later pass only adds candidates that
+     * are new or have been rebuilt since (see KernelCandidate::getEpoch), and
+     * downdates the solution by those no longer visited, e.g. because they
+     * were rejected.  Unchanged candidates cost nothing.
      */
     template<typename PixelT>
     BuildSpatialKernelVisitor<PixelT>::BuildSpatialKernelVisitor(
@@ -78,7 +85,11 @@ namespace detail {
         ) :
         afwMath::CandidateVisitor(),
         _kernelSolution(),
-        _nCandidates(0) 
+        _constraints(),
+        _newPass(true),
+        _nCandidates(0),
+        _nAdded(0),
+        _nRemoved(0)
     {
         int spatialKernelOrder = policy.getInt("spatialKernelOrder");
         afwMath::Kernel::SpatialFunctionPtr spatialKernelFunction;
@@ -127,6 +138,9 @@ namespace detail {
             throw LSST_EXCEPT(pexExcept::LogicError,
                               "Failed to cast SpatialCellCandidate to KernelCandidate");
         }
+        if (_newPass) {
+            _beginPass();
+        }
         if (!(kCandidate->isInitialized())) {
             kCandidate->setStatus(afwMath::SpatialCellCandidate::BAD);
             pexLogging::TTrace<3>("lsst.ip.diffim.BuildSpatialKernelVisitor.processCandidate", 
@@ -138,27 +152,91 @@ namespace detail {
                               "Processing candidate %d", kCandidate->getId());
         _nCandidates += 1;
 
+        typename std::map<int, Constraint>::iterator iter = _constraints.find(kCandidate->getId());
+        if ((iter != _constraints.end()) && (iter->second.epoch == kCandidate->getEpoch())) {
+            /* Already in the solution, unchanged */
+            iter->second.visited = true;
+            return;
+        }
+
         /* 
            Build the spatial kernel from the most recent fit, e.g. if its Pca
            you want to build a spatial model on the Pca basis, not original
            basis 
         */
-        _kernelSolution->addConstraint(kCandidate->getXCenter(),
-                                       kCandidate->getYCenter(),
-                                       kCandidate->getKernelSolution(
-                                           KernelCandidate<PixelT>::RECENT
-                                           )->getM(),
-                                       kCandidate->getKernelSolution(
-                                           KernelCandidate<PixelT>::RECENT
-                                           )->getB());
-        
+        Constraint constraint;
+        constraint.epoch   = kCandidate->getEpoch();
+        constraint.xCenter = kCandidate->getXCenter();
+        constraint.yCenter = kCandidate->getYCenter();
+        constraint.qMat    = kCandidate->getKernelSolution(KernelCandidate<PixelT>::RECENT)->getM();
+        constraint.wVec    = kCandidate->getKernelSolution(KernelCandidate<PixelT>::RECENT)->getB();
+        constraint.visited = true;
+        if (!constraint.qMat || !constraint.wVec) {
+            throw LSST_EXCEPT(pexExcept::Exception,
+                              str(boost::format("Candidate %d kernel matrices have been released") %
+                                  kCandidate->getId()));
+        }
+
+        if (iter != _constraints.end()) {
+            /* Rebuilt since it was added */
+            _kernelSolution->replaceConstraint(constraint.xCenter, constraint.yCenter,
+                                               iter->second.qMat, iter->second.wVec,
+                                               constraint.qMat, constraint.wVec);
+            _nRemoved += 1;
+        } else {
+            _kernelSolution->addConstraint(constraint.xCenter, constraint.yCenter,
+                                           constraint.qMat, constraint.wVec);
+        }
+        _constraints[kCandidate->getId()] = constraint;
+        _nAdded += 1;
     }
 
     template<typename PixelT>
     void BuildSpatialKernelVisitor<PixelT>::solveLinearEquation() {
+        if (_newPass) {
+            /* Nothing was visited this pass */
+            _beginPass();
+        }
+
+        /* Downdate by the candidates that dropped out of this pass */
+        typename std::map<int, Constraint>::iterator iter = _constraints.begin();
+        while (iter != _constraints.end()) {
+            if (iter->second.visited) {
+                ++iter;
+            } else {
+                _removeConstraint(iter++);
+            }
+        }
+        _newPass = true;
+
+        pexLogging::TTrace<4>("lsst.ip.diffim.BuildSpatialKernelVisitor.solveLinearEquation", 
+                              "Solving with %d constraints (%d added, %d removed)",
+                              _kernelSolution->getNConstraints(), _nAdded, _nRemoved);
         _kernelSolution->solve();
     }
 
+    template<typename PixelT>
+    void BuildSpatialKernelVisitor<PixelT>::_beginPass() {
+        for (typename std::map<int, Constraint>::iterator iter = _constraints.begin();
+             iter != _constraints.end(); ++iter) {
+            iter->second.visited = false;
+        }
+        _nCandidates = 0;
+        _nAdded      = 0;
+        _nRemoved    = 0;
+        _newPass     = false;
+    }
+
+    template<typename PixelT>
+    void BuildSpatialKernelVisitor<PixelT>::_removeConstraint(
+        typename std::map<int, Constraint>::iterator iter
+        ) {
+        _kernelSolution->removeConstraint(iter->second.xCenter, iter->second.yCenter,
+                                          iter->second.qMat, iter->second.wVec);
+        _constraints.erase(iter);
+        _nRemoved += 1;
+    }
+
     template<typename PixelT>
     std::pair<afwMath::LinearCombinationKernel::Ptr, afwMath::Kernel::SpatialFunctionPtr>
     BuildSpatialKernelVisitor<PixelT>::getSolutionPair() {
@@ -28,9 +28,11 @@
 #include <functional>   // std::binary_function
 #include <limits>       // std::numeric_limits
 #include <cmath>        // std::sqrt
+#include <vector>       // std::vector
 
 #if !defined(DOXYGEN)
 #   include "Minuit2/FCNBase.h"
+#   include "Minuit2/FCNGradientBase.h"
 #   include "Minuit2/FunctionMinimum.h"
 #   include "Minuit2/MnMigrad.h"
 #   include "Minuit2/MnMinos.h"
@@ -38,6 +40,8 @@
 #endif
 
 #include "boost/shared_ptr.hpp"
+#include "boost/ref.hpp"
+#include "boost/thread.hpp"
 #include "lsst/pex/exceptions.h"
 #include "lsst/pex/logging/Trace.h"
 #include "lsst/afw/image.h"
@@ -54,6 +58,7 @@ namespace afwDet = lsst::afw::detection;
 namespace afwImage = lsst::afw::image;
 namespace afwMath = lsst::afw::math;
 namespace afwGeom = lsst::afw::geom;
+namespace pexLog = lsst::pex::logging;
 
 namespace lsst { namespace ip { namespace diffim {
 
@@ -258,21 +263,478 @@ void NaiveDipoleFlux::fail(afw::table::SourceRecord & measRecord, meas::base::Me
 }
 
 
+namespace {
+
+/*
+ * Step, in pixels, of the central differences giving the Psf derivatives when
+ * the Psf is not cached; the truncation error is h^2/6 of the third derivative
+ */
+double const PSF_GRADIENT_STEP = 0.01;
+
+/**
+ * Add weight * image, translated by (dx, dy) pixels, into a row-major buffer covering bbox
+ */
+void addPsfImage(
+    afwImage::Image<afwMath::Kernel::Pixel> const& image,
+    int dx, int dy,
+    double weight,
+    afwGeom::Box2I const& bbox,
+    std::vector<double> &model
+) {
+    // Portion of the Psf that overlaps the model
+    afwGeom::Box2I overlap = image.getBBox();
+    overlap.shift(afwGeom::Extent2I(dx, dy));
+    overlap.clip(bbox);
+    if (overlap.isEmpty()) {
+        return;
+    }
+
+    int const width = bbox.getWidth();
+    for (int y = overlap.getMinY(); y <= overlap.getMaxY(); ++y) {
+        afwImage::Image<afwMath::Kernel::Pixel>::const_x_iterator pPtr =
+            image.x_at(overlap.getMinX() - dx - image.getX0(), y - dy - image.getY0());
+        double *mPtr = &model[(y - bbox.getMinY())*width + (overlap.getMinX() - bbox.getMinX())];
+        for (int x = overlap.getMinX(); x <= overlap.getMaxX(); ++x, ++pPtr, ++mPtr) {
+            *mPtr += weight * (*pPtr);
+        }
+    }
+}
+
+/**
+ * Catmull-Rom weights of the nodes at -1, 0, 1, 2 for a point t in [0, 1], and their derivatives
+ */
+void catmullRomWeights(double t, double w[4], double dw[4]) {
+    double const t2 = t*t;
+    double const t3 = t2*t;
+    w[0] = 0.5*(-t3 + 2.0*t2 - t);
+    w[1] = 0.5*(3.0*t3 - 5.0*t2 + 2.0);
+    w[2] = 0.5*(-3.0*t3 + 4.0*t2 + t);
+    w[3] = 0.5*(t3 - t2);
+    dw[0] = 0.5*(-3.0*t2 + 4.0*t - 1.0);
+    dw[1] = 0.5*(9.0*t2 - 10.0*t);
+    dw[2] = 0.5*(-9.0*t2 + 8.0*t + 1.0);
+    dw[3] = 0.5*(3.0*t2 - 2.0*t);
+}
+
+} // anonymous namespace
+
+/**
+ * Psf realisations at a grid of sub-pixel offsets about a reference pixel
+ *
+ * The Psf is computed once at offsets spaced by h = 1/oversample spanning
+ * [-0.5 - h, 0.5 + h] pixels along each axis.  The Psf at an arbitrary
+ * centroid is the bicubic (Catmull-Rom) interpolation of the 4x4 bracketing
+ * realisations, translated by the integer part of the centroid; spatial
+ * variation of the Psf across the footprint is neglected.  The interpolant
+ * and its derivatives are continuous, so chi2 is smooth in the centroids.
+ *
+ * @note The interpolation error is O(h^3).  For a Gaussian Psf of width
+ * sigma = 2 pixels and oversample = 4 it is below 1e-4 of the peak, and the
+ * error of the derivative below 1% of its maximum.
+ */
+class PsfImageCache {
+public:
+    typedef afwImage::Image<afwMath::Kernel::Pixel> ImageT;
+
+    PsfImageCache(afwDet::Psf const& psf, afwGeom::Point2I const& ref, int oversample);
+
+    /* Add weight * Psf(center) into model, a row-major buffer covering bbox */
+    void addImage(afwGeom::Point2D const& center, double weight,
+                  afwGeom::Box2I const& bbox, std::vector<double> &model) const;
+
+    /* Add weight * the derivatives of Psf(center) with respect to the center coordinates */
+    void addGradient(afwGeom::Point2D const& center, double weight, afwGeom::Box2I const& bbox,
+                     std::vector<double> &gradX, std::vector<double> &gradY) const;
+
+private:
+    afwGeom::Point2I _ref;
+    int _oversample;
+    std::vector<CONST_PTR(ImageT)> _images;  // index j*(oversample+3) + i for offset (i - 1, j - 1)
+
+    /*
+     * First of the 4x4 bracketing realisations, the Catmull-Rom weights along
+     * each axis and their derivatives with respect to the center, and the
+     * integer translation
+     */
+    void _locate(afwGeom::Point2D const& center, int &index, double wx[4], double wy[4],
+                 double dwx[4], double dwy[4], int &dx, int &dy) const;
+};
+
+PsfImageCache::PsfImageCache(
+    afwDet::Psf const& psf,
+    afwGeom::Point2I const& ref,
+    int oversample
+) : _ref(ref),
+    _oversample(oversample),
+    _images()
+{
+    if (oversample < 1) {
+        throw LSST_EXCEPT(pexExceptions::InvalidParameterError,
+                          (boost::format("Psf cache oversampling must be positive: %d") % oversample).str());
+    }
+    _images.reserve((oversample + 3)*(oversample + 3));
+    for (int j = 0; j <= oversample + 2; ++j) {
+        double const yOff = -0.5 + static_cast<double>(j - 1) / oversample;
+        for (int i = 0; i <= oversample + 2; ++i) {
+            double const xOff = -0.5 + static_cast<double>(i - 1) / oversample;
+            _images.push_back(psf.computeImage(afwGeom::Point2D(ref.getX() + xOff, ref.getY() + yOff)));
+        }
+    }
+}
+
+void PsfImageCache::_locate(
+    afwGeom::Point2D const& center,
+    int &index, double wx[4], double wy[4], double dwx[4], double dwy[4], int &dx, int &dy
+) const {
+    int const ix = static_cast<int>(std::floor(center.getX() + 0.5));
+    int const iy = static_cast<int>(std::floor(center.getY() + 0.5));
+
+    // Position within the grid of offsets; nodes i0 - 1 .. i0 + 2 bracket it
+    double const u = (center.getX() - ix + 0.5) * _oversample;
+    double const v = (center.getY() - iy + 0.5) * _oversample;
+    int const i0 = std::max(0, std::min(static_cast<int>(std::floor(u)), _oversample - 1));
+    int const j0 = std::max(0, std::min(static_cast<int>(std::floor(v)), _oversample - 1));
+    index = j0*(_oversample + 3) + i0;
+
+    // The weights are functions of u and v, which advance by oversample per pixel
+    catmullRomWeights(u - i0, wx, dwx);
+    catmullRomWeights(v - j0, wy, dwy);
+    for (int k = 0; k < 4; ++k) {
+        dwx[k] *= _oversample;
+        dwy[k] *= _oversample;
+    }
+    dx = ix - _ref.getX();
+    dy = iy - _ref.getY();
+}
+
+void PsfImageCache::addImage(
+    afwGeom::Point2D const& center,
+    double weight,
+    afwGeom::Box2I const& bbox,
+    std::vector<double> &model
+) const {
+    int index, dx, dy;
+    double wx[4], wy[4], dwx[4], dwy[4];
+    _locate(center, index, wx, wy, dwx, dwy, dx, dy);
+
+    int const nx = _oversample + 3;
+    for (int j = 0; j < 4; ++j) {
+        for (int i = 0; i < 4; ++i) {
+            double const w = wx[i]*wy[j];
+            if (w != 0.0) {
+                addPsfImage(*_images[index + j*nx + i], dx, dy, weight*w, bbox, model);
+            }
+        }
+    }
+}
+
+void PsfImageCache::addGradient(
+    afwGeom::Point2D const& center,
+    double weight,
+    afwGeom::Box2I const& bbox,
+    std::vector<double> &gradX,
+    std::vector<double> &gradY
+) const {
+    int index, dx, dy;
+    double wx[4], wy[4], dwx[4], dwy[4];
+    _locate(center, index, wx, wy, dwx, dwy, dx, dy);
+
+    int const nx = _oversample + 3;
+    for (int j = 0; j < 4; ++j) {
+        for (int i = 0; i < 4; ++i) {
+            ImageT const& image = *_images[index + j*nx + i];
+            double const wX = dwx[i]*wy[j];
+            double const wY = wx[i]*dwy[j];
+            if (wX != 0.0) {
+                addPsfImage(image, dx, dy, weight*wX, bbox, gradX);
+            }
+            if (wY != 0.0) {
+                addPsfImage(image, dx, dy, weight*wY, bbox, gradY);
+            }
+        }
+    }
+}
+
+/**
+ * Per-source state shared by all chi2 evaluations of a PsfDipoleFlux fit
+ *
+ * The data and inverse variance of the footprint pixels are extracted once,
+ * and the unit-flux Psf models of the two lobes are kept in preallocated
+ * buffers covering the footprint bounding box; each evaluation then refills
+ * the model buffers and accumulates chi2 in a single pass over the spans.
+ */
+class PsfDipoleFluxWorkspace {
+public:
+    /* psfCacheOversample <= 0 evaluates the Psf model exactly at every call */
+    PsfDipoleFluxWorkspace(afwDet::Footprint const& footprint,
+                           afwImage::Exposure<float> const& exposure,
+                           int psfCacheOversample);
+
+    /* Returns (chi2, number of footprint pixels with finite data and positive variance) */
+    std::pair<double,int> chi2(double negCenterX, double negCenterY, double negFlux,
+                               double posCenterX, double posCenterY, double posFlux);
+
+    /* Derivatives of chi2 with respect to the fit parameters, indexed as NEGCENTXPAR..POSFLUXPAR */
+    std::vector<double> gradient(double negCenterX, double negCenterY, double negFlux,
+                                 double posCenterX, double posCenterY, double posFlux);
+
+    /*
+     * Returns (chi2, nPix) at the centroids with the fluxes minimizing chi2 subject
+     * to negFlux <= 0 <= posFlux; the sigmas ignore covariance with the centroids
+     */
+    std::pair<double,int> solveFluxes(double negCenterX, double negCenterY,
+                                      double posCenterX, double posCenterY,
+                                      double &negFlux, double &posFlux,
+                                      double &negFluxSigma, double &posFluxSigma);
+
+    int getNPix() const { return _nPix; }
+
+    bool hasPsfCache() const { return static_cast<bool>(_psfCache); }
+
+private:
+    typedef std::vector<std::pair<int, int> >::const_iterator SpanIterator;
+
+    afwGeom::Box2I _bbox;
+    CONST_PTR(afwDet::Psf) _psf;
+    boost::shared_ptr<PsfImageCache> _psfCache;
+    std::vector<std::pair<int, int> > _spans; // [begin, end) offsets of the footprint spans in _bbox
+    std::vector<double> _data;     // data within _bbox, row major
+    std::vector<double> _invVar;   // inverse variance; 0 for unusable pixels and those outside the spans
+    std::vector<double> _negModel; // unit-flux Psf of the negative lobe
+    std::vector<double> _posModel; // unit-flux Psf of the positive lobe
+    std::vector<double> _negGradX; // derivatives of _negModel with respect to the lobe center
+    std::vector<double> _negGradY;
+    std::vector<double> _posGradX; // derivatives of _posModel with respect to the lobe center
+    std::vector<double> _posGradY;
+    double _dataChi2;              // sum of data**2 / variance
+    int _nPix;
+
+    void _fillModel(afwGeom::Point2D const& center, std::vector<double> &model);
+    void _fillGradient(afwGeom::Point2D const& center, std::vector<double> &gradX,
+                       std::vector<double> &gradY);
+};
+
+PsfDipoleFluxWorkspace::PsfDipoleFluxWorkspace(
+    afwDet::Footprint const& footprint,
+    afwImage::Exposure<float> const& exposure,
+    int psfCacheOversample
+) : _bbox(footprint.getBBox()),
+    _psf(exposure.getPsf()),
+    _psfCache(),
+    _spans(),
+    _data(_bbox.getArea(), 0.0),
+    _invVar(_bbox.getArea(), 0.0),
+    _negModel(_bbox.getArea()),
+    _posModel(_bbox.getArea()),
+    _negGradX(_bbox.getArea()),
+    _negGradY(_bbox.getArea()),
+    _posGradX(_bbox.getArea()),
+    _posGradY(_bbox.getArea()),
+    _dataChi2(0.0),
+    _nPix(0)
+{
+    afwImage::Image<float> data(*(exposure.getMaskedImage().getImage()), _bbox);
+    afwImage::Image<afwImage::VariancePixel> var(*(exposure.getMaskedImage().getVariance()), _bbox);
+
+    // Only pixels within the footprint spans take part in the fit
+    int const width = _bbox.getWidth();
+    afwDet::Footprint::SpanList const& spans = footprint.getSpans();
+    _spans.reserve(spans.size());
+    for (afwDet::Footprint::SpanList::const_iterator sp = spans.begin(); sp != spans.end(); ++sp) {
+        int const y = (*sp)->getY() - _bbox.getMinY();
+        int const x0 = (*sp)->getX0() - _bbox.getMinX();
+        int const x1 = (*sp)->getX1() - _bbox.getMinX();
+        _spans.push_back(std::make_pair(y*width + x0, y*width + x1 + 1));
+
+        afwImage::Image<float>::x_iterator dPtr = data.x_at(x0, y);
+        afwImage::Image<afwImage::VariancePixel>::x_iterator vPtr = var.x_at(x0, y);
+        for (int i = y*width + x0; i <= y*width + x1; ++i, ++dPtr, ++vPtr) {
+            if (std::isfinite(*dPtr) && std::isfinite(*vPtr) && (*vPtr > 0.0)) {
+                _data[i] = *dPtr;
+                _invVar[i] = 1.0 / *vPtr;
+                _dataChi2 += _data[i] * _data[i] * _invVar[i];
+                ++_nPix;
+            }
+        }
+    }
+
+    if (psfCacheOversample > 0) {
+        afwGeom::Point2I ref((_bbox.getMinX() + _bbox.getMaxX()) / 2,
+                             (_bbox.getMinY() + _bbox.getMaxY()) / 2);
+        _psfCache.reset(new PsfImageCache(*_psf, ref, psfCacheOversample));
+    }
+}
+
+void PsfDipoleFluxWorkspace::_fillModel(
+    afwGeom::Point2D const& center,
+    std::vector<double> &model
+) {
+    std::fill(model.begin(), model.end(), 0.0);
+
+    if (_psfCache) {
+        _psfCache->addImage(center, 1.0, _bbox, model);
+    } else {
+        addPsfImage(*_psf->computeImage(center), 0, 0, 1.0, _bbox, model);
+    }
+}
+
+void PsfDipoleFluxWorkspace::_fillGradient(
+    afwGeom::Point2D const& center,
+    std::vector<double> &gradX,
+    std::vector<double> &gradY
+) {
+    std::fill(gradX.begin(), gradX.end(), 0.0);
+    std::fill(gradY.begin(), gradY.end(), 0.0);
+
+    if (_psfCache) {
+        _psfCache->addGradient(center, 1.0, _bbox, gradX, gradY);
+    } else {
+        // Central differences of Psf realisations a small sub-pixel step either side of the center
+        double const h = PSF_GRADIENT_STEP;
+        double const scale = 0.5 / h;
+        afwGeom::Extent2D const stepX(h, 0.0);
+        afwGeom::Extent2D const stepY(0.0, h);
+        addPsfImage(*_psf->computeImage(center + stepX), 0, 0,  scale, _bbox, gradX);
+        addPsfImage(*_psf->computeImage(center - stepX), 0, 0, -scale, _bbox, gradX);
+        addPsfImage(*_psf->computeImage(center + stepY), 0, 0,  scale, _bbox, gradY);
+        addPsfImage(*_psf->computeImage(center - stepY), 0, 0, -scale, _bbox, gradY);
+    }
+}
+
+std::pair<double,int> PsfDipoleFluxWorkspace::chi2(
+    double negCenterX, double negCenterY, double negFlux,
+    double posCenterX, double posCenterY, double posFlux
+) {
+    /*
+     * Fit for the superposition of Psfs at the two centroids.
+     */
+    _fillModel(afwGeom::Point2D(negCenterX, negCenterY), _negModel);
+    _fillModel(afwGeom::Point2D(posCenterX, posCenterY), _posModel);
+
+    // [(model-data)/sigma]**2, summed over the usable pixels
+    double chi2 = 0.0;
+    for (SpanIterator sp = _spans.begin(); sp != _spans.end(); ++sp) {
+        for (int i = sp->first; i < sp->second; ++i) {
+            double const resid = negFlux*_negModel[i] + posFlux*_posModel[i] - _data[i];
+            chi2 += resid*resid*_invVar[i];
+        }
+    }
+    return std::pair<double,int>(chi2, _nPix);
+}
+
+std::pair<double,int> PsfDipoleFluxWorkspace::solveFluxes(
+    double negCenterX, double negCenterY,
+    double posCenterX, double posCenterY,
+    double &negFlux, double &posFlux,
+    double &negFluxSigma, double &posFluxSigma
+) {
+    _fillModel(afwGeom::Point2D(negCenterX, negCenterY), _negModel);
+    _fillModel(afwGeom::Point2D(posCenterX, posCenterY), _posModel);
+
+    // Weighted normal equations for the two lobe amplitudes
+    double ann = 0.0, anp = 0.0, app = 0.0, bn = 0.0, bp = 0.0;
+    for (SpanIterator sp = _spans.begin(); sp != _spans.end(); ++sp) {
+        for (int i = sp->first; i < sp->second; ++i) {
+            double const wNeg = _invVar[i] * _negModel[i];
+            double const wPos = _invVar[i] * _posModel[i];
+            ann += wNeg * _negModel[i];
+            anp += wNeg * _posModel[i];
+            app += wPos * _posModel[i];
+            bn  += wNeg * _data[i];
+            bp  += wPos * _data[i];
+        }
+    }
+
+    // chi2 is a convex quadratic in the fluxes
+    double const det = ann*app - anp*anp;
+    negFlux = posFlux = 0.0;
+    bool solved = false;
+    if (det > 0.0) {
+        negFlux = (app*bn - anp*bp) / det;
+        posFlux = (ann*bp - anp*bn) / det;
+        solved = (negFlux <= 0.0) && (posFlux >= 0.0);
+    }
+    if (!solved) {
+        /* The constrained minimum lies on a boundary; compare the best single-lobe solutions */
+        double const negOnly = (ann > 0.0) ? std::min(0.0, bn / ann) : 0.0;
+        double const posOnly = (app > 0.0) ? std::max(0.0, bp / app) : 0.0;
+        double const negOnlyChi2 = _dataChi2 - 2.0*negOnly*bn + negOnly*negOnly*ann;
+        double const posOnlyChi2 = _dataChi2 - 2.0*posOnly*bp + posOnly*posOnly*app;
+        if (negOnlyChi2 < posOnlyChi2) {
+            negFlux = negOnly;
+            posFlux = 0.0;
+        } else {
+            negFlux = 0.0;
+            posFlux = posOnly;
+        }
+    }
+
+    if (det > 0.0) {
+        negFluxSigma = std::sqrt(app / det);
+        posFluxSigma = std::sqrt(ann / det);
+    } else {
+        negFluxSigma = (ann > 0.0) ? std::sqrt(1.0 / ann) : std::numeric_limits<double>::quiet_NaN();
+        posFluxSigma = (app > 0.0) ? std::sqrt(1.0 / app) : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    double const chi2 = _dataChi2 - 2.0*(negFlux*bn + posFlux*bp) +
+        negFlux*negFlux*ann + 2.0*negFlux*posFlux*anp + posFlux*posFlux*app;
+    return std::pair<double,int>(std::max(chi2, 0.0), _nPix);
+}
+
+std::vector<double> PsfDipoleFluxWorkspace::gradient(
+    double negCenterX, double negCenterY, double negFlux,
+    double posCenterX, double posCenterY, double posFlux
+) {
+    afwGeom::Point2D negCenter(negCenterX, negCenterY);
+    afwGeom::Point2D posCenter(posCenterX, posCenterY);
+    _fillModel(negCenter, _negModel);
+    _fillModel(posCenter, _posModel);
+    _fillGradient(negCenter, _negGradX, _negGradY);
+    _fillGradient(posCenter, _posGradX, _posGradY);
+
+    /*
+     * The model is linear in the fluxes, whose derivatives are the unit-flux
+     * lobes; the centroid derivatives are the lobe gradients scaled by flux.
+     */
+    double sumNeg = 0.0, sumNegX = 0.0, sumNegY = 0.0;
+    double sumPos = 0.0, sumPosX = 0.0, sumPosY = 0.0;
+    for (SpanIterator sp = _spans.begin(); sp != _spans.end(); ++sp) {
+        for (int i = sp->first; i < sp->second; ++i) {
+            double const wResid = (negFlux*_negModel[i] + posFlux*_posModel[i] - _data[i]) * _invVar[i];
+            sumNeg  += wResid * _negModel[i];
+            sumNegX += wResid * _negGradX[i];
+            sumNegY += wResid * _negGradY[i];
+            sumPos  += wResid * _posModel[i];
+            sumPosX += wResid * _posGradX[i];
+            sumPosY += wResid * _posGradY[i];
+        }
+    }
+
+    std::vector<double> grad(6);
+    grad[NEGCENTXPAR] = 2.0 * negFlux * sumNegX;
+    grad[NEGCENTYPAR] = 2.0 * negFlux * sumNegY;
+    grad[NEGFLUXPAR]  = 2.0 * sumNeg;
+    grad[POSCENTXPAR] = 2.0 * posFlux * sumPosX;
+    grad[POSCENTYPAR] = 2.0 * posFlux * sumPosY;
+    grad[POSFLUXPAR]  = 2.0 * sumPos;
+    return grad;
+}
+
 /**
  * Class to minimize PsfDipoleFlux; this is the object that Minuit minimizes
+ *
+ * @note Supplies analytic derivatives of chi2, so Minuit need not estimate
+ * them with additional function evaluations
  */
-class MinimizeDipoleChi2 : public ROOT::Minuit2::FCNBase {
+class MinimizeDipoleChi2 : public ROOT::Minuit2::FCNGradientBase {
 public:
-    explicit MinimizeDipoleChi2(PsfDipoleFlux const& psfDipoleFlux,
-                                afw::table::SourceRecord & source,
-                                afw::image::Exposure<float> const& exposure
+    explicit MinimizeDipoleChi2(PsfDipoleFluxWorkspace & workspace
                                 ) : _errorDef(1.0),
                                     _nPar(6),
                                     _maxPix(1e4),
                                     _bigChi2(1e10),
-                                    _psfDipoleFlux(psfDipoleFlux),
-                                    _source(source),
-                                    _exposure(exposure)
+                                    _workspace(workspace)
     {}
     double Up() const { return _errorDef; }
     void setErrorDef(double def) { _errorDef = def; }
@@ -294,8 +756,8 @@ public:
             return _bigChi2;
         }
 
-        std::pair<double,int> fit = _psfDipoleFlux.chi2(_source, _exposure, negCenterX, negCenterY, negFlux,
-                                                        posCenterX, posCenterY, posFlux);
+        std::pair<double,int> fit = _workspace.chi2(negCenterX, negCenterY, negFlux,
+                                                    posCenterX, posCenterY, posFlux);
         double chi2 = fit.first;
         int nPix = fit.second;
         if (nPix > _maxPix) {
@@ -305,6 +767,27 @@ public:
         return chi2;
     }
 
+    // Derivatives of the cost function with respect to params
+    virtual std::vector<double> Gradient(std::vector<double> const & params) const {
+        double negFlux    = params[NEGFLUXPAR];
+        double posFlux    = params[POSFLUXPAR];
+
+        /* Flat outside the allowed region, as is the cost function */
+        if ((negFlux > 0.0) || (posFlux < 0.0) || (_workspace.getNPix() > _maxPix)) {
+            return std::vector<double>(_nPar, 0.0);
+        }
+
+        return _workspace.gradient(params[NEGCENTXPAR], params[NEGCENTYPAR], negFlux,
+                                   params[POSCENTXPAR], params[POSCENTYPAR], posFlux);
+    }
+
+    /*
+     * Let Minuit compare the gradient with its own numerical estimate when it
+     * is the exact derivative of the cached Psf interpolant; without the cache
+     * it is itself a finite difference, checked in tests/dipole.py instead
+     */
+    virtual bool CheckGradient() const { return _workspace.hasPsfCache(); }
+
 private:
     double _errorDef;       // how much cost function has changed at the +- 1 error points
     int _nPar;              // number of parameters in the fit; hard coded for MinimizeDipoleChi2
@@ -312,9 +795,66 @@ private:
                             // prevents too much centroid wander
     double _bigChi2;        // large value to tell fitter when it has gone into bad region of parameter space
 
-    PsfDipoleFlux const& _psfDipoleFlux;
-    afw::table::SourceRecord & _source;
-    afw::image::Exposure<float> const& _exposure;
+    PsfDipoleFluxWorkspace & _workspace;  // Minuit requires a const operator(); the workspace is scratch
+};
+
+/**
+ * Class to minimize PsfDipoleFlux over the lobe centroids only
+ *
+ * @note The model is linear in the fluxes, which are solved for exactly at
+ * each step (variable projection).  The gradient of the projected chi2 with
+ * respect to the centroids is the partial gradient at the optimal fluxes.
+ */
+class MinimizeDipoleCentroidChi2 : public ROOT::Minuit2::FCNGradientBase {
+public:
+    enum { NEGCENTX = 0, NEGCENTY, POSCENTX, POSCENTY, NPAR };
+
+    explicit MinimizeDipoleCentroidChi2(PsfDipoleFluxWorkspace & workspace
+                                        ) : _errorDef(1.0),
+                                            _maxPix(1e4),
+                                            _bigChi2(1e10),
+                                            _workspace(workspace)
+    {}
+    double Up() const { return _errorDef; }
+    void setErrorDef(double def) { _errorDef = def; }
+    int getMaxPix() const { return _maxPix; }
+    void setMaxPix(int maxPix) { _maxPix = maxPix; }
+
+    virtual double operator()(std::vector<double> const & params) const {
+        if (_workspace.getNPix() > _maxPix) {
+            return _bigChi2;
+        }
+        double negFlux, posFlux, negFluxSigma, posFluxSigma;
+        return _workspace.solveFluxes(params[NEGCENTX], params[NEGCENTY],
+                                      params[POSCENTX], params[POSCENTY],
+                                      negFlux, posFlux, negFluxSigma, posFluxSigma).first;
+    }
+
+    virtual std::vector<double> Gradient(std::vector<double> const & params) const {
+        std::vector<double> grad(NPAR, 0.0);
+        if (_workspace.getNPix() > _maxPix) {
+            return grad;
+        }
+        double negFlux, posFlux, negFluxSigma, posFluxSigma;
+        _workspace.solveFluxes(params[NEGCENTX], params[NEGCENTY], params[POSCENTX], params[POSCENTY],
+                               negFlux, posFlux, negFluxSigma, posFluxSigma);
+        std::vector<double> full = _workspace.gradient(params[NEGCENTX], params[NEGCENTY], negFlux,
+                                                       params[POSCENTX], params[POSCENTY], posFlux);
+        grad[NEGCENTX] = full[NEGCENTXPAR];
+        grad[NEGCENTY] = full[NEGCENTYPAR];
+        grad[POSCENTX] = full[POSCENTXPAR];
+        grad[POSCENTY] = full[POSCENTYPAR];
+        return grad;
+    }
+
+    virtual bool CheckGradient() const { return _workspace.hasPsfCache(); }
+
+private:
+    double _errorDef;       // how much cost function has changed at the +- 1 error points
+    int _maxPix;            // maximum number of pixels that shoud be in the footprint
+    double _bigChi2;        // large value to tell fitter when it has gone into bad region of parameter space
+
+    PsfDipoleFluxWorkspace & _workspace;
 };
 
 std::pair<double,int> PsfDipoleFlux::chi2(
@@ -323,72 +863,226 @@ std::pair<double,int> PsfDipoleFlux::chi2(
     double negCenterX, double negCenterY, double negFlux,
     double posCenterX, double posCenterY, double posFlux
 ) const {
+    // A single evaluation: filling the Psf cache would cost more than it saves, and interpolate
+    PsfDipoleFluxWorkspace workspace(*source.getFootprint(), exposure, 0);
+    return workspace.chi2(negCenterX, negCenterY, negFlux, posCenterX, posCenterY, posFlux);
+}
 
-    afw::geom::Point2D negCenter(negCenterX, negCenterY);
-    afw::geom::Point2D posCenter(posCenterX, posCenterY);
+std::vector<double> PsfDipoleFlux::gradient(
+    afw::table::SourceRecord & source,
+    afw::image::Exposure<float> const& exposure,
+    double negCenterX, double negCenterY, double negFlux,
+    double posCenterX, double posCenterY, double posFlux
+) const {
+    // As for chi2, evaluate the Psf model exactly
+    PsfDipoleFluxWorkspace workspace(*source.getFootprint(), exposure, 0);
+    return workspace.gradient(negCenterX, negCenterY, negFlux, posCenterX, posCenterY, posFlux);
+}
 
-    CONST_PTR(afw::detection::Footprint) footprint = source.getFootprint();
+/**
+ * Starting point of a PsfDipoleFlux fit
+ */
+struct PsfDipoleFitSeed {
+    double negCenterX, negCenterY, negFlux;
+    double posCenterX, posCenterY, posFlux;
+    double negStepCoord, negStepFlux;
+    double posStepCoord, posStepFlux;
+    bool solveFluxes;      // replace the fluxes by a linear fit at the starting centroids
+};
 
-    /*
-     * Fit for the superposition of Psfs at the two centroids.
-     */
-    CONST_PTR(afwDet::Psf) psf = exposure.getPsf();
-    PTR(afwImage::Image<afwMath::Kernel::Pixel>) negPsf = psf->computeImage(negCenter);
-    PTR(afwImage::Image<afwMath::Kernel::Pixel>) posPsf = psf->computeImage(posCenter);
-
-    afwImage::Image<double> negModel(footprint->getBBox());
-    afwImage::Image<double> posModel(footprint->getBBox());
-    afwImage::Image<float> data(*(exposure.getMaskedImage().getImage()),footprint->getBBox());
-    afwImage::Image<afwImage::VariancePixel> var(*(exposure.getMaskedImage().getVariance()),
-                                                 footprint->getBBox());
-
-    afwGeom::Box2I negPsfBBox = negPsf->getBBox();
-    afwGeom::Box2I posPsfBBox = posPsf->getBBox();
-    afwGeom::Box2I negModelBBox = negModel.getBBox();
-    afwGeom::Box2I posModelBBox = posModel.getBBox();
-
-    // Portion of the negative Psf that overlaps the model
-    int negXmin = std::max(negPsfBBox.getMinX(), negModelBBox.getMinX());
-    int negYmin = std::max(negPsfBBox.getMinY(), negModelBBox.getMinY());
-    int negXmax = std::min(negPsfBBox.getMaxX(), negModelBBox.getMaxX());
-    int negYmax = std::min(negPsfBBox.getMaxY(), negModelBBox.getMaxY());
-    afwGeom::Box2I negBBox = afwGeom::Box2I(afwGeom::Point2I(negXmin, negYmin),
-                                            afwGeom::Point2I(negXmax, negYmax));
-    afwImage::Image<afwMath::Kernel::Pixel> negSubim(*negPsf, negBBox);
-    afwImage::Image<double> negModelSubim(negModel, negBBox);
-    negModelSubim += negSubim;
-
-    // Portion of the positive Psf that overlaps the model
-    int posXmin = std::max(posPsfBBox.getMinX(), posModelBBox.getMinX());
-    int posYmin = std::max(posPsfBBox.getMinY(), posModelBBox.getMinY());
-    int posXmax = std::min(posPsfBBox.getMaxX(), posModelBBox.getMaxX());
-    int posYmax = std::min(posPsfBBox.getMaxY(), posModelBBox.getMaxY());
-    afwGeom::Box2I posBBox = afwGeom::Box2I(afwGeom::Point2I(posXmin, posYmin),
-                                            afwGeom::Point2I(posXmax, posYmax));
-    afwImage::Image<afwMath::Kernel::Pixel> posSubim(*posPsf, posBBox);
-    afwImage::Image<double> posModelSubim(posModel, posBBox);
-    posModelSubim += posSubim;
-
-    negModel  *= negFlux;   // scale negative model to image
-    posModel  *= posFlux;   // scale positive model to image
-    afwImage::Image<double> residuals(negModel, true); // full model contains negative lobe...
-    residuals += posModel;  // plus positive lobe...
-    residuals -= data;      // minus the data...
-    residuals *= residuals; // squared...
-    residuals /= var;       // divided by the variance : [(model-data)/sigma]**2
-    afwMath::Statistics stats = afwMath::makeStatistics(residuals, afwMath::SUM | afwMath::NPOINT);
-    double chi2 = stats.getValue(afwMath::SUM);
-    int nPix = stats.getValue(afwMath::NPOINT);
-    return std::pair<double,int>(chi2, nPix);
+/**
+ * Outcome of a PsfDipoleFlux fit
+ */
+struct PsfDipoleFitResult {
+    double negCenterX, negCenterY, negFlux, negFluxSigma;
+    double posCenterX, posCenterY, posFlux, posFluxSigma;
+    double chi2;
+    int nPix;
+    int nPar;
+};
+
+namespace {
+
+/*
+ * Run the minimizer selected by ctrl.  Touches nothing but the workspace, so
+ * fits with separate workspaces may run concurrently provided the Psf is not
+ * evaluated during the fit (i.e. the workspace has a Psf cache).
+ */
+PsfDipoleFitResult fitDipole(
+    PsfDipoleFluxWorkspace & workspace,
+    PsfDipoleFluxControl const& ctrl,
+    PsfDipoleFitSeed const& seed
+) {
+    double negCenterX, negCenterY, negFlux, negFluxSigma;
+    double posCenterX, posCenterY, posFlux, posFluxSigma;
+
+    PsfDipoleFitSeed start(seed);
+    if (seed.solveFluxes && !ctrl.fitFluxesLinearly) {
+        // Quick linear estimate of the fluxes, and their uncertainties as step sizes
+        workspace.solveFluxes(seed.negCenterX, seed.negCenterY, seed.posCenterX, seed.posCenterY,
+                              negFlux, posFlux, negFluxSigma, posFluxSigma);
+        if (negFlux < 0.0) {
+            start.negFlux = negFlux;
+            if (std::isfinite(negFluxSigma) && (negFluxSigma > 0.0)) {
+                start.negStepFlux = negFluxSigma;
+            }
+        }
+        if (posFlux > 0.0) {
+            start.posFlux = posFlux;
+            if (std::isfinite(posFluxSigma) && (posFluxSigma > 0.0)) {
+                start.posStepFlux = posFluxSigma;
+            }
+        }
+    }
+
+    if (ctrl.fitFluxesLinearly) {
+        // Only the centroids are nonlinear parameters; fluxes are solved at each step
+        ROOT::Minuit2::MnUserParameters fitPar;
+
+        fitPar.Add((boost::format("P%d")%NEGCENTXPAR).str(), start.negCenterX, start.negStepCoord);
+        fitPar.Add((boost::format("P%d")%NEGCENTYPAR).str(), start.negCenterY, start.negStepCoord);
+        fitPar.Add((boost::format("P%d")%POSCENTXPAR).str(), start.posCenterX, start.posStepCoord);
+        fitPar.Add((boost::format("P%d")%POSCENTYPAR).str(), start.posCenterY, start.posStepCoord);
+
+        MinimizeDipoleCentroidChi2 minimizerFunc(workspace);
+        minimizerFunc.setErrorDef(ctrl.errorDef);
+
+        ROOT::Minuit2::MnMigrad migrad(minimizerFunc, fitPar);
+        ROOT::Minuit2::FunctionMinimum min = migrad(ctrl.maxFnCalls);
+
+        negCenterX = min.UserState().Value(MinimizeDipoleCentroidChi2::NEGCENTX);
+        negCenterY = min.UserState().Value(MinimizeDipoleCentroidChi2::NEGCENTY);
+        posCenterX = min.UserState().Value(MinimizeDipoleCentroidChi2::POSCENTX);
+        posCenterY = min.UserState().Value(MinimizeDipoleCentroidChi2::POSCENTY);
+        workspace.solveFluxes(negCenterX, negCenterY, posCenterX, posCenterY,
+                              negFlux, posFlux, negFluxSigma, posFluxSigma);
+    } else {
+        // Set up fit parameters and param names
+        ROOT::Minuit2::MnUserParameters fitPar;
+
+        fitPar.Add((boost::format("P%d")%NEGCENTXPAR).str(), start.negCenterX, start.negStepCoord);
+        fitPar.Add((boost::format("P%d")%NEGCENTYPAR).str(), start.negCenterY, start.negStepCoord);
+        fitPar.Add((boost::format("P%d")%NEGFLUXPAR).str(), start.negFlux, start.negStepFlux);
+        fitPar.Add((boost::format("P%d")%POSCENTXPAR).str(), start.posCenterX, start.posStepCoord);
+        fitPar.Add((boost::format("P%d")%POSCENTYPAR).str(), start.posCenterY, start.posStepCoord);
+        fitPar.Add((boost::format("P%d")%POSFLUXPAR).str(), start.posFlux, start.posStepFlux);
+
+        // Create the minuit object that knows how to minimise our functor
+        //
+        MinimizeDipoleChi2 minimizerFunc(workspace);
+        minimizerFunc.setErrorDef(ctrl.errorDef);
+
+        //
+        // tell minuit about it
+        //
+        ROOT::Minuit2::MnMigrad migrad(minimizerFunc, fitPar);
+
+        //
+        // And let it loose
+        //
+        ROOT::Minuit2::FunctionMinimum min = migrad(ctrl.maxFnCalls);
+
+        // Coefficients are recorded even if minuit is unhappy
+        negCenterX = min.UserState().Value(NEGCENTXPAR);
+        negCenterY = min.UserState().Value(NEGCENTYPAR);
+        negFlux = min.UserState().Value(NEGFLUXPAR);
+        negFluxSigma = min.UserState().Error(NEGFLUXPAR);
+        posCenterX = min.UserState().Value(POSCENTXPAR);
+        posCenterY = min.UserState().Value(POSCENTYPAR);
+        posFlux = min.UserState().Value(POSFLUXPAR);
+        posFluxSigma = min.UserState().Error(POSFLUXPAR);
+    }
+
+    /* Evaluate chi2 once more at the minimum; the workspace also supplies nPix for chi2/dof */
+    std::pair<double,int> fit = workspace.chi2(negCenterX, negCenterY, negFlux,
+                                               posCenterX, posCenterY, posFlux);
+
+    PsfDipoleFitResult result;
+    result.negCenterX = negCenterX;
+    result.negCenterY = negCenterY;
+    result.negFlux = negFlux;
+    result.negFluxSigma = negFluxSigma;
+    result.posCenterX = posCenterX;
+    result.posCenterY = posCenterY;
+    result.posFlux = posFlux;
+    result.posFluxSigma = posFluxSigma;
+    result.chi2 = fit.first;
+    result.nPix = fit.second;
+    result.nPar = 6;
+    return result;
 }
 
-void PsfDipoleFlux::measure(
-    afw::table::SourceRecord & source,
-    afw::image::Exposure<float> const & exposure
-) const {
+/**
+ * One source of a batched fit; the workspace is built, and the results
+ * written, serially in catalog order.  The workspace is released as soon as
+ * the fit finishes, leaving only the result.
+ */
+struct PsfDipoleFitJob {
+    std::size_t index;                                   // position in the catalog
+    PsfDipoleFitSeed seed;
+    boost::shared_ptr<PsfDipoleFluxWorkspace> workspace;
+    PsfDipoleFitResult result;
+    bool isFitted;
+    std::string message;                                 // why the fit failed, if it did
+};
 
-    typedef afw::image::Exposure<float>::MaskedImageT MaskedImageT;
+/**
+ * Worker shared by the threads of a batched fit; each thread takes the next
+ * unfitted job until none remain
+ */
+class PsfDipoleFitQueue {
+public:
+    PsfDipoleFitQueue(std::vector<PsfDipoleFitJob> & jobs,
+                      PsfDipoleFluxControl const& ctrl) : _jobs(jobs), _ctrl(ctrl), _next(0), _mutex() {}
+
+    void operator()() {
+        for (;;) {
+            std::size_t i;
+            {
+                boost::mutex::scoped_lock lock(_mutex);
+                if (_next >= _jobs.size()) {
+                    return;
+                }
+                i = _next++;
+            }
+            PsfDipoleFitJob & job = _jobs[i];
+            try {
+                job.result = fitDipole(*job.workspace, _ctrl, job.seed);
+                job.isFitted = true;
+            } catch (std::exception & e) {
+                job.message = e.what();
+            }
+            job.workspace.reset();
+        }
+    }
+
+private:
+    std::vector<PsfDipoleFitJob> & _jobs;
+    PsfDipoleFluxControl const& _ctrl;
+    std::size_t _next;
+    boost::mutex _mutex;
+};
 
+/*
+ * Jobs per thread in each chunk of a batched fit: enough to balance the load,
+ * few enough that only a handful of workspaces are alive at once
+ */
+int const FIT_JOBS_PER_THREAD = 4;
+
+/*
+ * Step size for a lobe centroid from its naive uncertainty, if there is one
+ */
+double naiveStepSize(meas::base::CentroidResult const& centroid, double defaultStep) {
+    double const sigma = std::max(centroid.xSigma, centroid.ySigma);
+    return (std::isfinite(sigma) && (sigma > 0.0)) ? sigma : defaultStep;
+}
+
+} // anonymous namespace
+
+bool PsfDipoleFlux::_makeSeed(
+    afw::table::SourceRecord const & source,
+    PsfDipoleFitSeed & seed
+) const {
     CONST_PTR(afw::detection::Footprint) footprint = source.getFootprint();
     if (!footprint) {
         throw LSST_EXCEPT(pex::exceptions::RuntimeError,
@@ -403,7 +1097,7 @@ void PsfDipoleFlux::measure(
     }
     else if (peakCatalog.size() == 1) {
         // No deblending to do
-        return;
+        return false;
     }
 
     // For N>=2, just measure the brightest-positive and brightest-negative
@@ -412,69 +1106,153 @@ void PsfDipoleFlux::measure(
     afw::detection::PeakRecord const& positivePeak = peakCatalog.front();
     afw::detection::PeakRecord const& negativePeak = peakCatalog.back();
 
-    // Set up fit parameters and param names
-    ROOT::Minuit2::MnUserParameters fitPar;
-
-    fitPar.Add((boost::format("P%d")%NEGCENTXPAR).str(), negativePeak.getFx(), _ctrl.stepSizeCoord);
-    fitPar.Add((boost::format("P%d")%NEGCENTYPAR).str(), negativePeak.getFy(), _ctrl.stepSizeCoord);
-    fitPar.Add((boost::format("P%d")%NEGFLUXPAR).str(), negativePeak.getPeakValue(), _ctrl.stepSizeFlux);
-    fitPar.Add((boost::format("P%d")%POSCENTXPAR).str(), positivePeak.getFx(), _ctrl.stepSizeCoord);
-    fitPar.Add((boost::format("P%d")%POSCENTYPAR).str(), positivePeak.getFy(), _ctrl.stepSizeCoord);
-    fitPar.Add((boost::format("P%d")%POSFLUXPAR).str(), positivePeak.getPeakValue(), _ctrl.stepSizeFlux);
-
-    // Create the minuit object that knows how to minimise our functor
-    //
-    MinimizeDipoleChi2 minimizerFunc(*this, source, exposure);
-    minimizerFunc.setErrorDef(_ctrl.errorDef);
-
-    //
-    // tell minuit about it
-    //
-    ROOT::Minuit2::MnMigrad migrad(minimizerFunc, fitPar);
-
-    //
-    // And let it loose
-    //
-    ROOT::Minuit2::FunctionMinimum min = migrad(_ctrl.maxFnCalls);
-
-    float minChi2 = min.Fval();
-    bool const isValid = min.IsValid() && std::isfinite(minChi2);
-
-    if (true || isValid) {              // calculate coeffs even in minuit is unhappy
-
-        /* I need to call chi2 one more time to grab nPix to calculate chi2/dof.
-           Turns out that the Minuit operator method has to be const, and the
-           measurement _apply method has to be const, so I can't store nPix as a
-           private member variable anywhere.  Consted into a corner.
-        */
-        std::pair<double,int> fit = chi2(source, exposure,
-                                         min.UserState().Value(NEGCENTXPAR),
-                                         min.UserState().Value(NEGCENTYPAR),
-                                         min.UserState().Value(NEGFLUXPAR),
-                                         min.UserState().Value(POSCENTXPAR),
-                                         min.UserState().Value(POSCENTYPAR),
-                                         min.UserState().Value(POSFLUXPAR));
-        double evalChi2 = fit.first;
-        int nPix = fit.second;
+    seed.negCenterX = negativePeak.getFx();
+    seed.negCenterY = negativePeak.getFy();
+    seed.negFlux = negativePeak.getPeakValue();
+    seed.posCenterX = positivePeak.getFx();
+    seed.posCenterY = positivePeak.getFy();
+    seed.posFlux = positivePeak.getPeakValue();
+    seed.negStepCoord = seed.posStepCoord = _ctrl.stepSizeCoord;
+    seed.negStepFlux = seed.posStepFlux = _ctrl.stepSizeFlux;
+    seed.solveFluxes = false;
+
+    if (_ctrl.seedFromNaive) {
+        // Lobes the naive algorithms failed on keep their peak-based starting values
+        meas::base::CentroidResult const negCentroid = _naiveNegCentroid.get(source);
+        if (std::isfinite(negCentroid.x) && std::isfinite(negCentroid.y)) {
+            seed.negCenterX = negCentroid.x;
+            seed.negCenterY = negCentroid.y;
+            seed.negStepCoord = naiveStepSize(negCentroid, _ctrl.stepSizeCoord);
+            seed.solveFluxes = true;
+        }
+        meas::base::CentroidResult const posCentroid = _naivePosCentroid.get(source);
+        if (std::isfinite(posCentroid.x) && std::isfinite(posCentroid.y)) {
+            seed.posCenterX = posCentroid.x;
+            seed.posCenterY = posCentroid.y;
+            seed.posStepCoord = naiveStepSize(posCentroid, _ctrl.stepSizeCoord);
+            seed.solveFluxes = true;
+        }
+
+        // Fallback should the linear flux fit fail
+        if (_naiveNegFlux.isValid() && _naivePosFlux.isValid()) {
+            double const negFlux = source.get(_naiveNegFlux.getFlux());
+            double const posFlux = source.get(_naivePosFlux.getFlux());
+            if (std::isfinite(negFlux) && (negFlux < 0.0)) {
+                seed.negFlux = negFlux;
+            }
+            if (std::isfinite(posFlux) && (posFlux > 0.0)) {
+                seed.posFlux = posFlux;
+            }
+        }
+    }
+    return true;
+}
+
+void PsfDipoleFlux::_setResult(
+    afw::table::SourceRecord & source,
+    PsfDipoleFitResult const & fit
+) const {
+    source.set(getNegativeKeys().getFlux(), fit.negFlux);
+    source.set(getNegativeKeys().getFluxSigma(), fit.negFluxSigma);
+    source.set(getPositiveKeys().getFlux(), fit.posFlux);
+    source.set(getPositiveKeys().getFluxSigma(), fit.posFluxSigma);
+
+    source.set(_chi2dofKey, fit.chi2 / (fit.nPix - fit.nPar));
+    source.set(_negCentroid.getX(), fit.negCenterX);
+    source.set(_negCentroid.getY(), fit.negCenterY);
+    source.set(_posCentroid.getX(), fit.posCenterX);
+    source.set(_posCentroid.getY(), fit.posCenterY);
+    source.set(_avgCentroid.getX(), 0.5*(fit.negCenterX + fit.posCenterX));
+    source.set(_avgCentroid.getY(), 0.5*(fit.negCenterY + fit.posCenterY));
+}
+
+void PsfDipoleFlux::measure(
+    afw::table::SourceRecord & source,
+    afw::image::Exposure<float> const & exposure
+) const {
+    PsfDipoleFitSeed seed;
+    if (!_makeSeed(source, seed)) {
+        return;
+    }
 
-        PTR(afw::geom::Point2D) minNegCentroid(new afw::geom::Point2D(min.UserState().Value(NEGCENTXPAR),
-                                                                      min.UserState().Value(NEGCENTYPAR)));
-        source.set(getNegativeKeys().getFlux(), min.UserState().Value(NEGFLUXPAR));
-        source.set(getNegativeKeys().getFluxSigma(), min.UserState().Error(NEGFLUXPAR));
+    // Data, variance and model buffers are set up once for all function evaluations
+    PsfDipoleFluxWorkspace workspace(*source.getFootprint(), exposure, _ctrl.psfCacheOversample);
 
-        PTR(afw::geom::Point2D) minPosCentroid(new afw::geom::Point2D(min.UserState().Value(POSCENTXPAR),
-                                                                      min.UserState().Value(POSCENTYPAR)));
-        source.set(getPositiveKeys().getFlux(), min.UserState().Value(POSFLUXPAR));
-        source.set(getPositiveKeys().getFluxSigma(), min.UserState().Error(POSFLUXPAR));
+    _setResult(source, fitDipole(workspace, _ctrl, seed));
+}
 
-        source.set(_chi2dofKey, evalChi2 / (nPix - minimizerFunc.getNpar()));
-        source.set(_negCentroid.getX(), minNegCentroid->getX());
-        source.set(_negCentroid.getY(), minNegCentroid->getY());
-        source.set(_posCentroid.getX(), minPosCentroid->getX());
-        source.set(_posCentroid.getY(), minPosCentroid->getY());
-        source.set(_avgCentroid.getX(), 0.5*(minNegCentroid->getX() + minPosCentroid->getX()));
-        source.set(_avgCentroid.getY(), 0.5*(minNegCentroid->getY() + minPosCentroid->getY()));
+void PsfDipoleFlux::measureAll(
+    afw::table::SourceCatalog & sources,
+    afw::image::Exposure<float> const & exposure,
+    int nThreads
+) const {
+    if (nThreads <= 0) {
+        nThreads = std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+    }
+    if (_ctrl.psfCacheOversample <= 0 && nThreads > 1) {
+        // Psf models are not safe to evaluate concurrently
+        pexLog::TTrace<3>("lsst.ip.diffim.PsfDipoleFlux.measureAll",
+                          "Psf cache disabled; fitting %d sources serially",
+                          static_cast<int>(sources.size()));
+        nThreads = 1;
+    }
 
+    /*
+     * Sources are fitted in chunks of a few jobs per thread, so that only the
+     * workspaces of one chunk are held at a time.  Seeds and workspaces touch
+     * the afw objects, so are made serially.
+     */
+    std::size_t const chunkSize = static_cast<std::size_t>(nThreads) * FIT_JOBS_PER_THREAD;
+    std::vector<PsfDipoleFitJob> jobs;
+    jobs.reserve(chunkSize);
+    std::size_t i = 0;
+    while (i < sources.size()) {
+        jobs.clear();
+        for (; i < sources.size() && jobs.size() < chunkSize; ++i) {
+            afw::table::SourceRecord & source = sources[i];
+            PsfDipoleFitJob job;
+            job.index = i;
+            job.isFitted = false;
+            try {
+                if (!_makeSeed(source, job.seed)) {
+                    continue;
+                }
+                job.workspace.reset(new PsfDipoleFluxWorkspace(*source.getFootprint(), exposure,
+                                                               _ctrl.psfCacheOversample));
+            } catch (meas::base::MeasurementError & error) {
+                fail(source, &error);
+                continue;
+            } catch (pex::exceptions::Exception &) {
+                fail(source);
+                continue;
+            }
+            jobs.push_back(job);
+        }
+
+        PsfDipoleFitQueue queue(jobs, _ctrl);
+        if (nThreads == 1 || jobs.size() <= 1) {
+            queue();
+        } else {
+            boost::thread_group threads;
+            int const nChunkThreads = std::min(nThreads, static_cast<int>(jobs.size()));
+            for (int t = 0; t < nChunkThreads; ++t) {
+                threads.create_thread(boost::ref(queue));
+            }
+            threads.join_all();
+        }
+
+        // Results are written in catalog order, independent of the thread schedule
+        for (std::vector<PsfDipoleFitJob>::const_iterator job = jobs.begin(); job != jobs.end(); ++job) {
+            afw::table::SourceRecord & source = sources[job->index];
+            if (job->isFitted) {
+                _setResult(source, job->result);
+            } else {
+                pexLog::TTrace<3>("lsst.ip.diffim.PsfDipoleFlux.measureAll",
+                                  "Fit failed for source %lld: %s",
+                                  static_cast<long long>(source.getId()), job->message.c_str());
+                fail(source);
+            }
+        }
     }
 }
 
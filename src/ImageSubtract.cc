@@ -35,8 +35,6 @@
 #include <numeric>
 #include <limits>
 
-#include "boost/timer.hpp" 
-
 #include "Eigen/Core"
 
 #include "lsst/afw/image.h"
@@ -126,8 +124,7 @@ afwImage::MaskedImage<PixelT> convolveAndSubtract(
     bool invert                                              ///< Invert the output difference image
     ) {
 
-    boost::timer t;
-    t.restart();
+    Instrumentation::Timer timer(Instrumentation::RESIDUALS);
 
     afwImage::MaskedImage<PixelT> convolvedMaskedImage(templateImage.getDimensions());
     afwMath::ConvolutionControl convolutionControl = afwMath::ConvolutionControl();
@@ -146,9 +143,14 @@ afwImage::MaskedImage<PixelT> convolveAndSubtract(
         convolvedMaskedImage *= -1.0;
     }
 
-    double time = t.elapsed();
+    /* The image and variance planes are convolved */
+    double const nPix = templateImage.getWidth() * templateImage.getHeight();
+    timer.addBytes(nPix * (sizeof(PixelT) + sizeof(afwImage::MaskPixel) + sizeof(afwImage::VariancePixel)));
+    timer.addFlops(4. * nPix * convolutionKernel.getWidth() * convolutionKernel.getHeight() + 3. * nPix);
+    timer.stop();
     pexLog::TTrace<5>("lsst.ip.diffim.convolveAndSubtract", 
-                      "Total compute time to convolve and subtract : %.2f s", time);
+                      "Convolved and subtracted %d x %d pixels", 
+                      templateImage.getWidth(), templateImage.getHeight());
 
     return convolvedMaskedImage;
 }
@@ -177,8 +179,7 @@ afwImage::MaskedImage<PixelT> convolveAndSubtract(
     bool invert                                              ///< Invert the output difference image
     ) {
     
-    boost::timer t;
-    t.restart();
+    Instrumentation::Timer timer(Instrumentation::RESIDUALS);
 
     afwImage::MaskedImage<PixelT> convolvedMaskedImage(templateImage.getDimensions());
     afwMath::ConvolutionControl convolutionControl = afwMath::ConvolutionControl();
@@ -199,9 +200,13 @@ afwImage::MaskedImage<PixelT> convolveAndSubtract(
     convolvedMaskedImage.getMask()->assign(*scienceMaskedImage.getMask());
     convolvedMaskedImage.getVariance()->assign(*scienceMaskedImage.getVariance());
     
-    double time = t.elapsed();
+    double const nPix = templateImage.getWidth() * templateImage.getHeight();
+    timer.addBytes(nPix * (sizeof(PixelT) + sizeof(afwImage::MaskPixel) + sizeof(afwImage::VariancePixel)));
+    timer.addFlops(2. * nPix * convolutionKernel.getWidth() * convolutionKernel.getHeight() + 3. * nPix);
+    timer.stop();
     pexLog::TTrace<5>("lsst.ip.diffim.convolveAndSubtract", 
-                      "Total compute time to convolve and subtract : %.2f s", time);
+                      "Convolved and subtracted %d x %d pixels", 
+                      templateImage.getWidth(), templateImage.getHeight());
 
     return convolvedMaskedImage;
 }
@@ -0,0 +1,123 @@
+// -*- lsst-c++ -*-
+/**
+ * @file Instrumentation.cc
+ *
+ * @brief Implementation of Instrumentation
+ *
+ * @ingroup ip_diffim
+ */
+#include <sys/time.h>
+
+#include "boost/thread/mutex.hpp"
+
+#include "lsst/pex/exceptions/Runtime.h"
+
+#include "lsst/ip/diffim/Instrumentation.h"
+
+namespace pexExcept      = lsst::pex::exceptions;
+
+namespace lsst {
+namespace ip {
+namespace diffim {
+
+namespace {
+    /* Timers may end in several threads, e.g. of PsfDipoleFlux::measureAll */
+    boost::mutex recordMutex;
+
+    double wallClock() {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+    }
+
+    void checkPhase(Instrumentation::Phase phase) {
+        if ((phase < 0) || (phase >= Instrumentation::NPHASES)) {
+            throw LSST_EXCEPT(pexExcept::InvalidParameterError, "Invalid instrumentation phase");
+        }
+    }
+} // anonymous namespace
+
+    bool Instrumentation::_enabled = false;
+    int Instrumentation::_nCalls[Instrumentation::NPHASES] = {0, 0, 0, 0, 0};
+    double Instrumentation::_seconds[Instrumentation::NPHASES] = {0., 0., 0., 0., 0.};
+    double Instrumentation::_bytes[Instrumentation::NPHASES] = {0., 0., 0., 0., 0.};
+    double Instrumentation::_flops[Instrumentation::NPHASES] = {0., 0., 0., 0., 0.};
+
+    void Instrumentation::reset() {
+        boost::mutex::scoped_lock lock(recordMutex);
+        for (int i = 0; i < NPHASES; ++i) {
+            _nCalls[i]  = 0;
+            _seconds[i] = 0.;
+            _bytes[i]   = 0.;
+            _flops[i]   = 0.;
+        }
+    }
+
+    std::string Instrumentation::getPhaseName(Phase phase) {
+        switch (phase) {
+          case BASIS_CONVOLUTION:  return "basisConvolution";
+          case NORMAL_EQUATIONS:   return "normalEquations";
+          case SOLVE:              return "solve";
+          case RESIDUALS:          return "residuals";
+          case SPATIAL_ACCUMULATE: return "spatialAccumulate";
+          default:
+            throw LSST_EXCEPT(pexExcept::InvalidParameterError, "Invalid instrumentation phase");
+        }
+    }
+
+    int Instrumentation::getNCalls(Phase phase) {
+        checkPhase(phase);
+        boost::mutex::scoped_lock lock(recordMutex);
+        return _nCalls[phase];
+    }
+
+    double Instrumentation::getSeconds(Phase phase) {
+        checkPhase(phase);
+        boost::mutex::scoped_lock lock(recordMutex);
+        return _seconds[phase];
+    }
+
+    double Instrumentation::getBytes(Phase phase) {
+        checkPhase(phase);
+        boost::mutex::scoped_lock lock(recordMutex);
+        return _bytes[phase];
+    }
+
+    double Instrumentation::getFlops(Phase phase) {
+        checkPhase(phase);
+        boost::mutex::scoped_lock lock(recordMutex);
+        return _flops[phase];
+    }
+
+    void Instrumentation::_record(Phase phase, double seconds, double nBytes, double nFlops) {
+        boost::mutex::scoped_lock lock(recordMutex);
+        _nCalls[phase]  += 1;
+        _seconds[phase] += seconds;
+        _bytes[phase]   += nBytes;
+        _flops[phase]   += nFlops;
+    }
+
+    Instrumentation::Timer::Timer(Phase phase) :
+        _phase(phase),
+        _active(Instrumentation::_enabled),
+        _start(_active ? wallClock() : 0.),
+        _bytes(0.),
+        _flops(0.)
+    {}
+
+    Instrumentation::Timer::~Timer() {
+        stop();
+    }
+
+    void Instrumentation::Timer::stop() {
+        if (_active) {
+            Instrumentation::_record(_phase, wallClock() - _start, _bytes, _flops);
+            _active = false;
+        }
+    }
+
+    double Instrumentation::Timer::elapsed() const {
+        return _active ? wallClock() - _start : 0.;
+    }
+
+}}} // end of namespace lsst::ip::diffim
@@ -9,7 +9,8 @@
  * @ingroup ip_diffim
  */
 
-#include "boost/timer.hpp"
+#include <algorithm>
+
 
 #include "lsst/afw/math.h"
 #include "lsst/afw/image.h"
@@ -46,29 +47,15 @@ namespace diffim {
         _policy(policy),
         _source(),
         _coreFlux(),
+        _hasRating(false),
         _isInitialized(false),
+        _epoch(0),
         _useRegularization(false),
         _fitForBackground(_policy.getBool("fitForBackground")),
         _kernelSolutionOrig(),
         _kernelSolutionPca()
     {
-
-        /* Rank by mean core S/N in science image */
-        ImageStatistics<PixelT> imstats(_policy);
-        int candidateCoreRadius = _policy.getInt("candidateCoreRadius");
-        try {
-            imstats.apply(*_scienceMaskedImage, candidateCoreRadius);
-        } catch (pexExcept::Exception& e) {
-            pexLogging::TTrace<3>("lsst.ip.diffim.KernelCandidate",
-                                  "Unable to calculate core imstats for ranking Candidate %d", this->getId()); 
-            this->setStatus(afwMath::SpatialCellCandidate::BAD);
-            return;
-        }
-
-        _coreFlux = imstats.getMean();
-        pexLog::TTrace<5>("lsst.ip.diffim.KernelCandidate",
-                          "Candidate %d at %.2f %.2f with ranking %.2f", 
-                          this->getId(), this->getXCenter(), this->getYCenter(), _coreFlux);
+        /* Rating is measured by the first getCandidateRating(), if not supplied first */
     }
 
     template <typename PixelT>
@@ -85,7 +72,9 @@ namespace diffim {
         _policy(policy),
         _source(source),
         _coreFlux(source->getPsfFlux()),
+        _hasRating(true),
         _isInitialized(false),
+        _epoch(0),
         _useRegularization(false),
         _fitForBackground(_policy.getBool("fitForBackground")),
         _kernelSolutionOrig(),
@@ -96,6 +85,42 @@ namespace diffim {
                           this->getId(), this->getXCenter(), this->getYCenter(), _coreFlux);
     }
 
+    template <typename PixelT>
+    double KernelCandidate<PixelT>::getCandidateRating() const {
+        if (!_hasRating) {
+            _measureRating();
+        }
+        return _coreFlux;
+    }
+
+    /*
+     * Rank by mean core S/N in science image.  Deferred from construction:
+     * a candidate alone in its SpatialCell is never compared, so never
+     * measured.  Inserting into an occupied cell sorts by rating, so scans
+     * the stamp unless the rating was supplied.
+     */
+    template <typename PixelT>
+    void KernelCandidate<PixelT>::_measureRating() const {
+        _hasRating = true;
+        _coreFlux = 0.0;
+
+        ImageStatistics<PixelT> imstats(_policy);
+        int candidateCoreRadius = _policy.getInt("candidateCoreRadius");
+        try {
+            imstats.apply(*_scienceMaskedImage, candidateCoreRadius);
+        } catch (pexExcept::Exception& e) {
+            /* Ranked last; BuildSingleKernelVisitor rejects the stamp when it is visited */
+            pexLogging::TTrace<3>("lsst.ip.diffim.KernelCandidate",
+                                  "Unable to calculate core imstats for ranking Candidate %d", this->getId()); 
+            return;
+        }
+
+        _coreFlux = imstats.getMean();
+        pexLog::TTrace<5>("lsst.ip.diffim.KernelCandidate",
+                          "Candidate %d at %.2f %.2f with ranking %.2f", 
+                          this->getId(), this->getXCenter(), this->getYCenter(), _coreFlux);
+    }
+
     template <typename PixelT>
     void KernelCandidate<PixelT>::build(
         lsst::afw::math::KernelList const& basisList
@@ -108,6 +133,18 @@ namespace diffim {
         lsst::afw::math::KernelList const& basisList,
         boost::shared_ptr<Eigen::MatrixXd> hMat
         ) {
+        build(basisList, hMat, KernelBuildWorkspace::Ptr(new KernelBuildWorkspace()));
+    }
+
+    template <typename PixelT>
+    void KernelCandidate<PixelT>::build(
+        lsst::afw::math::KernelList const& basisList,
+        boost::shared_ptr<Eigen::MatrixXd> hMat,
+        KernelBuildWorkspace::Ptr workspace
+        ) {
+
+        /* Any solution derived from this candidate before now is stale */
+        ++_epoch;
 
         /* Examine the policy for control over the variance estimate */
         afwImage::Image<afwImage::VariancePixel> var =
@@ -132,7 +169,7 @@ namespace diffim {
         _varianceEstimate = VariancePtr( new afwImage::Image<afwImage::VariancePixel>(var) );
 
         try {
-            _buildKernelSolution(basisList, hMat);
+            _buildKernelSolution(basisList, hMat, workspace);
         } catch (pexExcept::Exception &e) {
             throw e;
         }
@@ -142,7 +179,7 @@ namespace diffim {
             _varianceEstimate = diffim.getVariance();
 
             try {
-                _buildKernelSolution(basisList, hMat);
+                _buildKernelSolution(basisList, hMat, workspace);
             } catch (pexExcept::Exception &e) {
                 throw e;
             }
@@ -150,11 +187,65 @@ namespace diffim {
 
         _isInitialized = true;
 
+        /* Keep M and B for the spatial fit */
+        KernelSolution::RetentionLevel level =
+            KernelSolution::getRetentionLevel(_policy.getString("kernelSolutionRetention"));
+        release(std::min(level, KernelSolution::NORMAL_EQUATIONS));
+    }
+
+    template <typename PixelT>
+    void KernelCandidate<PixelT>::setKernelSolution(
+        CandidateSwitch cand,
+        boost::shared_ptr<StaticKernelSolution<PixelT> > solution
+        ) {
+        if (cand == KernelCandidate::ORIG) {
+            _kernelSolutionOrig = solution;
+            _isInitialized = true;
+        }
+        else if (cand == KernelCandidate::PCA) {
+            _kernelSolutionPca = solution;
+        }
+        else {
+            throw LSST_EXCEPT(pexExcept::Exception, "Can only set ORIG or PCA kernel solutions");
+        }
+        ++_epoch;
+    }
+
+    template <typename PixelT>
+    void KernelCandidate<PixelT>::release(KernelSolution::RetentionLevel level) {
+        if (level == KernelSolution::FULL) {
+            return;
+        }
+        if (_kernelSolutionOrig) {
+            _kernelSolutionOrig->release(level);
+        }
+        if (_kernelSolutionPca) {
+            _kernelSolutionPca->release(level);
+        }
+        /* Rebuilt by each build() */
+        _varianceEstimate.reset();
+    }
+
+    template <typename PixelT>
+    std::size_t KernelCandidate<PixelT>::getBytesRetained() const {
+        std::size_t nBytes = 0;
+        if (_kernelSolutionOrig) {
+            nBytes += _kernelSolutionOrig->getBytesRetained();
+        }
+        if (_kernelSolutionPca) {
+            nBytes += _kernelSolutionPca->getBytesRetained();
+        }
+        if (_varianceEstimate) {
+            nBytes += _varianceEstimate->getWidth() * _varianceEstimate->getHeight() *
+                sizeof(afwImage::VariancePixel);
+        }
+        return nBytes;
     }
 
     template <typename PixelT>
     void KernelCandidate<PixelT>::_buildKernelSolution(lsst::afw::math::KernelList const& basisList,
-                                                       boost::shared_ptr<Eigen::MatrixXd> hMat)
+                                                       boost::shared_ptr<Eigen::MatrixXd> hMat,
+                                                       KernelBuildWorkspace::Ptr workspace)
     {
         bool checkConditionNumber = _policy.getBool("checkConditionNumber");
         double maxConditionNumber = _policy.getDouble("maxConditionNumber");
@@ -182,7 +273,8 @@ namespace diffim {
                     );
                 _kernelSolutionPca->build(*(_templateMaskedImage->getImage()),
                                           *(_scienceMaskedImage->getImage()),
-                                          *_varianceEstimate);
+                                          *_varianceEstimate,
+                                          workspace);
                 if (checkConditionNumber) {
                     if (_kernelSolutionPca->getConditionNumber(ctype) > maxConditionNumber) {
                         pexLog::TTrace<5>("lsst.ip.diffim.KernelCandidate",
@@ -200,7 +292,8 @@ namespace diffim {
                     );
                 _kernelSolutionOrig->build(*(_templateMaskedImage->getImage()),
                                            *(_scienceMaskedImage->getImage()),
-                                           *_varianceEstimate);
+                                           *_varianceEstimate,
+                                           workspace);
                 if (checkConditionNumber) {
                     if (_kernelSolutionOrig->getConditionNumber(ctype) > maxConditionNumber) {
                         pexLog::TTrace<5>("lsst.ip.diffim.KernelCandidate",
@@ -223,7 +316,8 @@ namespace diffim {
                     );
                 _kernelSolutionPca->build(*(_templateMaskedImage->getImage()),
                                           *(_scienceMaskedImage->getImage()),
-                                          *_varianceEstimate);
+                                          *_varianceEstimate,
+                                          workspace);
                 if (checkConditionNumber) {
                     if (_kernelSolutionPca->getConditionNumber(ctype) > maxConditionNumber) {
                         pexLog::TTrace<5>("lsst.ip.diffim.KernelCandidate",
@@ -241,7 +335,8 @@ namespace diffim {
                     );
                 _kernelSolutionOrig->build(*(_templateMaskedImage->getImage()),
                                            *(_scienceMaskedImage->getImage()),
-                                           *_varianceEstimate);
+                                           *_varianceEstimate,
+                                           workspace);
                 if (checkConditionNumber) {
                     if (_kernelSolutionOrig->getConditionNumber(ctype) > maxConditionNumber) {
                         pexLog::TTrace<5>("lsst.ip.diffim.KernelCandidate",
@@ -443,6 +538,52 @@ namespace diffim {
         return diffIm;
     }
 
+namespace {
+    template <typename PixelT>
+    class BytesRetainedVisitor : public afwMath::CandidateVisitor {
+    public:
+        BytesRetainedVisitor() : afwMath::CandidateVisitor(), _nBytes(0) {}
+        void processCandidate(afwMath::SpatialCellCandidate *candidate) {
+            KernelCandidate<PixelT> *kCandidate = dynamic_cast<KernelCandidate<PixelT> *>(candidate);
+            if (kCandidate != NULL) {
+                _nBytes += kCandidate->getBytesRetained();
+            }
+        }
+        std::size_t getNBytes() const {return _nBytes;}
+    private:
+        std::size_t _nBytes;
+    };
+
+    template <typename PixelT>
+    class ReleaseVisitor : public afwMath::CandidateVisitor {
+    public:
+        explicit ReleaseVisitor(KernelSolution::RetentionLevel level) :
+            afwMath::CandidateVisitor(), _level(level) {}
+        void processCandidate(afwMath::SpatialCellCandidate *candidate) {
+            KernelCandidate<PixelT> *kCandidate = dynamic_cast<KernelCandidate<PixelT> *>(candidate);
+            if (kCandidate != NULL) {
+                kCandidate->release(_level);
+            }
+        }
+    private:
+        KernelSolution::RetentionLevel _level;
+    };
+} // anonymous namespace
+
+    template <typename PixelT>
+    std::size_t getBytesRetained(afwMath::SpatialCellSet &kernelCellSet) {
+        BytesRetainedVisitor<PixelT> visitor;
+        kernelCellSet.visitAllCandidates(&visitor, true);
+        return visitor.getNBytes();
+    }
+
+    template <typename PixelT>
+    void releaseKernelSolutions(afwMath::SpatialCellSet &kernelCellSet,
+                                KernelSolution::RetentionLevel level) {
+        ReleaseVisitor<PixelT> visitor(level);
+        kernelCellSet.visitAllCandidates(&visitor, true);
+    }
+
 /***********************************************************************************************************/
 //
 // Explicit instantiations
@@ -450,5 +591,7 @@ namespace diffim {
     typedef float PixelT;
 
     template class KernelCandidate<PixelT>;
+    template std::size_t getBytesRetained<PixelT>(afwMath::SpatialCellSet &);
+    template void releaseKernelSolutions<PixelT>(afwMath::SpatialCellSet &, KernelSolution::RetentionLevel);
 
 }}} // end of namespace lsst::ip::diffim
@@ -9,6 +9,9 @@
  * @ingroup ip_diffim
  */
 
+#include <algorithm>
+#include <vector>
+
 #include "lsst/afw/geom.h"
 #include "lsst/afw/image.h"
 #include "lsst/afw/detection.h"
@@ -25,6 +28,15 @@ namespace afwDetect = lsst::afw::detection;
 namespace pexLog    = lsst::pex::logging; 
 namespace pexExcept = lsst::pex::exceptions; 
 
+namespace {
+    typedef std::pair<double, lsst::afw::detection::Footprint::Ptr> RankedFootprint;
+
+    /* Brightest footprints first */
+    bool compareRating(RankedFootprint const& a, RankedFootprint const& b) {
+        return a.first > b.first;
+    }
+}
+
 namespace lsst { 
 namespace ip { 
 namespace diffim {
@@ -81,16 +93,159 @@ namespace diffim {
         ) {
         
         // Parse the Policy
-        int fpNpixMin                = _policy.getInt("fpNpixMin");
         int fpGrowPix                = _policy.getInt("fpGrowPix");
+        double detThreshold          = _policy.getDouble("detThreshold");
+
+        /* reset private variables */
+        _footprints.clear();
+
+        // List of Footprints
+        boost::shared_ptr<std::vector<afwDetect::Footprint::Ptr> > footprintListInPtr = 
+            _detect(templateMaskedImage, scienceMaskedImage);
         
-        bool detOnTemplate           = _policy.getBool("detOnTemplate");
+        // Iterate over footprints, look for "good" ones
+        for (std::vector<afwDetect::Footprint::Ptr>::iterator i = footprintListInPtr->begin(); 
+             i != footprintListInPtr->end(); ++i) {
+            
+            pexLog::TTrace<6>("lsst.ip.diffim.KernelCandidateDetection.apply", 
+                              "Processing footprint %d", (*i)->getId());
+            growCandidate((*i), fpGrowPix, templateMaskedImage, scienceMaskedImage);
+        }
+        
+        if (_footprints.size() == 0) {
+            throw LSST_EXCEPT(pexExcept::Exception, 
+                              "Unable to find any footprints for Psf matching");
+        }
+        
+        pexLog::TTrace<1>("lsst.ip.diffim.KernelCandidateDetection.apply", 
+                          "Found %d clean footprints above threshold %.3f",
+                          _footprints.size(), detThreshold);
+        
+    }
+    
+    /** 
+     * @brief Runs Detection on a single image, and vets the resulting
+     * Footprints cell by cell until each cell of the kernel SpatialCellSet has
+     * enough clean candidates.
+     *
+     * @note The Footprints are assigned, by their bbox center, to cells of size sizeCellX x sizeCellY
+     * laid over the template bounding box, in the same way as
+     * lsst::afw::math::SpatialCellSet.  Within each cell they are vetted in
+     * order of descending peak value; once nStarPerCell plus the Policy
+     * reserve (nReservePerCell) candidates have been accepted in a cell, its
+     * remaining (fainter) Footprints are neither grown nor mask-checked.
+     *
+     * @note Since the kernel solution only ever visits nStarPerCell
+     * candidates per cell, the reserve is what is left to replace candidates
+     * rejected during fitting.
+     */
+    template <typename PixelT>
+    void KernelCandidateDetection<PixelT>::apply(
+        MaskedImagePtr const& templateMaskedImage,
+        MaskedImagePtr const& scienceMaskedImage,
+        int sizeCellX,
+        int sizeCellY,
+        int nStarPerCell
+        ) {
+
+        if ((sizeCellX <= 0) || (sizeCellY <= 0)) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Cell sizes must be positive");
+        }
+
+        // Parse the Policy
+        int fpGrowPix                = _policy.getInt("fpGrowPix");
         double detThreshold          = _policy.getDouble("detThreshold");
-        std::string detThresholdType = _policy.getString("detThresholdType");
+        int nReservePerCell          = _policy.getInt("nReservePerCell");
+        unsigned int nPerCell        = std::max(0, nStarPerCell) + std::max(0, nReservePerCell);
 
         /* reset private variables */
         _footprints.clear();
 
+        boost::shared_ptr<std::vector<afwDetect::Footprint::Ptr> > footprintListInPtr = 
+            _detect(templateMaskedImage, scienceMaskedImage);
+
+        /* Same cell layout as afwMath::SpatialCellSet */
+        afwGeom::Box2I region = templateMaskedImage->getBBox();
+        int nCellX = region.getWidth() / sizeCellX;
+        int nCellY = region.getHeight() / sizeCellY;
+        if (nCellX * sizeCellX != region.getWidth()) {
+            nCellX++;
+        }
+        if (nCellY * sizeCellY != region.getHeight()) {
+            nCellY++;
+        }
+
+        /* 
+         * Bin the footprints by the cell of their bbox center, where the
+         * candidates made from them are placed in the SpatialCellSet (growing
+         * the footprint does not move it), and rank them by their brightest
+         * peak.
+         */
+        std::vector<std::vector<RankedFootprint> > cells(nCellX * nCellY);
+        for (std::vector<afwDetect::Footprint::Ptr>::iterator i = footprintListInPtr->begin(); 
+             i != footprintListInPtr->end(); ++i) {
+            afwGeom::Box2I fpBBox = (*i)->getBBox();
+            double xc = 0.5 * (fpBBox.getMinX() + fpBBox.getMaxX());
+            double yc = 0.5 * (fpBBox.getMinY() + fpBBox.getMaxY());
+            double rating = (*i)->getNpix();
+
+            afwDetect::PeakCatalog const& peaks = (*i)->getPeaks();
+            if (peaks.size() > 0) {
+                rating = peaks[0].getPeakValue();
+                for (afwDetect::PeakCatalog::const_iterator pi = peaks.begin(); pi != peaks.end(); ++pi) {
+                    rating = std::max(rating, static_cast<double>(pi->getPeakValue()));
+                }
+            }
+
+            int ix = std::min(std::max(int(xc - region.getMinX()) / sizeCellX, 0), nCellX - 1);
+            int iy = std::min(std::max(int(yc - region.getMinY()) / sizeCellY, 0), nCellY - 1);
+            cells[iy * nCellX + ix].push_back(RankedFootprint(rating, *i));
+        }
+
+        /* Vet each cell, brightest first, until it is full */
+        int nVetted = 0;
+        for (std::vector<std::vector<RankedFootprint> >::iterator c = cells.begin(); c != cells.end(); ++c) {
+            std::stable_sort(c->begin(), c->end(), compareRating);
+
+            unsigned int nAccepted = 0;
+            for (std::vector<RankedFootprint>::iterator i = c->begin(); 
+                 (i != c->end()) && (nAccepted < nPerCell); ++i) {
+                pexLog::TTrace<6>("lsst.ip.diffim.KernelCandidateDetection.apply", 
+                                  "Processing footprint %d", i->second->getId());
+                ++nVetted;
+                if (growCandidate(i->second, fpGrowPix, templateMaskedImage, scienceMaskedImage)) {
+                    ++nAccepted;
+                }
+            }
+        }
+
+        if (_footprints.size() == 0) {
+            throw LSST_EXCEPT(pexExcept::Exception, 
+                              "Unable to find any footprints for Psf matching");
+        }
+
+        pexLog::TTrace<1>("lsst.ip.diffim.KernelCandidateDetection.apply", 
+                          "Found %d clean footprints above threshold %.3f (vetted %d of %d in %d cells)",
+                          _footprints.size(), detThreshold, nVetted, footprintListInPtr->size(), 
+                          nCellX * nCellY);
+    }
+
+    /** 
+     * @brief Runs Detection on either the template or science image, as
+     * dictated by the Policy
+     */
+    template <typename PixelT>
+    boost::shared_ptr<std::vector<afwDetect::Footprint::Ptr> > KernelCandidateDetection<PixelT>::_detect(
+        MaskedImagePtr const& templateMaskedImage,
+        MaskedImagePtr const& scienceMaskedImage
+        ) {
+        // Parse the Policy
+        int fpNpixMin                = _policy.getInt("fpNpixMin");
+        
+        bool detOnTemplate           = _policy.getBool("detOnTemplate");
+        double detThreshold          = _policy.getDouble("detThreshold");
+        std::string detThresholdType = _policy.getString("detThresholdType");
+
         // List of Footprints
         boost::shared_ptr<std::vector<afwDetect::Footprint::Ptr> > footprintListInPtr;
 
@@ -122,26 +277,8 @@ namespace diffim {
             pexLog::TTrace<4>("lsst.ip.diffim.KernelCandidateDetection.apply", 
                               "Found %d total footprints in science image above %.3f %s",
                               footprintListInPtr->size(), detThreshold, detThresholdType.c_str());
-        }    
-        
-        // Iterate over footprints, look for "good" ones
-        for (std::vector<afwDetect::Footprint::Ptr>::iterator i = footprintListInPtr->begin(); 
-             i != footprintListInPtr->end(); ++i) {
-            
-            pexLog::TTrace<6>("lsst.ip.diffim.KernelCandidateDetection.apply", 
-                              "Processing footprint %d", (*i)->getId());
-            growCandidate((*i), fpGrowPix, templateMaskedImage, scienceMaskedImage);
-        }
-        
-        if (_footprints.size() == 0) {
-            throw LSST_EXCEPT(pexExcept::Exception, 
-                              "Unable to find any footprints for Psf matching");
         }
-        
-        pexLog::TTrace<1>("lsst.ip.diffim.KernelCandidateDetection.apply", 
-                          "Found %d clean footprints above threshold %.3f",
-                          _footprints.size(), detThreshold);
-        
+        return footprintListInPtr;
     }
     
     template <typename PixelT>
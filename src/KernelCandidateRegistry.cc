@@ -0,0 +1,166 @@
+// -*- lsst-c++ -*-
+/**
+ * @file KernelCandidateRegistry.cc
+ *
+ * @brief Implementation of KernelCandidateRegistry
+ *
+ * @ingroup ip_diffim
+ */
+#include <limits>
+
+#include "lsst/afw/math.h"
+#include "lsst/pex/exceptions/Runtime.h"
+#include "lsst/pex/logging/Trace.h"
+
+#include "lsst/ip/diffim/KernelCandidate.h"
+#include "lsst/ip/diffim/KernelSolution.h"
+#include "lsst/ip/diffim/KernelCandidateRegistry.h"
+
+namespace afwMath        = lsst::afw::math;
+namespace pexLogging     = lsst::pex::logging;
+namespace pexExcept      = lsst::pex::exceptions;
+
+namespace lsst {
+namespace ip {
+namespace diffim {
+
+namespace {
+    /* Collects a cell's candidates in the cell's (rating) order */
+    template <typename PixelT>
+    class RegisterVisitor : public afwMath::CandidateVisitor {
+    public:
+        explicit RegisterVisitor(std::vector<KernelCandidate<PixelT> *> &candidates) :
+            afwMath::CandidateVisitor(), _candidates(candidates) {}
+        void processCandidate(afwMath::SpatialCellCandidate *candidate) {
+            KernelCandidate<PixelT> *kCandidate = dynamic_cast<KernelCandidate<PixelT> *>(candidate);
+            if (kCandidate == NULL) {
+                throw LSST_EXCEPT(pexExcept::LogicError,
+                                  "Failed to cast SpatialCellCandidate to KernelCandidate");
+            }
+            _candidates.push_back(kCandidate);
+        }
+    private:
+        std::vector<KernelCandidate<PixelT> *> &_candidates;
+    };
+} // anonymous namespace
+
+    template <typename PixelT>
+    KernelCandidateRegistry<PixelT>::KernelCandidateRegistry(
+        afwMath::SpatialCellSet &kernelCellSet
+        ) :
+        _candidates(),
+        _nCells(0),
+        _xCenter(),
+        _yCenter(),
+        _status(),
+        _chi2(),
+        _kSum(),
+        _background(),
+        _id(),
+        _cellIndex()
+    {
+        afwMath::SpatialCellSet::CellList &cellList = kernelCellSet.getCellList();
+        _nCells = cellList.size();
+        RegisterVisitor<PixelT> visitor(_candidates);
+        for (int cell = 0; cell < _nCells; ++cell) {
+            cellList[cell]->visitAllCandidates(&visitor, false);
+            _cellIndex.resize(_candidates.size(), cell);
+        }
+
+        int const nCandidates = _candidates.size();
+        _xCenter.resize(nCandidates);
+        _yCenter.resize(nCandidates);
+        _status.resize(nCandidates);
+        _chi2.resize(nCandidates);
+        _kSum.resize(nCandidates);
+        _background.resize(nCandidates);
+        _id.resize(nCandidates);
+        for (int i = 0; i < nCandidates; ++i) {
+            _xCenter[i] = _candidates[i]->getXCenter();
+            _yCenter[i] = _candidates[i]->getYCenter();
+            _id[i] = _candidates[i]->getId();
+        }
+        sync();
+        pexLogging::TTrace<5>("lsst.ip.diffim.KernelCandidateRegistry",
+                              "Registered %d candidates in %d cells", nCandidates, _nCells);
+    }
+
+    template <typename PixelT>
+    void KernelCandidateRegistry<PixelT>::_sync(int index) {
+        KernelCandidate<PixelT> const* kCandidate = _candidates[index];
+        _status[index] = kCandidate->getStatus();
+        _chi2[index] = kCandidate->getChi2();
+        _kSum[index] = std::numeric_limits<double>::quiet_NaN();
+        _background[index] = std::numeric_limits<double>::quiet_NaN();
+        if (kCandidate->isInitialized()) {
+            boost::shared_ptr<StaticKernelSolution<PixelT> > solution =
+                kCandidate->getKernelSolution(KernelCandidate<PixelT>::ORIG);
+            if (solution->getSolvedBy() != KernelSolution::NONE) {
+                _kSum[index] = solution->getKsum();
+                _background[index] = solution->getBackground();
+            }
+        }
+    }
+
+    template <typename PixelT>
+    void KernelCandidateRegistry<PixelT>::sync() {
+        for (int i = 0, n = _candidates.size(); i < n; ++i) {
+            _sync(i);
+        }
+    }
+
+    /*
+     * SpatialCell::visitCandidates visits, in each cell, the first
+     * nMaxPerCell candidates that are not BAD; a status only changes
+     * through the candidate, so the status of each candidate is read as
+     * the cell is walked.
+     */
+    template <typename PixelT>
+    std::vector<int> KernelCandidateRegistry<PixelT>::sync(int nMaxPerCell) {
+        std::vector<int> active;
+        int const nCandidates = _candidates.size();
+        int i = 0;
+        for (int cell = 0; cell < _nCells; ++cell) {
+            int nInCell = 0;
+            for (; (i < nCandidates) && (_cellIndex[i] == cell); ++i) {
+                if ((nMaxPerCell > 0) && (nInCell >= nMaxPerCell)) {
+                    continue;
+                }
+                _status[i] = _candidates[i]->getStatus();
+                if (_status[i] == afwMath::SpatialCellCandidate::BAD) {
+                    continue;
+                }
+                _sync(i);
+                active.push_back(i);
+                ++nInCell;
+            }
+        }
+        return active;
+    }
+
+    template <typename PixelT>
+    int KernelCandidateRegistry<PixelT>::countStatus(afwMath::SpatialCellCandidate::Status status) const {
+        int count = 0;
+        for (std::vector<int>::const_iterator s = _status.begin(); s != _status.end(); ++s) {
+            count += (*s == status);
+        }
+        return count;
+    }
+
+    template <typename PixelT>
+    void KernelCandidateRegistry<PixelT>::setStatus(
+        int index,
+        afwMath::SpatialCellCandidate::Status status
+        ) {
+        if ((index < 0) || (index >= static_cast<int>(_candidates.size()))) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Candidate index out of range");
+        }
+        _candidates[index]->setStatus(status);
+        _status[index] = status;
+    }
+
+    typedef float PixelT;
+
+    template class KernelCandidateRegistry<PixelT>;
+
+}}} // end of namespace lsst::ip::diffim
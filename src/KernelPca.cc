@@ -9,6 +9,12 @@
  * @ingroup ip_diffim
  */
 
+#include <algorithm>
+
+#include "Eigen/Core"
+#include "Eigen/Eigenvalues"
+
+#include "lsst/afw/geom.h"
 #include "lsst/afw/math.h"
 #include "lsst/afw/image.h"
 #include "lsst/pex/exceptions/Runtime.h"
@@ -17,6 +23,7 @@
 #include "lsst/ip/diffim/KernelCandidate.h"
 #include "lsst/ip/diffim/KernelPca.h"
 
+namespace afwGeom        = lsst::afw::geom;
 namespace afwMath        = lsst::afw::math;
 namespace afwImage       = lsst::afw::image;
 namespace pexLogging     = lsst::pex::logging; 
@@ -156,33 +163,96 @@ namespace detail {
      * @note Templated on the Image types it is running on (typically
      * [exclusively?] afwMath::Kernel::Pixel, which is double)
      *
-     * @note This override normalizes the resulting eigenImages to have peak
-     * value of 1.0.
+     * @note This override computes only the leading eigenimages from the
+     * Gram matrix of the input images, and normalizes them to have peak value
+     * of 1.0.
      *
      */
+    template <typename ImageT>
+    KernelPca<ImageT>::KernelPca(bool constantWeight, int nComponents) :
+        Super(constantWeight), 
+        _nComponents(nComponents),
+        _eigenValues(),
+        _eigenImages()
+    {
+        /* 
+         * analyze() gives every image the same weight and does not use the
+         * fluxes passed to addImage(), so flux weighting is not available.
+         */
+        if (!constantWeight) {
+            throw LSST_EXCEPT(pexExcept::InvalidParameterError, 
+                              "KernelPca only supports constant weights");
+        }
+    }
+
     template <typename ImageT>
     void KernelPca<ImageT>::analyze()
     {
-        Super::analyze();
-        
-        typename Super::ImageList const &eImageList = this->getEigenImages();
-        typename Super::ImageList::const_iterator iter = eImageList.begin(), end = eImageList.end();
-        for (size_t i = 0; iter != end; ++i, ++iter) {
-            PTR(ImageT) eImage = *iter;
-            
+        ImageList const &imageList = this->getImageList();
+        int const nImages = imageList.size();
+        if (nImages == 0) {
+            throw LSST_EXCEPT(pexExcept::LengthError, "No images provided for PCA analysis");
+        }
+
+        int const width  = imageList[0]->getWidth();
+        int const height = imageList[0]->getHeight();
+        int const nPix   = width * height;
+
+        /* Data matrix with one image per column */
+        Eigen::MatrixXd dMat(nPix, nImages);
+        for (int i = 0; i < nImages; ++i) {
+            if ((imageList[i]->getWidth() != width) || (imageList[i]->getHeight() != height)) {
+                throw LSST_EXCEPT(pexExcept::LengthError, "Images for PCA analysis differ in size");
+            }
+            for (int y = 0, n = 0; y < height; ++y) {
+                for (typename ImageT::x_iterator ptr = imageList[i]->row_begin(y), 
+                         end = imageList[i]->row_end(y); ptr != end; ++ptr, ++n) {
+                    dMat(n, i) = *ptr;
+                }
+            }
+        }
+
+        /* Snapshot method : the eigenvectors of D D^T with non-zero
+         * eigenvalue are D v, for v the eigenvectors of the n x n D^T D */
+        Eigen::MatrixXd gMat = dMat.transpose() * dMat / nImages;
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eVecValues(gMat);
+        Eigen::VectorXd const& eValues = eVecValues.eigenvalues();   /* increasing order */
+        Eigen::MatrixXd const& eVectors = eVecValues.eigenvectors();
+
+        _eigenValues.clear();
+        for (int i = nImages - 1; i >= 0; --i) {
+            _eigenValues.push_back(eValues(i));
+        }
+
+        int const nComponents = (_nComponents < 0) ? nImages : std::min(_nComponents, nImages);
+        _eigenImages.clear();
+        for (int k = 0; k < nComponents; ++k) {
+            Eigen::VectorXd eImageVec = dMat * eVectors.col(nImages - 1 - k);
+
             /*
              * Normalise eigenImages to have a maximum of 1.0.  For n > 0 they
              * (should) have mean == 0, so we can't use that to normalize
              */
-            afwMath::Statistics stats = afwMath::makeStatistics(*eImage, (afwMath::MIN | afwMath::MAX));
-            double const min = stats.getValue(afwMath::MIN);
-            double const max = stats.getValue(afwMath::MAX);
-            
+            double const min = eImageVec.minCoeff();
+            double const max = eImageVec.maxCoeff();
             double const extreme = (fabs(min) > max) ? min :max;
             if (extreme != 0.0) {
-                *eImage /= extreme;
+                eImageVec /= extreme;
             }
+
+            PTR(ImageT) eImage(new ImageT(afwGeom::Extent2I(width, height)));
+            for (int y = 0, n = 0; y < height; ++y) {
+                for (typename ImageT::x_iterator ptr = eImage->row_begin(y), end = eImage->row_end(y); 
+                     ptr != end; ++ptr, ++n) {
+                    *ptr = eImageVec(n);
+                }
+            }
+            _eigenImages.push_back(eImage);
         }
+
+        pexLogging::TTrace<5>("lsst.ip.diffim.KernelPca.analyze", 
+                              "Computed %d of %d eigenimages from %d images of %d pixels",
+                              nComponents, nImages, nImages, nPix);
     }
 
 
@@ -14,7 +14,6 @@
 #include <limits>
 
 #include "boost/shared_ptr.hpp"
-#include "boost/timer.hpp" 
 
 #include "Eigen/Core"
 #include "Eigen/Cholesky"
@@ -27,15 +26,14 @@
 #include "lsst/afw/geom.h"
 #include "lsst/afw/image.h"
 #include "lsst/afw/detection.h"
-#include "lsst/afw/detection/FootprintArray.cc"
 #include "lsst/pex/exceptions/Runtime.h"
 #include "lsst/pex/logging/Trace.h"
 
 #include "lsst/ip/diffim/ImageSubtract.h"
+#include "lsst/ip/diffim/Instrumentation.h"
 #include "lsst/ip/diffim/KernelSolution.h"
 
 #include "ndarray.h"
-#include "ndarray/eigen.h"
 
 #define DEBUG_MATRIX  0
 #define DEBUG_MATRIX2 0
@@ -51,6 +49,93 @@ namespace lsst {
 namespace ip { 
 namespace diffim {
     
+namespace {
+    /*
+     * M = C^T diag(w) C.  M is symmetric, so only its upper triangle is
+     * accumulated (a symmetric rank-k update of the weighted C, half the
+     * flops of the general product) and then mirrored, since M is also
+     * consumed by non-symmetric solvers and through getM().
+     */
+    void computeNormalMatrix(Eigen::MatrixXd const& cMat, Eigen::VectorXd const& wVec,
+                             Eigen::MatrixXd &wcMat, Eigen::MatrixXd &mMat) {
+        wcMat.noalias() = wVec.cwiseSqrt().asDiagonal() * cMat;
+        mMat.setZero(cMat.cols(), cMat.cols());
+        mMat.selfadjointView<Eigen::Upper>().rankUpdate(wcMat.transpose());
+        mMat.triangularView<Eigen::StrictlyLower>() = mMat.transpose();
+    }
+
+    /* Leading flop count of the weighting of C and the upper triangle of M */
+    double normalMatrixFlops(Eigen::MatrixXd const& cMat) {
+        double const n = cMat.rows();
+        double const k = cMat.cols();
+        return n * k * (k + 2.);
+    }
+
+    /* Leading flop count of convolving an image of dims with each kernel of a basis */
+    double convolutionFlops(afwMath::KernelList const& basisList, afwGeom::Extent2I const& dims) {
+        if (basisList.empty()) {
+            return 0.;
+        }
+        return 2. * basisList.size() * dims.getX() * dims.getY() * 
+            basisList[0]->getWidth() * basisList[0]->getHeight();
+    }
+
+    Eigen::MatrixXd computeNormalMatrix(Eigen::MatrixXd const& cMat, Eigen::VectorXd const& wVec) {
+        Instrumentation::Timer timer(Instrumentation::NORMAL_EQUATIONS);
+        timer.addBytes((cMat.size() + cMat.cols() * cMat.cols()) * sizeof(double));
+        timer.addFlops(normalMatrixFlops(cMat));
+
+        Eigen::MatrixXd wcMat(cMat.rows(), cMat.cols());
+        Eigen::MatrixXd mMat(cMat.cols(), cMat.cols());
+        computeNormalMatrix(cMat, wVec, wcMat, mMat);
+        return mMat;
+    }
+
+    /*
+     * M and B of C^T diag(w) C x = C^T diag(w) I, into buffers from the
+     * workspace; the weighted C and I are workspace scratch.
+     */
+    void computeNormalEquations(Eigen::MatrixXd const& cMat, Eigen::VectorXd const& wVec, 
+                                Eigen::VectorXd const& iVec, KernelBuildWorkspace &workspace,
+                                boost::shared_ptr<Eigen::MatrixXd> &mMat, 
+                                boost::shared_ptr<Eigen::VectorXd> &bVec) {
+        Instrumentation::Timer timer(Instrumentation::NORMAL_EQUATIONS);
+        timer.addBytes((cMat.size() + cMat.cols() * cMat.cols() + cMat.cols() + iVec.size()) * sizeof(double));
+        timer.addFlops(normalMatrixFlops(cMat) + 2. * cMat.size() + iVec.size());
+
+        mMat = workspace.getMatrix(cMat.cols(), cMat.cols());
+        bVec = workspace.getVector(cMat.cols());
+        {
+            boost::shared_ptr<Eigen::MatrixXd> wcMat = workspace.getMatrix(cMat.rows(), cMat.cols());
+            computeNormalMatrix(cMat, wVec, *wcMat, *mMat);
+        }
+        boost::shared_ptr<Eigen::VectorXd> wiVec = workspace.getVector(iVec.size());
+        *wiVec = wVec.cwiseProduct(iVec);
+        bVec->noalias() = cMat.transpose() * *wiVec;
+    }
+
+    /* Row-major, so that a (y, x) block of an image flattens in the order of its pixels */
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixXd;
+
+    /*
+     * Copy the pixels of view whose mask value is 0 into dest, in row-major
+     * order; view and mask are Eigen views (or blocks of views) of the same
+     * shape.  Returns the number of pixels copied.
+     */
+    template <typename ViewT, typename MaskT>
+    int gatherUnmasked(ViewT const& view, MaskT const& mask, double *dest) {
+        int nUsed = 0;
+        for (int row = 0; row < view.rows(); ++row) {
+            for (int col = 0; col < view.cols(); ++col) {
+                if (mask(row, col) == 0) {
+                    dest[nUsed++] = view(row, col);
+                }
+            }
+        }
+        return nUsed;
+    }
+} // anonymous namespace
+
     /* Unique identifier for solution */
     int KernelSolution::_SolutionId = 0;
 
@@ -140,8 +225,8 @@ namespace diffim {
 
         Eigen::VectorXd aVec = Eigen::VectorXd::Zero(bVec.size());
 
-        boost::timer t;
-        t.restart();
+        Instrumentation::Timer timer(Instrumentation::SOLVE);
+        timer.addFlops(2. * mMat.rows() * mMat.rows() * mMat.rows() / 3.);
 
         pexLog::TTrace<4>("lsst.ip.difim.KernelSolution.solve", 
                           "Solving for kernel");
@@ -177,9 +262,9 @@ namespace diffim {
 			}
 		}
 
-        double time = t.elapsed();
+        timer.stop();
         pexLog::TTrace<5>("lsst.ip.diffim.KernelSolution.solve", 
-                          "Compute time for matrix math : %.2f s", time);
+                          "Solved %d x %d matrix", mMat.rows(), mMat.cols());
 
         if (DEBUG_MATRIX) {
 		  std::cout << "A " << std::endl;
@@ -189,6 +274,138 @@ namespace diffim {
         _aVec = boost::shared_ptr<Eigen::VectorXd>(new Eigen::VectorXd(aVec));
     }
 
+    void KernelSolution::release(RetentionLevel level) {
+        if (level >= COEFFICIENTS) {
+            _mMat.reset();
+            _bVec.reset();
+        }
+    }
+
+    void KernelSolution::restore(
+        boost::shared_ptr<Eigen::MatrixXd> mMat,
+        boost::shared_ptr<Eigen::VectorXd> bVec,
+        boost::shared_ptr<Eigen::VectorXd> aVec,
+        KernelSolvedBy solvedBy
+        ) {
+        if (!aVec || (solvedBy == NONE)) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Cannot restore an unsolved kernel solution");
+        }
+        _mMat     = mMat;
+        _bVec     = bVec;
+        _aVec     = aVec;
+        _solvedBy = solvedBy;
+    }
+
+    std::size_t KernelSolution::getBytesRetained() const {
+        std::size_t nBytes = 0;
+        if (_mMat) nBytes += _mMat->size() * sizeof(double);
+        if (_bVec) nBytes += _bVec->size() * sizeof(double);
+        if (_aVec) nBytes += _aVec->size() * sizeof(double);
+        return nBytes;
+    }
+
+    KernelSolution::RetentionLevel KernelSolution::getRetentionLevel(std::string const& level) {
+        if (level == "full") {
+            return FULL;
+        }
+        else if (level == "normal-equations") {
+            return NORMAL_EQUATIONS;
+        }
+        else if (level == "coefficients") {
+            return COEFFICIENTS;
+        }
+        throw LSST_EXCEPT(pexExcept::InvalidParameterError,
+                          str(boost::format("Invalid kernel solution retention level (%s)") % level));
+    }
+
+    /*******************************************************************************************************/
+
+    KernelBuildWorkspace::KernelBuildWorkspace(std::size_t maxIdleBytes) :
+        _maxIdleBytes(maxIdleBytes),
+        _cimage(),
+        _matrices(),
+        _vectors(),
+        _nAllocations(0),
+        _nReused(0)
+    {};
+
+    KernelBuildWorkspace::ImageT KernelBuildWorkspace::getConvolvedImage(
+        lsst::afw::geom::Extent2I const& dimensions
+        ) {
+        if (!_cimage || 
+            (_cimage->getWidth() < dimensions.getX()) || (_cimage->getHeight() < dimensions.getY())) {
+            int const width  = _cimage ? std::max(_cimage->getWidth(), dimensions.getX()) : dimensions.getX();
+            int const height = _cimage ? std::max(_cimage->getHeight(), dimensions.getY()) : dimensions.getY();
+            _cimage.reset(new ImageT(afwGeom::Extent2I(width, height)));
+            ++_nAllocations;
+        }
+        else {
+            ++_nReused;
+        }
+        return ImageT(*_cimage, afwGeom::Box2I(afwGeom::Point2I(0, 0), dimensions), afwImage::LOCAL);
+    }
+
+    boost::shared_ptr<Eigen::MatrixXd> KernelBuildWorkspace::getMatrix(int rows, int cols) {
+        return _acquire(_matrices, rows, cols);
+    }
+
+    boost::shared_ptr<Eigen::VectorXd> KernelBuildWorkspace::getVector(int size) {
+        return _acquire(_vectors, size, 1);
+    }
+
+    std::size_t KernelBuildWorkspace::getBytesIdle() const {
+        std::size_t nBytes = 0;
+        for (std::list<boost::shared_ptr<Eigen::MatrixXd> >::const_iterator iter = _matrices.begin();
+             iter != _matrices.end(); ++iter) {
+            if (iter->unique()) nBytes += (*iter)->size() * sizeof(double);
+        }
+        for (std::list<boost::shared_ptr<Eigen::VectorXd> >::const_iterator iter = _vectors.begin();
+             iter != _vectors.end(); ++iter) {
+            if (iter->unique()) nBytes += (*iter)->size() * sizeof(double);
+        }
+        return nBytes;
+    }
+
+    template <typename T>
+    boost::shared_ptr<T> KernelBuildWorkspace::_acquire(std::list<boost::shared_ptr<T> > &pool, 
+                                                        int rows, int cols) {
+        for (typename std::list<boost::shared_ptr<T> >::iterator iter = pool.begin();
+             iter != pool.end(); ++iter) {
+            if (iter->unique() && ((*iter)->rows() == rows) && ((*iter)->cols() == cols)) {
+                /* Most recently used first; splice does not allocate */
+                pool.splice(pool.begin(), pool, iter);
+                ++_nReused;
+                return pool.front();
+            }
+        }
+
+        _trim();
+        pool.push_front(boost::shared_ptr<T>(new T(rows, cols)));
+        ++_nAllocations;
+        return pool.front();
+    }
+
+    void KernelBuildWorkspace::_trim() {
+        std::size_t nBytesIdle = getBytesIdle();
+        nBytesIdle = _trimPool(_matrices, nBytesIdle);
+        _trimPool(_vectors, nBytesIdle);
+    }
+
+    template <typename T>
+    std::size_t KernelBuildWorkspace::_trimPool(std::list<boost::shared_ptr<T> > &pool, 
+                                                std::size_t nBytesIdle) {
+        /* Least recently used at the back */
+        typename std::list<boost::shared_ptr<T> >::iterator iter = pool.end();
+        while ((nBytesIdle > _maxIdleBytes) && (iter != pool.begin())) {
+            --iter;
+            if (iter->unique()) {
+                nBytesIdle -= (*iter)->size() * sizeof(double);
+                iter = pool.erase(iter);
+            }
+        }
+        return nBytesIdle;
+    }
+
     /*******************************************************************************************************/
 
     template <typename InputT>
@@ -203,7 +420,8 @@ namespace diffim {
         _ivVec(),
         _kernel(),
         _background(0.0),
-        _kSum(0.0)
+        _kSum(0.0),
+        _pixelBasis(PixelBasis::fromKernelList(basisList))
     {
         std::vector<double> kValues(basisList.size());
         _kernel = boost::shared_ptr<afwMath::Kernel>( 
@@ -227,7 +445,11 @@ namespace diffim {
         afwImage::Image<afwMath::Kernel::Pixel>::Ptr image(
             new afwImage::Image<afwMath::Kernel::Pixel>(_kernel->getDimensions())
             );
-        (void)_kernel->computeImage(*image, false);              
+        if (_pixelBasis) {
+            (void)_pixelBasis->computeImage(*image, *_aVec);
+        } else {
+            (void)_kernel->computeImage(*image, false);              
+        }
         return image;
     }
 
@@ -261,7 +483,8 @@ namespace diffim {
     void StaticKernelSolution<InputT>::build(
         lsst::afw::image::Image<InputT> const &templateImage,
         lsst::afw::image::Image<InputT> const &scienceImage,
-        lsst::afw::image::Image<lsst::afw::image::VariancePixel> const &varianceEstimate
+        lsst::afw::image::Image<lsst::afw::image::VariancePixel> const &varianceEstimate,
+        KernelBuildWorkspace::Ptr workspace
         ) {
 
         afwMath::Statistics varStats = afwMath::makeStatistics(varianceEstimate, afwMath::MIN);
@@ -311,9 +534,8 @@ namespace diffim {
          * index you address is 97.
          */
 
-        /* NOTE - we are accessing particular elements of Eigen arrays using
-           these coordinates, therefore they need to be in LOCAL coordinates.
-           This was written before ndarray unification.
+        /* NOTE - the images are addressed through Eigen views of their
+           arrays, so these coordinates need to be in LOCAL coordinates.
         */
         afwGeom::Box2I goodBBox = (*kiter)->shrinkBBox(templateImage.getBBox(afwImage::LOCAL));
         unsigned int const startCol = goodBBox.getMinX();
@@ -322,83 +544,118 @@ namespace diffim {
         unsigned int endCol = goodBBox.getMaxX() + 1;
         unsigned int endRow = goodBBox.getMaxY() + 1;
 
-        boost::timer t;
-        t.restart();
-        
-        /* Eigen representation of input images; only the pixels that are unconvolved in cimage below */
-        Eigen::MatrixXd eigenTemplate = imageToEigenMatrix(templateImage).block(startRow, 
-                                                                                startCol, 
-                                                                                endRow-startRow, 
-                                                                                endCol-startCol);
-        Eigen::MatrixXd eigenScience = imageToEigenMatrix(scienceImage).block(startRow, 
-                                                                              startCol, 
-                                                                              endRow-startRow, 
-                                                                              endCol-startCol);
-        Eigen::MatrixXd eigeniVariance = imageToEigenMatrix(varianceEstimate).block(
-	    startRow, startCol, endRow-startRow, endCol-startCol
-	).array().inverse().matrix();
-
-        /* Resize into 1-D for later usage */
-        eigenTemplate.resize(eigenTemplate.rows()*eigenTemplate.cols(), 1);
-        eigenScience.resize(eigenScience.rows()*eigenScience.cols(), 1);
-        eigeniVariance.resize(eigeniVariance.rows()*eigeniVariance.cols(), 1);
-        
-        /* Holds image convolved with basis function */
-        afwImage::Image<PixelT> cimage(templateImage.getDimensions());
+        int const nRows = endRow - startRow;
+        int const nCols = endCol - startCol;
+        int const nPix  = nRows * nCols;
+
+        Instrumentation::Timer timer(Instrumentation::BASIS_CONVOLUTION);
         
-        /* Holds eigen representation of image convolved with all basis functions */
-        std::vector<boost::shared_ptr<Eigen::MatrixXd> > convolvedEigenList(nKernelParameters);
+        /* The good pixels are read in place from the images and flattened, in
+         * row-major (y, x) order, directly into the vectors and columns of C;
+         * the only copy is the conversion to double. */
+        if (!workspace) {
+            workspace.reset(new KernelBuildWorkspace());
+        }
+        boost::shared_ptr<Eigen::VectorXd> iVec = workspace->getVector(nPix);
+        Eigen::Map<RowMatrixXd>(iVec->data(), nRows, nCols) = 
+            imageToEigenMap(scienceImage).block(startRow, startCol, nRows, nCols).template cast<double>();
+        boost::shared_ptr<Eigen::VectorXd> ivVec = workspace->getVector(nPix);
+        Eigen::Map<RowMatrixXd>(ivVec->data(), nRows, nCols) = 
+            imageToEigenMap(varianceEstimate).block(startRow, startCol, nRows, nCols).template cast<double>()
+            .cwiseInverse();
         
-        /* Iterators over convolved image list and basis list */
-        typename std::vector<boost::shared_ptr<Eigen::MatrixXd> >::iterator eiter = 
-            convolvedEigenList.begin();
-        /* Create C_i in the formalism of Alard & Lupton */
-        for (kiter = basisList.begin(); kiter != basisList.end(); ++kiter, ++eiter) {
-            afwMath::convolve(cimage, templateImage, **kiter, false); /* cimage stores convolved image */
-
-            boost::shared_ptr<Eigen::MatrixXd> cMat (
-                new Eigen::MatrixXd(imageToEigenMatrix(cimage).block(startRow, 
-                                                                     startCol, 
-                                                                     endRow-startRow, 
-                                                                     endCol-startCol))
-                );
-            cMat->resize(cMat->rows()*cMat->cols(), 1);
-            *eiter = cMat;
-
-        } 
+        boost::shared_ptr<Eigen::MatrixXd> cMat = workspace->getMatrix(nPix, nParameters);
+        if (_pixelBasis) {
+            /* Convolution with a delta function is a shift of the template by
+             * (pixel - ctr); C_i is the correspondingly offset block of the
+             * template. */
+            typename EigenImageMap<InputT>::Type templateView = imageToEigenMap(templateImage);
+            afwGeom::Point2I ctr = _pixelBasis->getCtr();
+            for (int kidxj = 0; kidxj < _pixelBasis->getNBases(); kidxj++) {
+                afwGeom::Point2I pixel = _pixelBasis->getPixel(kidxj);
+                int const row0  = static_cast<int>(startRow) + (pixel.getY() - ctr.getY());
+                int const col0  = static_cast<int>(startCol) + (pixel.getX() - ctr.getX());
+                if ((row0 < 0) || (col0 < 0) || 
+                    (row0 + nRows > templateView.rows()) || (col0 + nCols > templateView.cols())) {
+                    throw LSST_EXCEPT(pexExcept::Exception, "Delta function basis shifted off image");
+                }
+                Eigen::Map<RowMatrixXd>(cMat->col(kidxj).data(), nRows, nCols) = 
+                    templateView.block(row0, col0, nRows, nCols).template cast<double>();
+            }
+        }
+        else {
+            /* Holds image convolved with basis function */
+            afwImage::Image<PixelT> cimage = workspace->getConvolvedImage(templateImage.getDimensions());
+            
+            /* Create C_i in the formalism of Alard & Lupton */
+            unsigned int kidxj = 0;
+            for (kiter = basisList.begin(); kiter != basisList.end(); ++kiter, ++kidxj) {
+                afwMath::convolve(cimage, templateImage, **kiter, false); /* cimage stores convolved image */
+                
+                Eigen::Map<RowMatrixXd>(cMat->col(kidxj).data(), nRows, nCols) = 
+                    imageToEigenMap(cimage).block(startRow, startCol, nRows, nCols).template cast<double>();
+            } 
+        }
 
-        double time = t.elapsed();
+        timer.addBytes((static_cast<double>(nPix) * nParameters + 2. * nPix) * sizeof(double));
+        if (!_pixelBasis) {
+            timer.addFlops(convolutionFlops(basisList, templateImage.getDimensions()));
+        }
+        timer.stop();
         pexLog::TTrace<5>("lsst.ip.diffim.StaticKernelSolution.build", 
-                          "Total compute time to do basis convolutions : %.2f s", time);
-        t.restart();
+                          "Built C from %d basis convolutions", static_cast<int>(basisList.size()));
         
-        /* 
-           Load matrix with all values from convolvedEigenList : all images
-           (eigeniVariance, convolvedEigenList) must be the same size
-        */
-        Eigen::MatrixXd cMat(eigenTemplate.col(0).size(), nParameters);
-        typename std::vector<boost::shared_ptr<Eigen::MatrixXd> >::iterator eiterj = 
-            convolvedEigenList.begin();
-        typename std::vector<boost::shared_ptr<Eigen::MatrixXd> >::iterator eiterE = 
-            convolvedEigenList.end();
-        for (unsigned int kidxj = 0; eiterj != eiterE; eiterj++, kidxj++) {
-            cMat.col(kidxj) = (*eiterj)->col(0);
-        }
         /* Treat the last "image" as all 1's to do the background calculation. */
         if (_fitForBackground)
-            cMat.col(nParameters-1).fill(1.);
+            cMat->col(nParameters-1).fill(1.);
 
-        _cMat.reset(new Eigen::MatrixXd(cMat));
-        _ivVec.reset(new Eigen::VectorXd(eigeniVariance.col(0)));
-        _iVec.reset(new Eigen::VectorXd(eigenScience.col(0)));
+        _cMat  = cMat;
+        _ivVec = ivVec;
+        _iVec  = iVec;
 
         /* Make these outside of solve() so I can check condition number */
-        _mMat.reset(new Eigen::MatrixXd((*_cMat).transpose() * ((*_ivVec).asDiagonal() * (*_cMat))));
-        _bVec.reset(new Eigen::VectorXd((*_cMat).transpose() * ((*_ivVec).asDiagonal() * (*_iVec))));
+        computeNormalEquations(*_cMat, *_ivVec, *_iVec, *workspace, _mMat, _bVec);
+    }
+
+    template <typename InputT>
+    void StaticKernelSolution<InputT>::release(RetentionLevel level) {
+        KernelSolution::release(level);
+        if (level >= NORMAL_EQUATIONS) {
+            _cMat.reset();
+            _iVec.reset();
+            _ivVec.reset();
+        }
+    }
+
+    template <typename InputT>
+    void StaticKernelSolution<InputT>::restore(
+        boost::shared_ptr<Eigen::MatrixXd> mMat,
+        boost::shared_ptr<Eigen::VectorXd> bVec,
+        boost::shared_ptr<Eigen::VectorXd> aVec,
+        KernelSolvedBy solvedBy
+        ) {
+        KernelSolution::restore(mMat, bVec, aVec, solvedBy);
+        /* Not part of a restored solution */
+        _cMat.reset();
+        _iVec.reset();
+        _ivVec.reset();
+        _setKernel();
+    }
+
+    template <typename InputT>
+    std::size_t StaticKernelSolution<InputT>::getBytesRetained() const {
+        std::size_t nBytes = KernelSolution::getBytesRetained();
+        if (_cMat) nBytes += _cMat->size() * sizeof(double);
+        if (_iVec) nBytes += _iVec->size() * sizeof(double);
+        if (_ivVec) nBytes += _ivVec->size() * sizeof(double);
+        return nBytes;
     }
 
     template <typename InputT>
     void StaticKernelSolution<InputT>::solve() {
+        if (!_cMat) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Kernel matrices released; cannot solve");
+        }
         pexLog::TTrace<5>("lsst.ip.diffim.StaticKernelSolution.solve", 
                           "mMat is %d x %d; bVec is %d; cMat is %d x %d; vVec is %d; iVec is %d", 
                           (*_mMat).rows(), (*_mMat).cols(), (*_bVec).size(),
@@ -453,10 +710,16 @@ namespace diffim {
         }
         _kernel->setKernelParameters(kValues);
 
-        ImageT::Ptr image (
-            new ImageT(_kernel->getDimensions())
-            );
-        _kSum  = _kernel->computeImage(*image, false);              
+        if (_pixelBasis) {
+            /* Each delta function has unit sum */
+            _kSum = (*_aVec).head(nKernelParameters).sum();
+        }
+        else {
+            ImageT::Ptr image (
+                new ImageT(_kernel->getDimensions())
+                );
+            _kSum  = _kernel->computeImage(*image, false);              
+        }
         
         if (_fitForBackground) {
             if (std::isnan((*_aVec)(nParameters-1))) {
@@ -512,7 +775,8 @@ namespace diffim {
         lsst::afw::image::Image<InputT> const &templateImage,
         lsst::afw::image::Image<InputT> const &scienceImage,
         lsst::afw::image::Image<lsst::afw::image::VariancePixel> const &varianceEstimate,
-        lsst::afw::image::Mask<lsst::afw::image::MaskPixel> const &pixelMask
+        lsst::afw::image::Mask<lsst::afw::image::MaskPixel> const &pixelMask,
+        KernelBuildWorkspace::Ptr workspace
         ) {
 
         afwMath::Statistics varStats = afwMath::makeStatistics(varianceEstimate, afwMath::MIN);
@@ -525,9 +789,6 @@ namespace diffim {
                               "Error: variance equals 0.0, cannot inverse variance weight");
         }
 
-        /* Full footprint of all input images */
-        afwDet::Footprint::Ptr fullFp(new afwDet::Footprint(templateImage.getBBox()));
-
         afwMath::KernelList basisList = 
             boost::dynamic_pointer_cast<afwMath::LinearCombinationKernel>(this->_kernel)->getKernelList();
         std::vector<boost::shared_ptr<afwMath::Kernel> >::const_iterator kiter = basisList.begin();
@@ -568,124 +829,53 @@ namespace diffim {
         finalMask.writeFits("finalmask.fits");
 
 
-        ndarray::Array<int, 1, 1> maskArray = 
-            ndarray::allocate(ndarray::makeVector(fullFp->getArea()));
-        afwDet::flattenArray(*fullFp, finalMask.getArray(), 
-                             maskArray, templateImage.getXY0()); /* Need to fake the XY0 */
-        ndarray::EigenView<int, 1, 1> maskEigen(maskArray);
-
-        ndarray::Array<InputT, 1, 1> arrayTemplate = 
-            ndarray::allocate(ndarray::makeVector(fullFp->getArea()));
-        afwDet::flattenArray(*fullFp, templateImage.getArray(), 
-                             arrayTemplate, templateImage.getXY0());
-        ndarray::EigenView<InputT, 1, 1> eigenTemplate0(arrayTemplate);
-
-        ndarray::Array<InputT, 1, 1> arrayScience = 
-            ndarray::allocate(ndarray::makeVector(fullFp->getArea()));
-        afwDet::flattenArray(*fullFp, scienceImage.getArray(), 
-                             arrayScience, scienceImage.getXY0());
-        ndarray::EigenView<InputT, 1, 1> eigenScience0(arrayScience);
-
-        ndarray::Array<afwImage::VariancePixel, 1, 1> arrayVariance = 
-            ndarray::allocate(ndarray::makeVector(fullFp->getArea()));
-        afwDet::flattenArray(*fullFp, varianceEstimate.getArray(), 
-                             arrayVariance, varianceEstimate.getXY0());
-        ndarray::EigenView<afwImage::VariancePixel, 1, 1> eigenVariance0(arrayVariance);
+        /* The unmasked pixels are read in place from the images and gathered
+           directly into the vectors and columns of C */
+        EigenImageMap<afwImage::MaskPixel>::Type maskView = imageToEigenMap(finalMask);
+        int const nGood = (maskView.array() == 0).count();
 
-        int nGood = 0;
-        for (int i = 0; i < maskEigen.size(); i++) {
-            if (maskEigen(i) == 0.0)
-                nGood += 1;
-        }
-
-        Eigen::VectorXd eigenTemplate(nGood);
-        Eigen::VectorXd eigenScience(nGood);
-        Eigen::VectorXd eigenVariance(nGood);
-        int nUsed = 0;
-        for (int i = 0; i < maskEigen.size(); i++) {
-            if (maskEigen(i) == 0.0) {
-                eigenTemplate(nUsed) = eigenTemplate0(i);
-                eigenScience(nUsed) = eigenScience0(i);
-                eigenVariance(nUsed) = eigenVariance0(i);
-                nUsed += 1;
-            }
+        if (!workspace) {
+            workspace.reset(new KernelBuildWorkspace());
         }
+        boost::shared_ptr<Eigen::VectorXd> iVec = workspace->getVector(nGood);
+        gatherUnmasked(imageToEigenMap(scienceImage), maskView, iVec->data());
+        boost::shared_ptr<Eigen::VectorXd> ivVec = workspace->getVector(nGood);
+        gatherUnmasked(imageToEigenMap(varianceEstimate), maskView, ivVec->data());
+        *ivVec = ivVec->cwiseInverse();
 
-
-        boost::timer t;
-        t.restart();
+        Instrumentation::Timer timer(Instrumentation::BASIS_CONVOLUTION);
 
         unsigned int const nKernelParameters     = basisList.size();
         unsigned int const nBackgroundParameters = this->_fitForBackground ? 1 : 0;
         unsigned int const nParameters           = nKernelParameters + nBackgroundParameters;
 
         /* Holds image convolved with basis function */
-        afwImage::Image<InputT> cimage(templateImage.getDimensions());
+        KernelBuildWorkspace::ImageT cimage = workspace->getConvolvedImage(templateImage.getDimensions());
         
-        /* Holds eigen representation of image convolved with all basis functions */
-        std::vector<boost::shared_ptr<Eigen::VectorXd> >
-            convolvedEigenList(nKernelParameters);
-        
-        /* Iterators over convolved image list and basis list */
-        typename std::vector<boost::shared_ptr<Eigen::VectorXd> >::iterator eiter = 
-            convolvedEigenList.begin();
-
         /* Create C_i in the formalism of Alard & Lupton */
-        for (kiter = basisList.begin(); kiter != basisList.end(); ++kiter, ++eiter) {
+        boost::shared_ptr<Eigen::MatrixXd> cMat = workspace->getMatrix(nGood, nParameters);
+        unsigned int kidxj = 0;
+        for (kiter = basisList.begin(); kiter != basisList.end(); ++kiter, ++kidxj) {
             afwMath::convolve(cimage, templateImage, **kiter, false); /* cimage stores convolved image */
-
-            ndarray::Array<InputT, 1, 1> arrayC = 
-                ndarray::allocate(ndarray::makeVector(fullFp->getArea()));
-            afwDet::flattenArray(*fullFp, cimage.getArray(), 
-                                 arrayC, cimage.getXY0());
-            ndarray::EigenView<InputT, 1, 1> eigenC0(arrayC);
-
-            Eigen::VectorXd eigenC(nGood);
-            int nUsed = 0;
-            for (int i = 0; i < maskEigen.size(); i++) {
-                if (maskEigen(i) == 0.0) {
-                    eigenC(nUsed) = eigenC0(i);
-                    nUsed += 1;
-                }
-            }
-
-            boost::shared_ptr<Eigen::VectorXd> 
-                eigenCptr (new Eigen::VectorXd(eigenC));
-            
-            *eiter = eigenCptr;
+            gatherUnmasked(imageToEigenMap(cimage), maskView, cMat->col(kidxj).data());
         }
-        double time = t.elapsed();
+        timer.addBytes((static_cast<double>(nGood) * nParameters + 2. * nGood) * sizeof(double));
+        timer.addFlops(convolutionFlops(basisList, templateImage.getDimensions()));
+        timer.stop();
         pexLog::TTrace<5>("lsst.ip.diffim.StaticKernelSolution.buildWithMask", 
-                          "Total compute time to do basis convolutions : %.2f s", time);
-        t.restart();
+                          "Built C from %d basis convolutions", static_cast<int>(basisList.size()));
         
-        /* Load matrix with all convolved images */
-        Eigen::MatrixXd cMat(eigenTemplate.size(), nParameters);
-        typename std::vector<boost::shared_ptr<Eigen::VectorXd> >::iterator eiterj = 
-            convolvedEigenList.begin();
-        typename std::vector<boost::shared_ptr<Eigen::VectorXd> >::iterator eiterE = 
-            convolvedEigenList.end();
-        for (unsigned int kidxj = 0; eiterj != eiterE; eiterj++, kidxj++) {
-            cMat.block(0, kidxj, eigenTemplate.size(), 1) = 
-                Eigen::MatrixXd(**eiterj).block(0, 0, eigenTemplate.size(), 1);
-        }
         /* Treat the last "image" as all 1's to do the background calculation. */
         if (this->_fitForBackground)
-            cMat.col(nParameters-1).fill(1.);
+            cMat->col(nParameters-1).fill(1.);
         
-        this->_cMat.reset(new Eigen::MatrixXd(cMat));
-        //this->_ivVec.reset(new Eigen::VectorXd((eigenVariance.template cast<double>()).cwise().inverse()));
-        //this->_iVec.reset(new Eigen::VectorXd(eigenScience.template cast<double>()));
-        this->_ivVec.reset(new Eigen::VectorXd(eigenVariance.array().inverse().matrix()));
-        this->_iVec.reset(new Eigen::VectorXd(eigenScience));
+        this->_cMat  = cMat;
+        this->_ivVec = ivVec;
+        this->_iVec  = iVec;
 
         /* Make these outside of solve() so I can check condition number */
-        this->_mMat.reset(
-            new Eigen::MatrixXd(this->_cMat->transpose() * this->_ivVec->asDiagonal() * *(this->_cMat))
-            );
-        this->_bVec.reset(
-            new Eigen::VectorXd(this->_cMat->transpose() * this->_ivVec->asDiagonal() * *(this->_iVec))
-            );
+        computeNormalEquations(*(this->_cMat), *(this->_ivVec), *(this->_iVec), *workspace,
+                               this->_mMat, this->_bVec);
     }
 
 
@@ -724,9 +914,8 @@ namespace diffim {
         unsigned int const nBackgroundParameters = this->_fitForBackground ? 1 : 0;
         unsigned int const nParameters           = nKernelParameters + nBackgroundParameters;
 
-        /* NOTE - we are accessing particular elements of Eigen arrays using
-           these coordinates, therefore they need to be in LOCAL coordinates.
-           This was written before ndarray unification.
+        /* NOTE - the images are addressed through Eigen views of their
+           arrays, so these coordinates need to be in LOCAL coordinates.
         */
         /* Ignore known EDGE pixels for speed */
         afwGeom::Box2I shrunkLocalBBox = (*kiter)->shrinkBBox(templateImage.getBBox(afwImage::LOCAL));
@@ -744,113 +933,53 @@ namespace diffim {
         endCol += 1;
         endRow += 1;
 
-        boost::timer t;
-        t.restart();
-
-        /* Eigen representation of input images; only the pixels that are unconvolved in cimage below */
-        Eigen::MatrixXi eMask = maskToEigenMatrix(sMask).block(startRow, 
-                                                               startCol, 
-                                                               endRow-startRow, 
-                                                               endCol-startCol);
-
-        Eigen::MatrixXd eigenTemplate = imageToEigenMatrix(templateImage).block(startRow, 
-                                                                                startCol, 
-                                                                                endRow-startRow, 
-                                                                                endCol-startCol);
-        Eigen::MatrixXd eigenScience = imageToEigenMatrix(scienceImage).block(startRow, 
-                                                                              startCol, 
-                                                                              endRow-startRow, 
-                                                                              endCol-startCol);
-        Eigen::MatrixXd eigeniVariance = imageToEigenMatrix(varianceEstimate).block(
-	    startRow, startCol, endRow-startRow, endCol-startCol
-	).array().inverse().matrix();
-
-        /* Resize into 1-D for later usage */
-        eMask.resize(eMask.rows()*eMask.cols(), 1);
-        eigenTemplate.resize(eigenTemplate.rows()*eigenTemplate.cols(), 1);
-        eigenScience.resize(eigenScience.rows()*eigenScience.cols(), 1);
-        eigeniVariance.resize(eigeniVariance.rows()*eigeniVariance.cols(), 1);
-
-        /* Do the masking, slowly for now... */
-        Eigen::MatrixXd maskedEigenTemplate(eigenTemplate.rows(), 1);
-        Eigen::MatrixXd maskedEigenScience(eigenScience.rows(), 1);
-        Eigen::MatrixXd maskedEigeniVariance(eigeniVariance.rows(), 1);
-        int nGood = 0;
-        for (int i = 0; i < eMask.rows(); i++) {
-            if (eMask(i, 0) == 0) {
-                maskedEigenTemplate(nGood, 0) = eigenTemplate(i, 0);
-                maskedEigenScience(nGood, 0) = eigenScience(i, 0);
-                maskedEigeniVariance(nGood, 0) = eigeniVariance(i, 0);
-                nGood += 1;
-            }
-        }
-        /* Can't resize() since all values are lost; use blocks */
-        eigenTemplate    = maskedEigenTemplate.block(0, 0, nGood, 1);
-        eigenScience     = maskedEigenScience.block(0, 0, nGood, 1);
-        eigeniVariance   = maskedEigeniVariance.block(0, 0, nGood, 1);
+        int const nRows = endRow - startRow;
+        int const nCols = endCol - startCol;
+
+        Instrumentation::Timer timer(Instrumentation::BASIS_CONVOLUTION);
 
+        /* The unmasked pixels of the unconvolved region are read in place from
+           the images and gathered directly into the vectors and columns of C */
+        EigenImageMap<afwImage::MaskPixel>::Type maskView = imageToEigenMap(sMask);
+        int const nGood = (maskView.block(startRow, startCol, nRows, nCols).array() == 0).count();
+
+        boost::shared_ptr<Eigen::VectorXd> iVec(new Eigen::VectorXd(nGood));
+        gatherUnmasked(imageToEigenMap(scienceImage).block(startRow, startCol, nRows, nCols),
+                       maskView.block(startRow, startCol, nRows, nCols), iVec->data());
+        boost::shared_ptr<Eigen::VectorXd> ivVec(new Eigen::VectorXd(nGood));
+        gatherUnmasked(imageToEigenMap(varianceEstimate).block(startRow, startCol, nRows, nCols),
+                       maskView.block(startRow, startCol, nRows, nCols), ivVec->data());
+        *ivVec = ivVec->cwiseInverse();
 
         /* Holds image convolved with basis function */
         afwImage::Image<InputT> cimage(templateImage.getDimensions());
         
-        /* Holds eigen representation of image convolved with all basis functions */
-        std::vector<boost::shared_ptr<Eigen::MatrixXd> > convolvedEigenList(nKernelParameters);
-        
-        /* Iterators over convolved image list and basis list */
-        typename std::vector<boost::shared_ptr<Eigen::MatrixXd> >::iterator eiter = 
-            convolvedEigenList.begin();
         /* Create C_i in the formalism of Alard & Lupton */
-        for (kiter = basisList.begin(); kiter != basisList.end(); ++kiter, ++eiter) {
+        boost::shared_ptr<Eigen::MatrixXd> cMat(new Eigen::MatrixXd(nGood, nParameters));
+        unsigned int kidxj = 0;
+        for (kiter = basisList.begin(); kiter != basisList.end(); ++kiter, ++kidxj) {
             afwMath::convolve(cimage, templateImage, **kiter, false); /* cimage stores convolved image */
-            
-            Eigen::MatrixXd cMat = imageToEigenMatrix(cimage).block(startRow, 
-                                                                    startCol, 
-                                                                    endRow-startRow, 
-                                                                    endCol-startCol);
-            cMat.resize(cMat.rows() * cMat.cols(), 1);
-
-            /* Do masking */
-            Eigen::MatrixXd maskedcMat(cMat.rows(), 1);
-            int nGood = 0;
-            for (int i = 0; i < eMask.rows(); i++) {
-                if (eMask(i, 0) == 0) {
-                    maskedcMat(nGood, 0) = cMat(i, 0);
-                    nGood += 1;
-                }
-            }
-            cMat = maskedcMat.block(0, 0, nGood, 1);
-            boost::shared_ptr<Eigen::MatrixXd> cMatPtr (new Eigen::MatrixXd(cMat));
-            *eiter = cMatPtr;
+            gatherUnmasked(imageToEigenMap(cimage).block(startRow, startCol, nRows, nCols),
+                           maskView.block(startRow, startCol, nRows, nCols), cMat->col(kidxj).data());
         } 
 
-        double time = t.elapsed();
+        timer.addBytes((static_cast<double>(nGood) * nParameters + 2. * nGood) * sizeof(double));
+        timer.addFlops(convolutionFlops(basisList, templateImage.getDimensions()));
+        timer.stop();
         pexLog::TTrace<5>("lsst.ip.diffim.StaticKernelSolution.build", 
-                          "Total compute time to do basis convolutions : %.2f s", time);
-        t.restart();
+                          "Built C from %d basis convolutions", static_cast<int>(basisList.size()));
         
-        /* 
-           Load matrix with all values from convolvedEigenList : all images
-           (eigeniVariance, convolvedEigenList) must be the same size
-        */
-        Eigen::MatrixXd cMat(eigenTemplate.col(0).size(), nParameters);
-        typename std::vector<boost::shared_ptr<Eigen::MatrixXd> >::iterator eiterj = 
-            convolvedEigenList.begin();
-        typename std::vector<boost::shared_ptr<Eigen::MatrixXd> >::iterator eiterE = 
-            convolvedEigenList.end();
-        for (unsigned int kidxj = 0; eiterj != eiterE; eiterj++, kidxj++) {
-            cMat.col(kidxj) = (*eiterj)->col(0);
-        }
         /* Treat the last "image" as all 1's to do the background calculation. */
         if (this->_fitForBackground)
-            cMat.col(nParameters-1).fill(1.);
+            cMat->col(nParameters-1).fill(1.);
 
-        this->_cMat.reset(new Eigen::MatrixXd(cMat));
-        this->_ivVec.reset(new Eigen::VectorXd(eigeniVariance.col(0)));
-        this->_iVec.reset(new Eigen::VectorXd(eigenScience.col(0)));
+        this->_cMat  = cMat;
+        this->_ivVec = ivVec;
+        this->_iVec  = iVec;
 
         /* Make these outside of solve() so I can check condition number */
         this->_mMat.reset(
-            new Eigen::MatrixXd(this->_cMat->transpose() * this->_ivVec->asDiagonal() * *(this->_cMat))
+            new Eigen::MatrixXd(computeNormalMatrix(*(this->_cMat), *(this->_ivVec)))
             );
         this->_bVec.reset(
             new Eigen::VectorXd(this->_cMat->transpose() * this->_ivVec->asDiagonal() * *(this->_iVec))
@@ -923,19 +1052,9 @@ namespace diffim {
         unsigned int const endCol   = shrunkBBox.getMaxX();
         unsigned int const endRow   = shrunkBBox.getMaxY();
 
-        /* NOTE: no endCol/endRow += 1 for block slicing, since we are doing the
-           slicing using Afw, not Eigen
-
-           Eigen arrays have index 0,0 in the upper right, while LSST images
-           have 0,0 in the lower left.  The y-axis is flipped.  When translating
-           Images to Eigen matrices in ipDiffim::imageToEigenMatrix this is
-           accounted for.  However, we still need to be aware of this fact if
-           addressing subregions of an Eigen matrix.  This is why the slicing is
-           done in Afw, its cleaner.
-           
-           Please see examples/maskedKernel.cc for elaboration on some of the
-           tests done to make sure this indexing gets done right.
-
+        /* NOTE: these are inclusive limits in PARENT coordinates; the boxes
+           below are converted to blocks of the LOCAL Eigen views (whose rows
+           run with image y, see imageToEigenMap) when the pixels are read.
         */
 
 
@@ -1000,97 +1119,74 @@ namespace diffim {
         totalSize    += lBox.getWidth() * lBox.getHeight();
         totalSize    += rBox.getWidth() * rBox.getHeight();
 
-        Eigen::MatrixXd eigenTemplate(totalSize, 1);
-        Eigen::MatrixXd eigenScience(totalSize, 1);
-        Eigen::MatrixXd eigeniVariance(totalSize, 1);
-        eigenTemplate.setZero();
-        eigenScience.setZero();
-        eigeniVariance.setZero();
+        /* Each box is read in place from the images and flattened, in
+           row-major (y, x) order, directly into the vectors and columns of C;
+           the boxes are in PARENT coordinates, the views in LOCAL */
+        int const x0 = templateImage.getX0();
+        int const y0 = templateImage.getY0();
+
+        boost::shared_ptr<Eigen::VectorXd> iVec(new Eigen::VectorXd(totalSize));
+        boost::shared_ptr<Eigen::VectorXd> ivVec(new Eigen::VectorXd(totalSize));
         
-        boost::timer t;
-        t.restart();
+        Instrumentation::Timer timer(Instrumentation::BASIS_CONVOLUTION);
  
         int nTerms = 0;
         typename std::vector<afwGeom::Box2I>::iterator biter = boxArray.begin();
         for (; biter != boxArray.end(); ++biter) {
-            int area = (*biter).getWidth() * (*biter).getHeight();
-
-            afwImage::Image<InputT> siTemplate(templateImage, *biter);
-            afwImage::Image<InputT> siScience(scienceImage, *biter);
-            afwImage::Image<InputT> sVarEstimate(varianceEstimate, *biter);
-
-            Eigen::MatrixXd eTemplate = imageToEigenMatrix(siTemplate);
-            Eigen::MatrixXd eScience = imageToEigenMatrix(siScience);
-            Eigen::MatrixXd eiVarEstimate = imageToEigenMatrix(sVarEstimate).array().inverse().matrix();
-            
-            eTemplate.resize(area, 1);
-            eScience.resize(area, 1);
-            eiVarEstimate.resize(area, 1);
-
-            eigenTemplate.block(nTerms, 0, area, 1) = eTemplate.block(0, 0, area, 1);
-            eigenScience.block(nTerms, 0, area, 1) = eScience.block(0, 0, area, 1);
-            eigeniVariance.block(nTerms, 0, area, 1) = eiVarEstimate.block(0, 0, area, 1);
-
-            nTerms += area;
+            int const nRows = (*biter).getHeight();
+            int const nCols = (*biter).getWidth();
+            int const row0  = (*biter).getMinY() - y0;
+            int const col0  = (*biter).getMinX() - x0;
+
+            Eigen::Map<RowMatrixXd>(iVec->data() + nTerms, nRows, nCols) = 
+                imageToEigenMap(scienceImage).block(row0, col0, nRows, nCols).template cast<double>();
+            Eigen::Map<RowMatrixXd>(ivVec->data() + nTerms, nRows, nCols) = 
+                imageToEigenMap(varianceEstimate).block(row0, col0, nRows, nCols).template cast<double>()
+                .cwiseInverse();
+
+            nTerms += nRows * nCols;
         }
 
         afwImage::Image<InputT> cimage(templateImage.getDimensions());
 
-        std::vector<boost::shared_ptr<Eigen::MatrixXd> > convolvedEigenList(nKernelParameters);
-        typename std::vector<boost::shared_ptr<Eigen::MatrixXd> >::iterator eiter = 
-            convolvedEigenList.begin();
         /* Create C_i in the formalism of Alard & Lupton */
-        for (kiter = basisList.begin(); kiter != basisList.end(); ++kiter, ++eiter) {
+        boost::shared_ptr<Eigen::MatrixXd> cMat(new Eigen::MatrixXd(totalSize, nParameters));
+        unsigned int kidxj = 0;
+        for (kiter = basisList.begin(); kiter != basisList.end(); ++kiter, ++kidxj) {
             afwMath::convolve(cimage, templateImage, **kiter, false); /* cimage stores convolved image */
-            Eigen::MatrixXd cMat(totalSize, 1);
-            cMat.setZero();
+            typename EigenImageMap<InputT>::Type cView = imageToEigenMap(cimage);
 
             int nTerms = 0;
             typename std::vector<afwGeom::Box2I>::iterator biter = boxArray.begin();
             for (; biter != boxArray.end(); ++biter) {
-                int area = (*biter).getWidth() * (*biter).getHeight();
+                int const nRows = (*biter).getHeight();
+                int const nCols = (*biter).getWidth();
 
-                afwImage::Image<InputT> csubimage(cimage, *biter);
-                Eigen::MatrixXd esubimage = imageToEigenMatrix(csubimage);
-                esubimage.resize(area, 1);
-                cMat.block(nTerms, 0, area, 1) = esubimage.block(0, 0, area, 1);
+                Eigen::Map<RowMatrixXd>(cMat->col(kidxj).data() + nTerms, nRows, nCols) = 
+                    cView.block((*biter).getMinY() - y0, (*biter).getMinX() - x0, nRows, nCols)
+                    .template cast<double>();
 
-                nTerms += area;
+                nTerms += nRows * nCols;
             }
-            
-            boost::shared_ptr<Eigen::MatrixXd> cMatPtr (new Eigen::MatrixXd(cMat));
-            *eiter = cMatPtr;
-            
         } 
         
-        double time = t.elapsed();
+        timer.addBytes((static_cast<double>(totalSize) * nParameters + 2. * totalSize) * sizeof(double));
+        timer.addFlops(convolutionFlops(basisList, templateImage.getDimensions()));
+        timer.stop();
         pexLog::TTrace<5>("lsst.ip.diffim.MaskedKernelSolution.build", 
-                          "Total compute time to do basis convolutions : %.2f s", time);
-        t.restart();
+                          "Built C from %d basis convolutions", static_cast<int>(basisList.size()));
 
-        /* 
-           Load matrix with all values from convolvedEigenList : all images
-           (eigeniVariance, convolvedEigenList) must be the same size
-        */
-        Eigen::MatrixXd cMat(eigenTemplate.col(0).size(), nParameters);
-        typename std::vector<boost::shared_ptr<Eigen::MatrixXd> >::iterator eiterj = 
-            convolvedEigenList.begin();
-        typename std::vector<boost::shared_ptr<Eigen::MatrixXd> >::iterator eiterE = 
-            convolvedEigenList.end();
-        for (unsigned int kidxj = 0; eiterj != eiterE; eiterj++, kidxj++) {
-            cMat.col(kidxj) = (*eiterj)->col(0);
-        }
         /* Treat the last "image" as all 1's to do the background calculation. */
         if (this->_fitForBackground)
-            cMat.col(nParameters-1).fill(1.);
+            cMat->col(nParameters-1).fill(1.);
 
-        this->_cMat.reset(new Eigen::MatrixXd(cMat));
-        this->_ivVec.reset(new Eigen::VectorXd(eigeniVariance.col(0)));
-        this->_iVec.reset(new Eigen::VectorXd(eigenScience.col(0)));
+        this->_cMat  = cMat;
+        this->_ivVec = ivVec;
+        this->_iVec  = iVec;
 
         /* Make these outside of solve() so I can check condition number */
         this->_mMat.reset(
-            new Eigen::MatrixXd(this->_cMat->transpose() * this->_ivVec->asDiagonal() * *(this->_cMat))
+            new Eigen::MatrixXd(computeNormalMatrix(*(this->_cMat), *(this->_ivVec)))
             );
         this->_bVec.reset(
             new Eigen::VectorXd(this->_cMat->transpose() * this->_ivVec->asDiagonal() * *(this->_iVec))
@@ -1181,6 +1277,9 @@ namespace diffim {
 
     template <typename InputT>
     boost::shared_ptr<Eigen::MatrixXd> RegularizedKernelSolution<InputT>::getM(bool includeHmat) {
+        if (!this->_mMat) {
+            return this->_mMat;
+        }
         if (includeHmat == true) {
             return (boost::shared_ptr<Eigen::MatrixXd>(
                         new Eigen::MatrixXd(*(this->_mMat) + _lambda * (*_hMat))
@@ -1191,8 +1290,23 @@ namespace diffim {
         }
     }
 
+    template <typename InputT>
+    void RegularizedKernelSolution<InputT>::restore(
+        boost::shared_ptr<Eigen::MatrixXd> mMat,
+        boost::shared_ptr<Eigen::VectorXd> bVec,
+        boost::shared_ptr<Eigen::VectorXd> aVec,
+        KernelSolution::KernelSolvedBy solvedBy,
+        double lambda
+        ) {
+        StaticKernelSolution<InputT>::restore(mMat, bVec, aVec, solvedBy);
+        _lambda = lambda;
+    }
+
     template <typename InputT>
     void RegularizedKernelSolution<InputT>::solve() {
+        if (!this->_cMat) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Kernel matrices released; cannot solve");
+        }
 
         pexLog::TTrace<5>("lsst.ip.diffim.RegularizedKernelSolution.solve", 
                           "cMat is %d x %d; vVec is %d; iVec is %d; hMat is %d x %d", 
@@ -1213,7 +1327,7 @@ namespace diffim {
 
 
         this->_mMat.reset(
-            new Eigen::MatrixXd(this->_cMat->transpose() * this->_ivVec->asDiagonal() * *(this->_cMat))
+            new Eigen::MatrixXd(computeNormalMatrix(*(this->_cMat), *(this->_ivVec)))
             );
         this->_bVec.reset(
             new Eigen::VectorXd(this->_cMat->transpose() * this->_ivVec->asDiagonal() * *(this->_iVec))
@@ -1343,11 +1457,23 @@ namespace diffim {
         _kernel(),
         _background(background),
         _kSum(0.0),
+        _pixelBasis(PixelBasis::fromKernelList(basisList)),
         _policy(policy),
         _nbases(0),
         _nkt(0),
         _nbt(0),
-        _nt(0) {
+        _nt(0),
+        _nConstraints(0),
+        _constraints(),
+        _rebuildInterval(0),
+        _downdated(false),
+        _nDowndatedSolves(0),
+        _nRebuilds(0),
+        _useCholesky(false),
+        _llt(),
+        _pendingUpdates(),
+        _pendingRank(0),
+        _nUpdatedSolves(0) {
 
         bool isAlardLupton    = _policy.getString("kernelBasisSet") == "alard-lupton";
         bool usePca           = _policy.getBool("usePcaForSpatialKernel");
@@ -1355,6 +1481,8 @@ namespace diffim {
             _constantFirstTerm = true;
         }
         this->_fitForBackground = _policy.getBool("fitForBackground");
+        _useCholesky = _policy.getBool("useCholeskyForSpatialKernel");
+        _rebuildInterval = _policy.getInt("spatialKernelRebuildInterval");
 
         _nbases = basisList.size();
         _nkt = _spatialKernelFunction->getParameters().size();
@@ -1391,7 +1519,192 @@ namespace diffim {
         
         pexLog::TTrace<8>("lsst.ip.diffim.SpatialKernelSolution.addConstraint", 
                           "Adding candidate at %f, %f", xCenter, yCenter);
+        _accumulateConstraint(xCenter, yCenter, *qMat, *wVec, 1.0);
+        _recordUpdate(xCenter, yCenter, qMat, 1.0);
+
+        Constraint constraint;
+        constraint.xCenter = xCenter;
+        constraint.yCenter = yCenter;
+        constraint.qMat    = qMat;
+        constraint.wVec    = wVec;
+        _constraints.push_back(constraint);
+        _nConstraints += 1;
+    }
+
+    /*
+     * Downdate M and B by a constraint previously passed to addConstraint.
+     * qMat and wVec must be the same objects.  The subtraction is exact only
+     * up to floating point cancellation; see rebuild().
+     */
+    void SpatialKernelSolution::removeConstraint(float xCenter, float yCenter,
+                                                 boost::shared_ptr<Eigen::MatrixXd> qMat,
+                                                 boost::shared_ptr<Eigen::VectorXd> wVec) {
+        if (_nConstraints == 0) {
+            throw LSST_EXCEPT(pexExcept::Exception, "No constraints to remove");
+        }
+
+        std::vector<Constraint>::iterator constraint = _constraints.begin();
+        while ((constraint != _constraints.end()) &&
+               ((constraint->qMat != qMat) || (constraint->wVec != wVec) ||
+                (constraint->xCenter != xCenter) || (constraint->yCenter != yCenter))) {
+            ++constraint;
+        }
+        if (constraint == _constraints.end()) {
+            throw LSST_EXCEPT(pexExcept::Exception,
+                              str(boost::format("No constraint at %f, %f to remove") % xCenter % yCenter));
+        }
+
+        pexLog::TTrace<8>("lsst.ip.diffim.SpatialKernelSolution.removeConstraint", 
+                          "Removing candidate at %f, %f", xCenter, yCenter);
+        _accumulateConstraint(xCenter, yCenter, *qMat, *wVec, -1.0);
+        _recordUpdate(xCenter, yCenter, qMat, -1.0);
+        _constraints.erase(constraint);
+        _nConstraints -= 1;
+        _downdated = true;
+    }
+
+    /*
+     * Adding and subtracting constraints leaves cancellation residue in M and
+     * B that grows with the number of passes; accumulating the current
+     * constraints from scratch removes it.
+     */
+    double SpatialKernelSolution::rebuild() {
+        Eigen::MatrixXd mMatOld = *_mMat;
+        (*_mMat).setZero();
+        (*_bVec).setZero();
+        for (std::vector<Constraint>::const_iterator constraint = _constraints.begin();
+             constraint != _constraints.end(); ++constraint) {
+            _accumulateConstraint(constraint->xCenter, constraint->yCenter,
+                                  *(constraint->qMat), *(constraint->wVec), 1.0);
+        }
+        _llt.reset();
+        _pendingUpdates.clear();
+        _pendingRank = 0;
+        _downdated = false;
+        _nDowndatedSolves = 0;
+        _nRebuilds += 1;
+
+        /* Only the upper triangle is accumulated */
+        Eigen::MatrixXd dMat = (*_mMat) - mMatOld;
+        double drift = dMat.triangularView<Eigen::Upper>().toDenseMatrix().cwiseAbs().maxCoeff();
+        pexLog::TTrace<5>("lsst.ip.diffim.SpatialKernelSolution.rebuild", 
+                          "Rebuilt from %d constraints; largest change in M %.3e",
+                          _nConstraints, drift);
+        return drift;
+    }
+
+    void SpatialKernelSolution::replaceConstraint(float xCenter, float yCenter,
+                                                  boost::shared_ptr<Eigen::MatrixXd> qMatOld,
+                                                  boost::shared_ptr<Eigen::VectorXd> wVecOld,
+                                                  boost::shared_ptr<Eigen::MatrixXd> qMatNew,
+                                                  boost::shared_ptr<Eigen::VectorXd> wVecNew) {
+        removeConstraint(xCenter, yCenter, qMatOld, wVecOld);
+        addConstraint(xCenter, yCenter, qMatNew, wVecNew);
+    }
+
+    /* 
+     * Remember a change to M for a later update of the cached factorization.
+     * Once the changes are of high enough rank that refactoring is cheaper,
+     * the cache is simply dropped.
+     */
+    void SpatialKernelSolution::_recordUpdate(float xCenter, float yCenter,
+                                              boost::shared_ptr<Eigen::MatrixXd> qMat,
+                                              double weight) {
+        if (!_llt) {
+            return;
+        }
+        /* k rank-1 updates cost ~k nt^2; a new factorization ~nt^3 / 3 */
+        _pendingRank += qMat->rows();
+        if (3 * _pendingRank > _nt) {
+            _llt.reset();
+            _pendingUpdates.clear();
+            _pendingRank = 0;
+            return;
+        }
+        PendingUpdate update;
+        update.xCenter = xCenter;
+        update.yCenter = yCenter;
+        update.qMat    = qMat;
+        update.weight  = weight;
+        _pendingUpdates.push_back(update);
+    }
+
+    /*
+     * The contribution of one constraint to M is P Q P^T, with P mapping the
+     * candidate's basis (and background) terms onto the spatial terms.
+     */
+    Eigen::MatrixXd SpatialKernelSolution::_makePMatrix(float xCenter, float yCenter) {
+        int const nq = _nbases + (_fitForBackground ? 1 : 0);
+        Eigen::MatrixXd pMat = Eigen::MatrixXd::Zero(_nt, nq);
+
+        Eigen::VectorXd pK(_nkt);
+        std::vector<double> paramsK(_nkt, 0.0);
+        for (int idx = 0; idx < _nkt; idx++) {
+            paramsK[idx] = 1.0;
+            _spatialKernelFunction->setParameters(paramsK);
+            pK(idx) = (*_spatialKernelFunction)(xCenter, yCenter);
+            paramsK[idx] = 0.0;
+        }
+
+        int m0 = 0;
+        int dm = 0;
+        if (_constantFirstTerm) {
+            m0 = 1;
+            dm = _nkt-1;
+            pMat(0, 0) = 1.0;
+        }
+        for (int m1 = m0; m1 < _nbases; m1++) {
+            pMat.block(m1*_nkt-dm, m1, _nkt, 1) = pK;
+        }
+
+        if (_fitForBackground) {
+            std::vector<double> paramsB(_nbt, 0.0);
+            for (int idx = 0; idx < _nbt; idx++) {
+                paramsB[idx] = 1.0;
+                _background->setParameters(paramsB);
+                pMat(_nt - _nbt + idx, _nbases) = (*_background)(xCenter, yCenter);
+                paramsB[idx] = 0.0;
+            }
+        }
+        return pMat;
+    }
 
+    /*
+     * Apply the pending changes to _llt as rank-1 updates/downdates along
+     * the eigenvectors of each Q.  Returns false if a downdate lost positive
+     * definiteness, in which case M has to be refactored.
+     */
+    bool SpatialKernelSolution::_applyUpdates() {
+        for (std::vector<PendingUpdate>::const_iterator update = _pendingUpdates.begin();
+             update != _pendingUpdates.end(); ++update) {
+            Eigen::MatrixXd pMat = _makePMatrix(update->xCenter, update->yCenter);
+            int const nq = pMat.cols();
+            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eVecValues(update->qMat->topLeftCorner(nq, nq));
+            Eigen::VectorXd const& eValues = eVecValues.eigenvalues();
+            Eigen::MatrixXd const& eVectors = eVecValues.eigenvectors();
+            double const eMax = eValues.cwiseAbs().maxCoeff();
+            for (int i = 0; i < nq; i++) {
+                if (std::fabs(eValues(i)) <= std::numeric_limits<double>::epsilon() * eMax) {
+                    continue;
+                }
+                Eigen::VectorXd vVec = pMat * eVectors.col(i);
+                _llt->rankUpdate(vVec, update->weight * eValues(i));
+                if (_llt->info() != Eigen::Success) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void SpatialKernelSolution::_accumulateConstraint(float xCenter, float yCenter,
+                                                      Eigen::MatrixXd const& qMat,
+                                                      Eigen::VectorXd const& wVec,
+                                                      double weight) {
+        Instrumentation::Timer timer(Instrumentation::SPATIAL_ACCUMULATE);
+        timer.addFlops(2. * qMat.size() * _nkt * _nkt + 2. * wVec.size() * _nkt);
+
+        /* weight only scales the coefficient of each term added below */
         /* Calculate P matrices */
         /* Pure kernel terms */
         Eigen::VectorXd pK(_nkt);
@@ -1437,8 +1750,8 @@ namespace diffim {
         
         if (DEBUG_MATRIX) {
             std::cout << "Spatial matrix inputs" << std::endl;
-            std::cout << "M " << (*qMat) << std::endl;
-            std::cout << "B " << (*wVec) << std::endl;
+            std::cout << "M " << qMat << std::endl;
+            std::cout << "B " << wVec << std::endl;
         }
 
         /* first index to start the spatial blocks; default=0 for non-constant first term */
@@ -1452,42 +1765,42 @@ namespace diffim {
             m0 = 1;       /* we need to manually fill in the first (non-spatial) terms below */
             dm = _nkt-1;  /* need to shift terms due to lack of spatial variation in first term */
             
-            (*_mMat)(0, 0) += (*qMat)(0,0);
+            (*_mMat)(0, 0) += weight * qMat(0,0);
             for(int m2 = 1; m2 < _nbases; m2++)  {
-                (*_mMat).block(0, m2*_nkt-dm, 1, _nkt) += (*qMat)(0,m2) * pK.transpose();
+                (*_mMat).block(0, m2*_nkt-dm, 1, _nkt) += (weight * qMat(0,m2)) * pK.transpose();
             }
-            (*_bVec)(0) += (*wVec)(0);
+            (*_bVec)(0) += weight * wVec(0);
             
             if (_fitForBackground) {
-                (*_mMat).block(0, mb, 1, _nbt) += (*qMat)(0,_nbases) * pB.transpose();
+                (*_mMat).block(0, mb, 1, _nbt) += (weight * qMat(0,_nbases)) * pB.transpose();
             }
         }
         
         /* Fill in the spatial blocks */
         for(int m1 = m0; m1 < _nbases; m1++)  {
-            /* Diagonal kernel-kernel term; only use upper triangular part of pKpKt */
-            (*_mMat).block(m1*_nkt-dm, m1*_nkt-dm, _nkt, _nkt) += 
-                (pKpKt * (*qMat)(m1,m1)).triangularView<Eigen::Upper>();
+            /* Diagonal kernel-kernel term; only the upper triangle is accumulated */
+            (*_mMat).block(m1*_nkt-dm, m1*_nkt-dm, _nkt, _nkt).selfadjointView<Eigen::Upper>().rankUpdate(
+                pK, weight * qMat(m1,m1));
             
             /* Kernel-kernel terms */
             for(int m2 = m1+1; m2 < _nbases; m2++)  {
-                (*_mMat).block(m1*_nkt-dm, m2*_nkt-dm, _nkt, _nkt) += (*qMat)(m1,m2) * pKpKt;
+                (*_mMat).block(m1*_nkt-dm, m2*_nkt-dm, _nkt, _nkt) += (weight * qMat(m1,m2)) * pKpKt;
             }
 
             if (_fitForBackground) {
                 /* Kernel cross terms with background */
-                (*_mMat).block(m1*_nkt-dm, mb, _nkt, _nbt) += (*qMat)(m1,_nbases) * pKpBt;
+                (*_mMat).block(m1*_nkt-dm, mb, _nkt, _nbt) += (weight * qMat(m1,_nbases)) * pKpBt;
             }
             
             /* B vector */
-            (*_bVec).segment(m1*_nkt-dm, _nkt) += (*wVec)(m1) * pK;
+            (*_bVec).segment(m1*_nkt-dm, _nkt) += (weight * wVec(m1)) * pK;
         }
         
         if (_fitForBackground) {
             /* Background-background terms only */
-            (*_mMat).block(mb, mb, _nbt, _nbt) +=  
-                (pBpBt * (*qMat)(_nbases,_nbases)).triangularView<Eigen::Upper>();
-            (*_bVec).segment(mb, _nbt)         += (*wVec)(_nbases) * pB;
+            (*_mMat).block(mb, mb, _nbt, _nbt).selfadjointView<Eigen::Upper>().rankUpdate(
+                pB, weight * qMat(_nbases,_nbases));
+            (*_bVec).segment(mb, _nbt)         += (weight * wVec(_nbases)) * pB;
         }
         
         if (DEBUG_MATRIX) {
@@ -1505,28 +1818,124 @@ namespace diffim {
         afwImage::Image<afwMath::Kernel::Pixel>::Ptr image(
             new afwImage::Image<afwMath::Kernel::Pixel>(_kernel->getDimensions())
             );
-        (void)_kernel->computeImage(*image, false, pos[0], pos[1]);              
+        if (_pixelBasis) {
+            (void)_pixelBasis->computeImage(*image, _evaluateCoefficients(pos));
+        } else {
+            (void)_kernel->computeImage(*image, false, pos[0], pos[1]);              
+        }
         return image;
     }
 
+    /* 
+     * Evaluate the basis coefficients of the spatial model at pos, directly
+     * from the solution vector.
+     */
+    Eigen::VectorXd SpatialKernelSolution::_evaluateCoefficients(afwGeom::Point2D const& pos) {
+        Eigen::VectorXd coeffs(_nbases);
+        if (_nkt == 1) {
+            coeffs = (*_aVec).head(_nbases);
+            return coeffs;
+        }
+
+        Eigen::VectorXd pK(_nkt);
+        std::vector<double> paramsK(_nkt, 0.0);
+        for (int idx = 0; idx < _nkt; idx++) {
+            paramsK[idx] = 1.0;
+            _spatialKernelFunction->setParameters(paramsK);
+            pK(idx) = (*_spatialKernelFunction)(pos[0], pos[1]);
+            paramsK[idx] = 0.0;
+        }
+
+        int m0 = 0;
+        int dm = 0;
+        if (_constantFirstTerm) {
+            m0 = 1;
+            dm = _nkt-1;
+            coeffs(0) = (*_aVec)(0) * pK(0);
+        }
+        for (int m1 = m0; m1 < _nbases; m1++) {
+            coeffs(m1) = (*_aVec).segment(m1*_nkt-dm, _nkt).dot(pK);
+        }
+        return coeffs;
+    }
+
+    /*
+     * If useCholeskyForSpatialKernel, M is factored by Cholesky and the
+     * factorization kept; later solves after a few add/removeConstraint calls
+     * update it (rank-k) rather than refactoring M.  If M is not positive
+     * definite the usual LU / eigenvector solution is used.
+     */
     void SpatialKernelSolution::solve() {
-        /* Fill in the other half of mMat */
-        for (int i = 0; i < _nt; i++) {
-            for (int j = i+1; j < _nt; j++) {
-                (*_mMat)(j,i) = (*_mMat)(i,j);
+        if (_downdated) {
+            _downdated = false;
+            _nDowndatedSolves += 1;
+            if ((_rebuildInterval > 0) && (_nDowndatedSolves >= _rebuildInterval)) {
+                rebuild();
             }
         }
 
-        try {
-            KernelSolution::solve();
-        } catch (pexExcept::Exception &e) {
-            LSST_EXCEPT_ADD(e, "Unable to solve spatial kernel matrix");
-            throw e;
+        /* Fill in the other half of mMat; addConstraint only accumulates the upper triangle */
+        (*_mMat).triangularView<Eigen::StrictlyLower>() = (*_mMat).transpose();
+
+        bool solved = false;
+        if (_useCholesky) {
+            Instrumentation::Timer timer(Instrumentation::SOLVE);
+            if (_llt && _applyUpdates()) {
+                _nUpdatedSolves += 1;
+                pexLog::TTrace<5>("lsst.ip.diffim.SpatialKernelSolution.solve", 
+                                  "Updated factorization by %d constraints",
+                                  static_cast<int>(_pendingUpdates.size()));
+                timer.addFlops(2. * _pendingRank * _nt * _nt);
+            } else {
+                _llt.reset(new Eigen::LLT<Eigen::MatrixXd>(*_mMat));
+                timer.addFlops(static_cast<double>(_nt) * _nt * _nt / 3.);
+            }
+            timer.addFlops(2. * _nt * _nt);
+            _pendingUpdates.clear();
+            _pendingRank = 0;
+
+            if (_llt->info() == Eigen::Success) {
+                _aVec.reset(new Eigen::VectorXd(_llt->solve(*_bVec)));
+                _solvedBy = CHOLESKY_LLT;
+                solved = true;
+            } else {
+                pexLog::TTrace<5>("lsst.ip.diffim.SpatialKernelSolution.solve", 
+                                  "Unable to determine kernel via Cholesky");
+                _llt.reset();
+            }
+        }
+
+        if (!solved) {
+            try {
+                KernelSolution::solve();
+            } catch (pexExcept::Exception &e) {
+                LSST_EXCEPT_ADD(e, "Unable to solve spatial kernel matrix");
+                throw e;
+            }
         }
         /* Turn matrices into _kernel and _background */
         _setKernel();
     }
 
+    void SpatialKernelSolution::restore(
+        boost::shared_ptr<Eigen::MatrixXd> mMat,
+        boost::shared_ptr<Eigen::VectorXd> bVec,
+        boost::shared_ptr<Eigen::VectorXd> aVec,
+        KernelSolvedBy solvedBy
+        ) {
+        if (aVec && (aVec->size() != _nt)) {
+            throw LSST_EXCEPT(pexExcept::Exception, 
+                              str(boost::format("Restored solution has %d terms, expected %d") %
+                                  aVec->size() % _nt));
+        }
+        KernelSolution::restore(mMat, bVec, aVec, solvedBy);
+        /* Any cached factorization belongs to the old M */
+        _llt.reset();
+        _pendingUpdates.clear();
+        _pendingRank = 0;
+        _setKernel();
+    }
+
     std::pair<afwMath::LinearCombinationKernel::Ptr, 
             afwMath::Kernel::SpatialFunctionPtr> SpatialKernelSolution::getSolutionPair() {
         if (_solvedBy == KernelSolution::NONE) {
@@ -1537,9 +1946,6 @@ namespace diffim {
     }
     
     void SpatialKernelSolution::_setKernel() {
-        /* Report on condition number */
-        double cNumber = this->getConditionNumber(EIGENVALUE);
-        
         if (_nkt == 1) {
             /* Not spatially varying; this fork is a specialization for convolution speed--up */
             
@@ -1550,7 +1956,7 @@ namespace diffim {
                     throw LSST_EXCEPT(
                         pexExcept::Exception, 
                         str(boost::format(
-                                "I. Unable to determine spatial kernel solution %d (nan).  Condition number = %.3e") % i % cNumber));
+                                "I. Unable to determine spatial kernel solution %d (nan).  Condition number = %.3e") % i % this->getConditionNumber(EIGENVALUE)));
                 }
                 kCoeffs[i] = (*_aVec)(i);
             }
@@ -1574,7 +1980,7 @@ namespace diffim {
                         throw LSST_EXCEPT(
                             pexExcept::Exception, 
                             str(boost::format(
-                                    "II. Unable to determine spatial kernel solution %d (nan).  Condition number = %.3e") % idx % cNumber));
+                                    "II. Unable to determine spatial kernel solution %d (nan).  Condition number = %.3e") % idx % this->getConditionNumber(EIGENVALUE)));
                     }
                     kCoeffs[i][0] = (*_aVec)(idx++);
                 }
@@ -1584,7 +1990,7 @@ namespace diffim {
                             throw LSST_EXCEPT(
                                 pexExcept::Exception, 
                                 str(boost::format(
-                                        "III. Unable to determine spatial kernel solution %d (nan).  Condition number = %.3e") % idx % cNumber));
+                                        "III. Unable to determine spatial kernel solution %d (nan).  Condition number = %.3e") % idx % this->getConditionNumber(EIGENVALUE)));
                         }
                         kCoeffs[i][j] = (*_aVec)(idx++);
                     }
@@ -1594,8 +2000,14 @@ namespace diffim {
         }
 
         /* Set kernel Sum */
-        ImageT::Ptr image (new ImageT(_kernel->getDimensions()));
-        _kSum  = _kernel->computeImage(*image, false);              
+        if (_pixelBasis) {
+            /* Each delta function has unit sum */
+            _kSum = _evaluateCoefficients(afwGeom::Point2D(0., 0.)).sum();
+        }
+        else {
+            ImageT::Ptr image (new ImageT(_kernel->getDimensions()));
+            _kSum  = _kernel->computeImage(*image, false);              
+        }
 
         /* Set the background coefficients */
         std::vector<double> bgCoeffs(_fitForBackground ? _nbt : 1);
@@ -124,6 +124,46 @@ namespace detail {
         }
     }
     
+    template<typename PixelT>
+    void KernelSumVisitor<PixelT>::aggregate(
+        KernelCandidateRegistry<PixelT> const& registry,
+        std::vector<int> const& active
+        ) {
+        std::vector<double> const& kSums = registry.getKsum();
+        _kSums.reserve(_kSums.size() + active.size());
+        for (std::vector<int>::const_iterator i = active.begin(); i != active.end(); ++i) {
+            /* NaN if there is no ORIG solution, where processCandidate would throw */
+            if (std::isnan(kSums[*i])) {
+                throw LSST_EXCEPT(pexExcept::Exception, 
+                                  str(boost::format("Kernel not solved for candidate %d; cannot return ksum") %
+                                      registry.getId()[*i]));
+            }
+            _kSums.push_back(kSums[*i]);
+        }
+    }
+
+    template<typename PixelT>
+    void KernelSumVisitor<PixelT>::reject(
+        KernelCandidateRegistry<PixelT> &registry,
+        std::vector<int> const& active
+        ) {
+        if (!_policy.getBool("kernelSumClipping")) {
+            pexLogging::TTrace<6>("lsst.ip.diffim.KernelSumVisitor.reject", 
+                                  "Sigma clipping not enabled");
+            return;
+        }
+        std::vector<double> const& kSums = registry.getKsum();
+        for (std::vector<int>::const_iterator i = active.begin(); i != active.end(); ++i) {
+            if (fabs(kSums[*i] - _kSumMean) > _dkSumMax) {
+                registry.setStatus(*i, afwMath::SpatialCellCandidate::BAD);
+                pexLogging::TTrace<4>("lsst.ip.diffim.KernelSumVisitor.reject", 
+                                      "Rejecting candidate %d; bad source kernel sum : (%.2f)",
+                                      registry.getId()[*i], kSums[*i]);
+                _nRejected += 1;
+            }
+        }
+    }
+
     template<typename PixelT>
     void KernelSumVisitor<PixelT>::processKsumDistribution() {
         if (_kSums.size() == 0) {
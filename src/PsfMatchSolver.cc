@@ -0,0 +1,954 @@
+// -*- lsst-c++ -*-
+/**
+ * @file PsfMatchSolver.cc
+ *
+ * @brief Implementation of PsfMatchSolver
+ *
+ * @ingroup ip_diffim
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "boost/cstdint.hpp"
+#include "boost/format.hpp"
+
+#include "lsst/afw/math.h"
+#include "lsst/afw/image.h"
+#include "lsst/pex/policy/Policy.h"
+#include "lsst/pex/exceptions/Runtime.h"
+#include "lsst/pex/logging/Trace.h"
+
+#include "lsst/ip/diffim/BasisLists.h"
+#include "lsst/ip/diffim/KernelCandidate.h"
+#include "lsst/ip/diffim/KernelCandidateRegistry.h"
+#include "lsst/ip/diffim/KernelPca.h"
+#include "lsst/ip/diffim/KernelSumVisitor.h"
+#include "lsst/ip/diffim/BuildSingleKernelVisitor.h"
+#include "lsst/ip/diffim/BuildSpatialKernelVisitor.h"
+#include "lsst/ip/diffim/AssessSpatialKernelVisitor.h"
+#include "lsst/ip/diffim/PsfMatchSolver.h"
+
+namespace afwMath        = lsst::afw::math;
+namespace afwImage       = lsst::afw::image;
+namespace pexLogging     = lsst::pex::logging;
+namespace pexPolicy      = lsst::pex::policy;
+namespace pexExcept      = lsst::pex::exceptions;
+
+namespace lsst {
+namespace ip {
+namespace diffim {
+
+namespace {
+    /*
+     * Checkpoint format : every section is padded to 8 bytes so that the
+     * doubles can be read in place from the mapping.
+     *
+     *   "IPDIFFCK"
+     *   int[8]    version, nCandidates, key length, nSpatialBases (0 : the
+     *             spatial basis is the solver's basisList), basis width, basis
+     *             height, spatial solvedBy, nSpatialTerms
+     *   char[]    key
+     *   double[]  spatial basis images, if nSpatialBases > 0
+     *   double[]  spatial M, B and solution
+     *   per candidate :
+     *     double[3] xCenter, yCenter, chi2
+     *     uint64[2] checksums of the template and science stamps
+     *     int[2]    status, nSolutions
+     *     per solution :
+     *       int[5]    KernelCandidate::CandidateSwitch, solvedBy, nParameters,
+     *                 has normal equations, is regularized
+     *       double[]  lambda if regularized, M and B if present, then the
+     *                 solution
+     */
+    char const CHECKPOINT_MAGIC[8] = {'I', 'P', 'D', 'I', 'F', 'F', 'C', 'K'};
+    int const CHECKPOINT_VERSION = 2;
+
+    /* 64 bit FNV-1a hash, to fingerprint what a checkpoint depends on */
+    class Fingerprint {
+    public:
+        Fingerprint() : _hash(0xcbf29ce484222325ULL) {}
+
+        void add(void const* data, std::size_t nBytes) {
+            unsigned char const* bytes = static_cast<unsigned char const *>(data);
+            for (std::size_t i = 0; i < nBytes; ++i) {
+                _hash = (_hash ^ bytes[i]) * 0x100000001b3ULL;
+            }
+        }
+        void add(std::string const& str) {
+            add(str.data(), str.size() + 1);
+        }
+        template <typename ImageT>
+        void addImage(ImageT const& image) {
+            int const dims[2] = {image.getWidth(), image.getHeight()};
+            add(dims, sizeof(dims));
+            for (int y = 0; y < image.getHeight(); ++y) {
+                add(&(*image.row_begin(y)), image.getWidth() * sizeof(*image.row_begin(y)));
+            }
+        }
+        template <typename PixelT>
+        void addMaskedImage(afwImage::MaskedImage<PixelT> const& maskedImage) {
+            addImage(*maskedImage.getImage());
+            addImage(*maskedImage.getMask());
+            addImage(*maskedImage.getVariance());
+        }
+
+        boost::uint64_t get() const {return _hash;}
+        std::string str() const {return (boost::format("%016x") % _hash).str();}
+
+    private:
+        boost::uint64_t _hash;
+    };
+
+    /* The pixels a candidate's kernel was fit to */
+    template <typename PixelT>
+    boost::uint64_t stampChecksum(boost::shared_ptr<afwImage::MaskedImage<PixelT> > const& maskedImage) {
+        Fingerprint fingerprint;
+        if (maskedImage) {
+            fingerprint.addMaskedImage(*maskedImage);
+        }
+        return fingerprint.get();
+    }
+
+    std::size_t padded(std::size_t nBytes) {
+        return (nBytes + 7) & ~static_cast<std::size_t>(7);
+    }
+
+    template <typename T>
+    void writeSection(std::ofstream &out, T const* data, std::size_t n) {
+        static char const zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        std::size_t const nBytes = n * sizeof(T);
+        out.write(reinterpret_cast<char const *>(data), nBytes);
+        out.write(zeros, padded(nBytes) - nBytes);
+    }
+
+    /* Read-only mapping of a checkpoint; sections are read in place */
+    class MappedFile {
+    public:
+        explicit MappedFile(std::string const& path) : _data(NULL), _size(0), _offset(0) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw LSST_EXCEPT(pexExcept::Exception, 
+                                  str(boost::format("Cannot open kernel checkpoint %s") % path));
+            }
+            struct stat st;
+            if ((::fstat(fd, &st) == 0) && (st.st_size > 0)) {
+                void *addr = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr != MAP_FAILED) {
+                    _data = static_cast<char const *>(addr);
+                    _size = st.st_size;
+                }
+            }
+            ::close(fd);
+            if (_data == NULL) {
+                throw LSST_EXCEPT(pexExcept::Exception, 
+                                  str(boost::format("Cannot map kernel checkpoint %s") % path));
+            }
+        }
+        ~MappedFile() {
+            ::munmap(const_cast<char *>(_data), _size);
+        }
+
+        template <typename T>
+        T const* read(std::size_t n) {
+            std::size_t const nBytes = n * sizeof(T);
+            if ((_offset > _size) || (nBytes > _size - _offset)) {
+                throw LSST_EXCEPT(pexExcept::Exception, "Truncated kernel checkpoint");
+            }
+            T const* ptr = reinterpret_cast<T const *>(_data + _offset);
+            _offset += padded(nBytes);
+            return ptr;
+        }
+
+        /* Copies out of the mapping, which does not outlive this object */
+        boost::shared_ptr<Eigen::MatrixXd> readMatrix(int rows, int cols) {
+            return boost::shared_ptr<Eigen::MatrixXd>(
+                new Eigen::MatrixXd(Eigen::Map<Eigen::MatrixXd const>(read<double>(rows * cols), rows, cols)));
+        }
+        boost::shared_ptr<Eigen::VectorXd> readVector(int size) {
+            return boost::shared_ptr<Eigen::VectorXd>(
+                new Eigen::VectorXd(Eigen::Map<Eigen::VectorXd const>(read<double>(size), size)));
+        }
+
+    private:
+        char const* _data;
+        std::size_t _size;
+        std::size_t _offset;
+
+        MappedFile(MappedFile const&);
+        MappedFile& operator=(MappedFile const&);
+    };
+
+    template <typename PixelT>
+    class CollectCandidatesVisitor : public afwMath::CandidateVisitor {
+    public:
+        CollectCandidatesVisitor() : afwMath::CandidateVisitor(), _candidates() {}
+        void processCandidate(afwMath::SpatialCellCandidate *candidate) {
+            KernelCandidate<PixelT> *kCandidate = dynamic_cast<KernelCandidate<PixelT> *>(candidate);
+            if (kCandidate == NULL) {
+                throw LSST_EXCEPT(pexExcept::LogicError,
+                                  "Failed to cast SpatialCellCandidate to KernelCandidate");
+            }
+            _candidates.push_back(kCandidate);
+        }
+        std::vector<KernelCandidate<PixelT> *> const& getCandidates() const {return _candidates;}
+    private:
+        std::vector<KernelCandidate<PixelT> *> _candidates;
+    };
+
+    /* One candidate solution as read from a checkpoint */
+    struct SolutionRecord {
+        int which;
+        KernelSolution::KernelSolvedBy solvedBy;
+        bool isRegularized;
+        double lambda;
+        boost::shared_ptr<Eigen::MatrixXd> mMat;
+        boost::shared_ptr<Eigen::VectorXd> bVec;
+        boost::shared_ptr<Eigen::VectorXd> aVec;
+    };
+
+    struct CandidateRecord {
+        double xCenter;
+        double yCenter;
+        double chi2;
+        boost::uint64_t checksums[2];
+        int status;
+        std::vector<SolutionRecord> solutions;
+    };
+} // anonymous namespace
+
+    /**
+     * @class PsfMatchSolver
+     * @ingroup ip_diffim
+     *
+     * @brief The spatial kernel fitting loop of PsfMatchTask._solve
+     *
+     * @code
+        PsfMatchSolver<PixelT> solver(basisList, policy);
+        solver.solve(kernelCellSet);
+        std::pair<afwMath::LinearCombinationKernel::Ptr, afwMath::Kernel::SpatialFunctionPtr> kb =
+            solver.getSolutionPair();
+     * @endcode
+     *
+     * @note Single kernels are built until no candidate is rejected; kernel
+     * sum outliers, and candidates whose Pca-basis fit fails, send the loop
+     * back to the single kernel fits without counting an iteration.  Only
+     * rejections by the spatial fit assessment count against
+     * maxSpatialIterations; if that limit is reached a final spatial fit is
+     * made to the surviving candidates.
+     */
+    template<typename PixelT>
+    PsfMatchSolver<PixelT>::PsfMatchSolver(
+        afwMath::KernelList const& basisList,
+        pexPolicy::Policy const& policy
+        ) :
+        _basisList(basisList),
+        _policy(policy),
+        _hMat(),
+        _kernelSolution(),
+        _spatialBasisList(),
+        _spatialkv(),
+        _priorKernel(),
+        _priorBackground(),
+        _nIterations(0),
+        _nRejectedPrior(0),
+        _skippedKsum(false),
+        _nRejectedSingle(),
+        _nRejectedKsum(),
+        _nRejectedPca(),
+        _nRejectedSpatial(),
+        _nGoodSpatial(),
+        _nAddedSpatial(),
+        _nRemovedSpatial(),
+        _bytesRetained(0)
+    {}
+
+    template<typename PixelT>
+    PsfMatchSolver<PixelT>::PsfMatchSolver(
+        afwMath::KernelList const& basisList,
+        pexPolicy::Policy const& policy,
+        boost::shared_ptr<Eigen::MatrixXd> hMat
+        ) :
+        _basisList(basisList),
+        _policy(policy),
+        _hMat(hMat),
+        _kernelSolution(),
+        _spatialBasisList(),
+        _spatialkv(),
+        _priorKernel(),
+        _priorBackground(),
+        _nIterations(0),
+        _nRejectedPrior(0),
+        _skippedKsum(false),
+        _nRejectedSingle(),
+        _nRejectedKsum(),
+        _nRejectedPca(),
+        _nRejectedSpatial(),
+        _nGoodSpatial(),
+        _nAddedSpatial(),
+        _nRemovedSpatial(),
+        _bytesRetained(0)
+    {}
+
+    template<typename PixelT>
+    void PsfMatchSolver<PixelT>::setPrior(
+        afwMath::LinearCombinationKernel::Ptr kernel,
+        afwMath::Kernel::SpatialFunctionPtr background
+        ) {
+        if (!kernel || !background) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Prior needs both a spatial kernel and background");
+        }
+        _priorKernel = kernel;
+        _priorBackground = background;
+    }
+
+    template<typename PixelT>
+    void PsfMatchSolver<PixelT>::clearPrior() {
+        _priorKernel.reset();
+        _priorBackground.reset();
+    }
+
+    template<typename PixelT>
+    void PsfMatchSolver<PixelT>::_resetCounters() {
+        _nIterations = 0;
+        _nRejectedPrior = 0;
+        _skippedKsum = false;
+        _nRejectedSingle.clear();
+        _nRejectedKsum.clear();
+        _nRejectedPca.clear();
+        _nRejectedSpatial.clear();
+        _nGoodSpatial.clear();
+        _nAddedSpatial.clear();
+        _nRemovedSpatial.clear();
+    }
+
+    template<typename PixelT>
+    void PsfMatchSolver<PixelT>::solve(
+        afwMath::SpatialCellSet &kernelCellSet
+        ) {
+        int const maxSpatialIterations = _policy.getInt("maxSpatialIterations");
+        int const nStarPerCell = _policy.getInt("nStarPerCell");
+        bool const usePcaForSpatialKernel = _policy.getBool("usePcaForSpatialKernel");
+
+        _resetCounters();
+        _kernelSolution.reset();
+        _spatialkv.reset();
+
+        /* Visitor for the single kernel fit */
+        boost::shared_ptr<detail::BuildSingleKernelVisitor<PixelT> > singlekv;
+        if (_hMat) {
+            singlekv.reset(new detail::BuildSingleKernelVisitor<PixelT>(_basisList, _policy, _hMat));
+        } else {
+            singlekv.reset(new detail::BuildSingleKernelVisitor<PixelT>(_basisList, _policy));
+        }
+
+        /* Kernel sum rejection, run over the candidates' scalars */
+        detail::KernelSumVisitor<PixelT> ksv(_policy);
+        KernelCandidateRegistry<PixelT> registry(kernelCellSet);
+
+        /*
+         * Candidates that the prior does not fit are rejected before their
+         * single kernels are built, and the candidates replacing them
+         * assessed until none is lost.  With spatialKernelClipping kernel sum
+         * outliers would have failed this too, so unless a single kernel fit
+         * then brings in an unscreened replacement the first kernel sum
+         * clipping is skipped.
+         */
+        bool skipKsum = false;
+        if (_priorKernel) {
+            detail::AssessSpatialKernelVisitor<PixelT> priorkv(_priorKernel, _priorBackground, _policy);
+            priorkv.setAssessUninitialized(true);
+            int nLost = -1;
+            while (nLost != 0) {
+                kernelCellSet.visitCandidates(&priorkv, nStarPerCell);
+                _nRejectedPrior += priorkv.getNRejected();
+                nLost = priorkv.getNRejected() + priorkv.getNFailed();
+                pexLogging::TTrace<2>("lsst.ip.diffim.PsfMatchSolver.solve",
+                                      "Prior rejected %d of %d candidates", 
+                                      priorkv.getNRejected(), priorkv.getNProcessed());
+            }
+            skipKsum = _policy.getBool("spatialKernelClipping") && (priorkv.getNGood() > 0);
+        }
+
+        int nRejectedSpatial = 0;
+        while (_nIterations < maxSpatialIterations) {
+            _nRejectedSingle.push_back(0);
+            _nRejectedKsum.push_back(0);
+            _nRejectedPca.push_back(0);
+            _nRejectedSpatial.push_back(0);
+            _nGoodSpatial.push_back(0);
+            _nAddedSpatial.push_back(0);
+            _nRemovedSpatial.push_back(0);
+
+            /* Make sure there are no uninitialized candidates as active occupants of Cell */
+            int nRejectedSkf = -1;
+            while (nRejectedSkf != 0) {
+                pexLogging::TTrace<2>("lsst.ip.diffim.PsfMatchSolver.solve",
+                                      "Building single kernels...");
+                kernelCellSet.visitCandidates(singlekv.get(), nStarPerCell);
+                nRejectedSkf = singlekv->getNRejected();
+                _nRejectedSingle.back() += nRejectedSkf;
+                pexLogging::TTrace<2>("lsst.ip.diffim.PsfMatchSolver.solve",
+                                      "Iteration %d, rejected %d candidates due to initial kernel fit",
+                                      _nIterations, nRejectedSkf);
+            }
+
+            /* Reject outliers in kernel sum */
+            bool const ksumScreened = skipKsum && (_nRejectedSingle.back() == 0);
+            skipKsum = false;
+            _skippedKsum = _skippedKsum || ksumScreened;
+            if (ksumScreened) {
+                pexLogging::TTrace<2>("lsst.ip.diffim.PsfMatchSolver.solve",
+                                      "Skipping kernel sum clipping; all candidates fit by the prior");
+            } else {
+                std::vector<int> const active = registry.sync(nStarPerCell);
+                ksv.resetKernelSum();
+                ksv.aggregate(registry, active);
+                ksv.processKsumDistribution();
+                ksv.reject(registry, active);
+
+                int const nRejectedKsum = ksv.getNRejected();
+                _nRejectedKsum.back() = nRejectedKsum;
+                pexLogging::TTrace<2>("lsst.ip.diffim.PsfMatchSolver.solve",
+                                      "Iteration %d, rejected %d candidates due to kernel sum",
+                                      _nIterations, nRejectedKsum);
+
+                /* Jump back to the top without incrementing the iteration */
+                if (nRejectedKsum > 0) {
+                    continue;
+                }
+            }
+
+            /*
+             * Either apply the spatial fit to the kernels directly, or run a
+             * Pca and use its components as a new basis of lower dimensionality.
+             */
+            if (usePcaForSpatialKernel) {
+                pexLogging::TTrace<1>("lsst.ip.diffim.PsfMatchSolver.solve", "Building Pca basis");
+
+                int const nRejectedPca = _createPcaBasis(kernelCellSet, nStarPerCell);
+                _nRejectedPca.back() = nRejectedPca;
+                pexLogging::TTrace<2>("lsst.ip.diffim.PsfMatchSolver.solve",
+                                      "Iteration %d, rejected %d candidates due to Pca kernel fit",
+                                      _nIterations, nRejectedPca);
+
+                /*
+                 * Bad objects contributed to the Pca basis; their cell-mates
+                 * need their original kernels built first.  Don't count
+                 * against the iterations.
+                 */
+                if (nRejectedPca > 0) {
+                    continue;
+                }
+            } else {
+                _spatialBasisList = _basisList;
+            }
+
+            /* We have gotten on to the spatial modeling part */
+            _buildSpatialKernel(kernelCellSet, nStarPerCell);
+            std::pair<afwMath::LinearCombinationKernel::Ptr, afwMath::Kernel::SpatialFunctionPtr> kb =
+                getSolutionPair();
+
+            /* Check the quality of the spatial fit (look at residuals) */
+            detail::AssessSpatialKernelVisitor<PixelT> assesskv(kb.first, kb.second, _policy);
+            kernelCellSet.visitCandidates(&assesskv, nStarPerCell);
+            nRejectedSpatial = assesskv.getNRejected();
+            int const nGoodSpatial = assesskv.getNGood();
+            _nRejectedSpatial.back() = nRejectedSpatial;
+            _nGoodSpatial.back() = nGoodSpatial;
+            pexLogging::TTrace<2>("lsst.ip.diffim.PsfMatchSolver.solve",
+                                  "Iteration %d, rejected %d candidates due to spatial kernel fit",
+                                  _nIterations, nRejectedSpatial);
+            pexLogging::TTrace<2>("lsst.ip.diffim.PsfMatchSolver.solve",
+                                  "%d candidates used in fit", nGoodSpatial);
+
+            /* If only nGoodSpatial == 0, might be other candidates in the cells */
+            if ((nGoodSpatial == 0) && (nRejectedSpatial == 0)) {
+                throw LSST_EXCEPT(pexExcept::Exception, "No kernel candidates for spatial fit");
+            }
+
+            if (nRejectedSpatial == 0) {
+                /* Nothing rejected, finished with spatial fit */
+                break;
+            }
+
+            /* Otherwise, iterate on... */
+            _nIterations += 1;
+        }
+
+        /* Final fit if above did not converge */
+        if ((nRejectedSpatial > 0) && (_nIterations == maxSpatialIterations)) {
+            pexLogging::TTrace<2>("lsst.ip.diffim.PsfMatchSolver.solve", "Final spatial fit");
+            if (usePcaForSpatialKernel) {
+                _createPcaBasis(kernelCellSet, nStarPerCell);
+            }
+            _buildSpatialKernel(kernelCellSet, nStarPerCell);
+        }
+
+        if (!_kernelSolution) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Unable to determine a spatial kernel");
+        }
+
+        /* The spatial fit no longer needs the candidates' M and B */
+        if (KernelSolution::getRetentionLevel(_policy.getString("kernelSolutionRetention")) ==
+            KernelSolution::COEFFICIENTS) {
+            _spatialkv.reset();
+            releaseKernelSolutions<PixelT>(kernelCellSet, KernelSolution::COEFFICIENTS);
+        }
+        _bytesRetained = getBytesRetained<PixelT>(kernelCellSet);
+        pexLogging::TTrace<3>("lsst.ip.diffim.PsfMatchSolver.solve",
+                              "Kernel candidates retain %.1f MB", _bytesRetained / 1048576.);
+    }
+
+    /*
+     * Everything in the solver and cell set that changes the solution : the
+     * basis kernel images, the regularization matrix, every policy value
+     * bar those that only control output, and the cell set bbox.  The
+     * candidates' positions and pixels are checked separately by
+     * restoreCheckpoint.
+     */
+    template<typename PixelT>
+    std::string PsfMatchSolver<PixelT>::_getCheckpointKey(
+        afwMath::SpatialCellSet const& kernelCellSet
+        ) {
+        typedef afwImage::Image<afwMath::Kernel::Pixel> KernelImageT;
+
+        Fingerprint basisFingerprint;
+        KernelImageT image(_basisList[0]->getDimensions());
+        for (afwMath::KernelList::const_iterator k = _basisList.begin(); k != _basisList.end(); ++k) {
+            (void)(*k)->computeImage(image, false);
+            basisFingerprint.addImage(image);
+        }
+
+        Fingerprint hMatFingerprint;
+        if (_hMat) {
+            int const dims[2] = {static_cast<int>(_hMat->rows()), static_cast<int>(_hMat->cols())};
+            hMatFingerprint.add(dims, sizeof(dims));
+            hMatFingerprint.add(_hMat->data(), _hMat->size() * sizeof(double));
+        }
+
+        Fingerprint policyFingerprint;
+        pexPolicy::Policy::StringArray names = _policy.paramNames(false);
+        std::sort(names.begin(), names.end());
+        for (pexPolicy::Policy::StringArray::const_iterator name = names.begin(); name != names.end(); ++name) {
+            if ((*name == "kernelCheckpointFile") || (*name == "basisCacheDir") ||
+                (*name == "enableInstrumentation")) {
+                continue;
+            }
+            policyFingerprint.add(*name);
+            policyFingerprint.add(_policy.str(*name));
+        }
+
+        lsst::afw::geom::Box2I const bbox = kernelCellSet.getBBox();
+        return (boost::format("basis=%dx%dx%d:%s:hMat=%s:policy=%s:bbox=%d,%d,%d,%d") %
+                _basisList.size() % _basisList[0]->getWidth() % _basisList[0]->getHeight() %
+                basisFingerprint.str() % (_hMat ? hMatFingerprint.str() : std::string("none")) %
+                policyFingerprint.str() %
+                bbox.getMinX() % bbox.getMinY() % bbox.getMaxX() % bbox.getMaxY()).str();
+    }
+
+    template<typename PixelT>
+    void PsfMatchSolver<PixelT>::writeCheckpoint(
+        std::string const& path,
+        afwMath::SpatialCellSet &kernelCellSet
+        ) {
+        if (!_kernelSolution) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Spatial kernel has not been solved for");
+        }
+        typedef afwImage::Image<afwMath::Kernel::Pixel> KernelImageT;
+
+        CollectCandidatesVisitor<PixelT> collector;
+        kernelCellSet.visitAllCandidates(&collector, false);
+        std::vector<KernelCandidate<PixelT> *> const& candidates = collector.getCandidates();
+
+        std::string const key = _getCheckpointKey(kernelCellSet);
+        bool const writeBasis = _policy.getBool("usePcaForSpatialKernel");
+        Eigen::MatrixXd const& mSpatial = *_kernelSolution->getM();
+        Eigen::VectorXd const& bSpatial = *_kernelSolution->getB();
+        Eigen::VectorXd const& aSpatial = *_kernelSolution->getA();
+
+        std::string const tmpPath = (boost::format("%s.%d.tmp") % path % getpid()).str();
+        {
+            std::ofstream out(tmpPath.c_str(), std::ios::binary);
+            if (!out) {
+                throw LSST_EXCEPT(pexExcept::Exception, 
+                                  str(boost::format("Cannot write kernel checkpoint to %s") % tmpPath));
+            }
+            int const header[8] = {CHECKPOINT_VERSION,
+                                   static_cast<int>(candidates.size()),
+                                   static_cast<int>(key.size()),
+                                   writeBasis ? static_cast<int>(_spatialBasisList.size()) : 0,
+                                   _spatialBasisList[0]->getWidth(),
+                                   _spatialBasisList[0]->getHeight(),
+                                   static_cast<int>(_kernelSolution->getSolvedBy()),
+                                   static_cast<int>(aSpatial.size())};
+            writeSection(out, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+            writeSection(out, header, 8);
+            writeSection(out, key.data(), key.size());
+
+            if (writeBasis) {
+                KernelImageT image(_spatialBasisList[0]->getDimensions());
+                Eigen::VectorXd pixels(image.getWidth() * image.getHeight());
+                for (afwMath::KernelList::const_iterator k = _spatialBasisList.begin();
+                     k != _spatialBasisList.end(); ++k) {
+                    (void)(*k)->computeImage(image, false);
+                    int n = 0;
+                    for (int y = 0; y < image.getHeight(); ++y) {
+                        for (KernelImageT::x_iterator ptr = image.row_begin(y); ptr != image.row_end(y); 
+                             ++ptr, ++n) {
+                            pixels(n) = *ptr;
+                        }
+                    }
+                    writeSection(out, pixels.data(), pixels.size());
+                }
+            }
+            writeSection(out, mSpatial.data(), mSpatial.size());
+            writeSection(out, bSpatial.data(), bSpatial.size());
+            writeSection(out, aSpatial.data(), aSpatial.size());
+
+            for (typename std::vector<KernelCandidate<PixelT> *>::const_iterator c = candidates.begin();
+                 c != candidates.end(); ++c) {
+                /* Unsolved solutions (e.g. of rejected candidates) are not kept */
+                std::vector<std::pair<int, boost::shared_ptr<StaticKernelSolution<PixelT> > > > solutions;
+                if ((*c)->isInitialized()) {
+                    boost::shared_ptr<StaticKernelSolution<PixelT> > orig = 
+                        (*c)->getKernelSolution(KernelCandidate<PixelT>::ORIG);
+                    boost::shared_ptr<StaticKernelSolution<PixelT> > recent = 
+                        (*c)->getKernelSolution(KernelCandidate<PixelT>::RECENT);
+                    if (orig->getA() && (orig->getSolvedBy() != KernelSolution::NONE)) {
+                        solutions.push_back(std::make_pair(static_cast<int>(KernelCandidate<PixelT>::ORIG), 
+                                                           orig));
+                    }
+                    if ((recent != orig) && recent->getA() && (recent->getSolvedBy() != KernelSolution::NONE)) {
+                        solutions.push_back(std::make_pair(static_cast<int>(KernelCandidate<PixelT>::PCA), 
+                                                           recent));
+                    }
+                }
+
+                double const position[3] = {(*c)->getXCenter(), (*c)->getYCenter(), (*c)->getChi2()};
+                boost::uint64_t const checksums[2] = {stampChecksum((*c)->getTemplateMaskedImage()),
+                                                      stampChecksum((*c)->getScienceMaskedImage())};
+                int const state[2] = {static_cast<int>((*c)->getStatus()), static_cast<int>(solutions.size())};
+                writeSection(out, position, 3);
+                writeSection(out, checksums, 2);
+                writeSection(out, state, 2);
+
+                for (unsigned int i = 0; i < solutions.size(); ++i) {
+                    boost::shared_ptr<StaticKernelSolution<PixelT> > solution = solutions[i].second;
+                    boost::shared_ptr<Eigen::MatrixXd> mMat = solution->getM();
+                    boost::shared_ptr<Eigen::VectorXd> bVec = solution->getB();
+                    Eigen::VectorXd const& aVec = *solution->getA();
+                    bool const hasNormalEquations = mMat && bVec;
+                    boost::shared_ptr<RegularizedKernelSolution<PixelT> > regularized =
+                        boost::dynamic_pointer_cast<RegularizedKernelSolution<PixelT> >(solution);
+                    int const info[5] = {solutions[i].first,
+                                         static_cast<int>(solution->getSolvedBy()),
+                                         static_cast<int>(aVec.size()),
+                                         hasNormalEquations ? 1 : 0,
+                                         regularized ? 1 : 0};
+                    writeSection(out, info, 5);
+                    if (regularized) {
+                        double const lambda = regularized->getLambda();
+                        writeSection(out, &lambda, 1);
+                    }
+                    if (hasNormalEquations) {
+                        writeSection(out, mMat->data(), mMat->size());
+                        writeSection(out, bVec->data(), bVec->size());
+                    }
+                    writeSection(out, aVec.data(), aVec.size());
+                }
+            }
+            if (!out) {
+                out.close();
+                std::remove(tmpPath.c_str());
+                throw LSST_EXCEPT(pexExcept::Exception, 
+                                  str(boost::format("Error writing kernel checkpoint to %s") % tmpPath));
+            }
+        }
+        /* Readers never see a partial checkpoint */
+        std::rename(tmpPath.c_str(), path.c_str());
+        pexLogging::TTrace<3>("lsst.ip.diffim.PsfMatchSolver.writeCheckpoint",
+                              "Wrote %d candidates to %s", static_cast<int>(candidates.size()), path.c_str());
+    }
+
+    /*
+     * The checkpoint is read and checked in full before anything is
+     * changed, so a failed restore leaves the solver and cell set as they
+     * were.
+     */
+    template<typename PixelT>
+    void PsfMatchSolver<PixelT>::restoreCheckpoint(
+        std::string const& path,
+        afwMath::SpatialCellSet &kernelCellSet
+        ) {
+        typedef afwImage::Image<afwMath::Kernel::Pixel> KernelImageT;
+
+        MappedFile in(path);
+        if (std::memcmp(in.read<char>(sizeof(CHECKPOINT_MAGIC)), CHECKPOINT_MAGIC, 
+                        sizeof(CHECKPOINT_MAGIC)) != 0) {
+            throw LSST_EXCEPT(pexExcept::Exception, 
+                              str(boost::format("%s is not a kernel checkpoint") % path));
+        }
+        int const* header = in.read<int>(8);
+        int const version = header[0];
+        int const nCandidates = header[1];
+        int const keyLength = header[2];
+        int const nSpatialBases = header[3];
+        int const width = header[4];
+        int const height = header[5];
+        int const nSpatialTerms = header[7];
+        if (version != CHECKPOINT_VERSION) {
+            throw LSST_EXCEPT(pexExcept::Exception, 
+                              str(boost::format("Unsupported kernel checkpoint version %d") % version));
+        }
+        if ((nCandidates < 0) || (keyLength < 0) || (nSpatialBases < 0) || (nSpatialTerms < 1)) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Corrupt kernel checkpoint header");
+        }
+        std::string const key = _getCheckpointKey(kernelCellSet);
+        if (std::string(in.read<char>(keyLength), keyLength) != key) {
+            throw LSST_EXCEPT(pexExcept::Exception, 
+                              str(boost::format("Kernel checkpoint %s was made with a different configuration") %
+                                  path));
+        }
+
+        afwMath::KernelList spatialBasisList = _basisList;
+        if (nSpatialBases > 0) {
+            if ((width < 1) || (height < 1)) {
+                throw LSST_EXCEPT(pexExcept::Exception, "Corrupt kernel checkpoint header");
+            }
+            spatialBasisList.clear();
+            for (int i = 0; i < nSpatialBases; ++i) {
+                double const* pixels = in.read<double>(width * height);
+                KernelImageT image(lsst::afw::geom::Extent2I(width, height));
+                for (int y = 0, n = 0; y < height; ++y) {
+                    for (KernelImageT::x_iterator ptr = image.row_begin(y); ptr != image.row_end(y); 
+                         ++ptr, ++n) {
+                        *ptr = pixels[n];
+                    }
+                }
+                spatialBasisList.push_back(afwMath::Kernel::Ptr(new afwMath::FixedKernel(image)));
+            }
+        }
+        boost::shared_ptr<Eigen::MatrixXd> mSpatial = in.readMatrix(nSpatialTerms, nSpatialTerms);
+        boost::shared_ptr<Eigen::VectorXd> bSpatial = in.readVector(nSpatialTerms);
+        boost::shared_ptr<Eigen::VectorXd> aSpatial = in.readVector(nSpatialTerms);
+
+        CollectCandidatesVisitor<PixelT> collector;
+        kernelCellSet.visitAllCandidates(&collector, false);
+        std::vector<KernelCandidate<PixelT> *> const& candidates = collector.getCandidates();
+        if (static_cast<int>(candidates.size()) != nCandidates) {
+            throw LSST_EXCEPT(pexExcept::Exception, 
+                              str(boost::format("Kernel checkpoint has %d candidates, cell set has %d") %
+                                  nCandidates % candidates.size()));
+        }
+
+        std::vector<CandidateRecord> records(nCandidates);
+        for (int i = 0; i < nCandidates; ++i) {
+            CandidateRecord &record = records[i];
+            double const* position = in.read<double>(3);
+            boost::uint64_t const* checksums = in.read<boost::uint64_t>(2);
+            int const* state = in.read<int>(2);
+            record.xCenter = position[0];
+            record.yCenter = position[1];
+            record.chi2 = position[2];
+            record.checksums[0] = checksums[0];
+            record.checksums[1] = checksums[1];
+            record.status = state[0];
+            if ((record.xCenter != candidates[i]->getXCenter()) || 
+                (record.yCenter != candidates[i]->getYCenter())) {
+                throw LSST_EXCEPT(pexExcept::Exception, 
+                                  str(boost::format("Kernel checkpoint candidate %d at %.2f,%.2f does not "
+                                                    "match the cell set (%.2f,%.2f)") %
+                                      i % record.xCenter % record.yCenter %
+                                      candidates[i]->getXCenter() % candidates[i]->getYCenter()));
+            }
+            if ((record.checksums[0] != stampChecksum(candidates[i]->getTemplateMaskedImage())) ||
+                (record.checksums[1] != stampChecksum(candidates[i]->getScienceMaskedImage()))) {
+                throw LSST_EXCEPT(pexExcept::Exception, 
+                                  str(boost::format("Kernel checkpoint candidate %d at %.2f,%.2f was fit to "
+                                                    "different pixels") %
+                                      i % record.xCenter % record.yCenter));
+            }
+            for (int j = 0; j < state[1]; ++j) {
+                int const* info = in.read<int>(5);
+                int const nParameters = info[2];
+                if ((nParameters < 1) || 
+                    ((info[0] != KernelCandidate<PixelT>::ORIG) && (info[0] != KernelCandidate<PixelT>::PCA))) {
+                    throw LSST_EXCEPT(pexExcept::Exception, "Corrupt kernel checkpoint solution");
+                }
+                SolutionRecord solution;
+                solution.which = info[0];
+                solution.solvedBy = static_cast<KernelSolution::KernelSolvedBy>(info[1]);
+                solution.isRegularized = (info[4] != 0);
+                solution.lambda = 0.0;
+                if (solution.isRegularized) {
+                    if (!_hMat) {
+                        throw LSST_EXCEPT(pexExcept::Exception, 
+                                          "Kernel checkpoint has regularized solutions but no hMat was given");
+                    }
+                    solution.lambda = *in.read<double>(1);
+                }
+                if (info[3]) {
+                    solution.mMat = in.readMatrix(nParameters, nParameters);
+                    solution.bVec = in.readVector(nParameters);
+                }
+                solution.aVec = in.readVector(nParameters);
+                record.solutions.push_back(solution);
+            }
+        }
+
+        /* Checks the spatial solution against the basis and policy before the candidates change */
+        detail::BuildSpatialKernelVisitor<PixelT> spatialkv(spatialBasisList, kernelCellSet.getBBox(), _policy);
+        SpatialKernelSolution::Ptr kernelSolution = spatialkv.getKernelSolution();
+        kernelSolution->restore(mSpatial, bSpatial, aSpatial, 
+                                static_cast<KernelSolution::KernelSolvedBy>(header[6]));
+
+        bool const fitForBackground = _policy.getBool("fitForBackground");
+        for (int i = 0; i < nCandidates; ++i) {
+            KernelCandidate<PixelT> *kCandidate = candidates[i];
+            for (std::vector<SolutionRecord>::const_iterator s = records[i].solutions.begin();
+                 s != records[i].solutions.end(); ++s) {
+                typename KernelCandidate<PixelT>::CandidateSwitch const which = 
+                    static_cast<typename KernelCandidate<PixelT>::CandidateSwitch>(s->which);
+                afwMath::KernelList const& basisList = (which == KernelCandidate<PixelT>::ORIG) ? 
+                    _basisList : spatialBasisList;
+                boost::shared_ptr<StaticKernelSolution<PixelT> > solution;
+                if (s->isRegularized) {
+                    boost::shared_ptr<RegularizedKernelSolution<PixelT> > regularized(
+                        new RegularizedKernelSolution<PixelT>(basisList, fitForBackground, _hMat, _policy));
+                    regularized->restore(s->mMat, s->bVec, s->aVec, s->solvedBy, s->lambda);
+                    solution = regularized;
+                } else {
+                    solution.reset(new StaticKernelSolution<PixelT>(basisList, fitForBackground));
+                    solution->restore(s->mMat, s->bVec, s->aVec, s->solvedBy);
+                }
+                kCandidate->setKernelSolution(which, solution);
+            }
+            kCandidate->setChi2(records[i].chi2);
+            kCandidate->setStatus(static_cast<afwMath::SpatialCellCandidate::Status>(records[i].status));
+        }
+
+        _resetCounters();
+        _spatialkv.reset();
+        _spatialBasisList = spatialBasisList;
+        _kernelSolution = kernelSolution;
+        _bytesRetained = getBytesRetained<PixelT>(kernelCellSet);
+        pexLogging::TTrace<3>("lsst.ip.diffim.PsfMatchSolver.restoreCheckpoint",
+                              "Restored %d candidates from %s", nCandidates, path.c_str());
+    }
+
+    template<typename PixelT>
+    std::pair<afwMath::LinearCombinationKernel::Ptr, afwMath::Kernel::SpatialFunctionPtr>
+    PsfMatchSolver<PixelT>::getSolutionPair() {
+        if (!_kernelSolution) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Spatial kernel has not been solved for");
+        }
+        return _kernelSolution->getSolutionPair();
+    }
+
+    template<typename PixelT>
+    void PsfMatchSolver<PixelT>::_buildSpatialKernel(
+        afwMath::SpatialCellSet &kernelCellSet,
+        int nStarPerCell
+        ) {
+        /* Same basis as the last pass: only the changed candidates are (re)visited */
+        if (!_spatialkv) {
+            _spatialkv.reset(new detail::BuildSpatialKernelVisitor<PixelT>(_spatialBasisList,
+                                                                           kernelCellSet.getBBox(),
+                                                                           _policy));
+        }
+        kernelCellSet.visitCandidates(_spatialkv.get(), nStarPerCell);
+        _spatialkv->solveLinearEquation();
+        pexLogging::TTrace<3>("lsst.ip.diffim.PsfMatchSolver.solve",
+                              "Spatial kernel built with %d candidates (%d added, %d removed)",
+                              _spatialkv->getNCandidates(), _spatialkv->getNAdded(),
+                              _spatialkv->getNRemoved());
+        if (!_nAddedSpatial.empty()) {
+            _nAddedSpatial.back() = _spatialkv->getNAdded();
+            _nRemovedSpatial.back() = _spatialkv->getNRemoved();
+        }
+        _kernelSolution = _spatialkv->getKernelSolution();
+    }
+
+    /*
+     * Replace _spatialBasisList by the principal components of the kernels,
+     * refit the candidates with that basis, and return the number rejected.
+     */
+    template<typename PixelT>
+    int PsfMatchSolver<PixelT>::_createPcaBasis(
+        afwMath::SpatialCellSet &kernelCellSet,
+        int nStarPerCell
+        ) {
+        typedef afwImage::Image<afwMath::Kernel::Pixel> ImageT;
+
+        int const nComponents = _policy.getInt("numPrincipalComponents");
+        bool const subtractMean = _policy.getBool("subtractMeanForPca");
+
+        /* Only compute the eigenimages we will use; the mean takes up one slot, and may be all we use */
+        int const nEigenComponents = std::max(0, subtractMean ? nComponents - 1 : nComponents);
+        boost::shared_ptr<detail::KernelPca<ImageT> > imagePca(
+            new detail::KernelPca<ImageT>(true, nEigenComponents));
+        detail::KernelPcaVisitor<PixelT> importStarVisitor(imagePca);
+        kernelCellSet.visitCandidates(&importStarVisitor, nStarPerCell);
+        if (subtractMean) {
+            importStarVisitor.subtractMean();
+        }
+        imagePca->analyze();
+
+        std::vector<double> const& eigenValues = imagePca->getEigenValues();
+        afwMath::KernelList pcaBasisList = importStarVisitor.getEigenKernels();
+
+        double const eSum = std::accumulate(eigenValues.begin(), eigenValues.end(), 0.0);
+        if (eSum == 0.0) {
+            throw LSST_EXCEPT(pexExcept::Exception, "Eigenvalues sum to zero");
+        }
+        for (unsigned int j = 0; j < eigenValues.size(); ++j) {
+            pexLogging::TTrace<6>("lsst.ip.diffim.PsfMatchSolver.solve",
+                                  "Eigenvalue %d : %f (%f)", j, eigenValues[j], eigenValues[j] / eSum);
+        }
+
+        /* Drop components with NaN pixels */
+        int const nToUse = std::min(std::min(nComponents, static_cast<int>(eigenValues.size())),
+                                    static_cast<int>(pcaBasisList.size()));
+        afwMath::KernelList trimBasisList;
+        for (int j = 0; j < nToUse; ++j) {
+            afwImage::Image<double> kimage(pcaBasisList[j]->getDimensions());
+            pcaBasisList[j]->computeImage(kimage, false);
+            bool hasNan = false;
+            for (int y = 0; y < kimage.getHeight() && !hasNan; ++y) {
+                for (afwImage::Image<double>::x_iterator ptr = kimage.row_begin(y), end = kimage.row_end(y);
+                     ptr != end; ++ptr) {
+                    if (std::isnan(*ptr)) {
+                        hasNan = true;
+                        break;
+                    }
+                }
+            }
+            if (!hasNan) {
+                trimBasisList.push_back(pcaBasisList[j]);
+            }
+        }
+
+        /* Put all the power in the first kernel, which will not vary spatially */
+        _spatialBasisList = renormalizeKernelList(trimBasisList);
+        _spatialkv.reset();
+
+        /* New Kernel visitor for this new basis list (no regularization explicitly) */
+        detail::BuildSingleKernelVisitor<PixelT> singlekvPca(_spatialBasisList, _policy);
+        singlekvPca.setSkipBuilt(false);
+        kernelCellSet.visitCandidates(&singlekvPca, nStarPerCell);
+        return singlekvPca.getNRejected();
+    }
+
+    typedef float PixelT;
+
+    template class PsfMatchSolver<PixelT>;
+
+}}} // end of namespace lsst::ip::diffim
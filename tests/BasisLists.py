@@ -1,4 +1,6 @@
 #!/usr/bin/env python
+import shutil
+import tempfile
 import numpy as num
 
 import unittest
@@ -90,6 +92,27 @@ class DiffimTestCases(unittest.TestCase):
             arr = kim.getArray()
             self.assertAlmostEqual(num.sum(arr*arr), 1.0)
 
+    def testPixelBasis(self):
+        ks = ipDiffim.makeDeltaFunctionBasisList(self.kSize, self.kSize)
+        pixelBasis = ipDiffim.PixelBasis.fromKernelList(ks)
+        self.assertEqual(pixelBasis.getNBases(), self.kSize * self.kSize)
+        self.assertEqual(pixelBasis.getWidth(), self.kSize)
+        self.assertEqual(pixelBasis.getHeight(), self.kSize)
+
+        # Reshaping the coefficients matches the LinearCombinationKernel
+        coeffs = num.arange(len(ks), dtype=num.float64)
+        kernel = afwMath.LinearCombinationKernel(ks, list(coeffs))
+        kimage1 = afwImage.ImageD(kernel.getDimensions())
+        ksum1 = kernel.computeImage(kimage1, False)
+        kimage2 = afwImage.ImageD(kernel.getDimensions())
+        ksum2 = pixelBasis.computeImage(kimage2, coeffs)
+        self.assertAlmostEqual(ksum1, ksum2)
+        self.assertTrue(num.all(kimage1.getArray() == kimage2.getArray()))
+
+        # Not a pixel basis
+        ks = ipDiffim.makeAlardLuptonBasisList(self.kSize//2, 1, [1.], [0])
+        self.assertEqual(ipDiffim.PixelBasis.fromKernelList(ks), None)
+
     def testMakeAlardLupton(self):
         nGauss   = self.policyAL.get("alardNGauss")
         sigGauss = self.policyAL.getDoubleArray("alardSigGauss")
@@ -261,6 +284,105 @@ class DiffimTestCases(unittest.TestCase):
         else:
             pass
 
+    def testOrthonormalize(self):
+        ks0 = ipDiffim.makeKernelBasisList(self.subconfigAL)
+        for weightSigma in (0.0, 3.0):
+            ks = ipDiffim.orthonormalizeKernelList(ks0, weightSigma)
+            self.assertEqual(len(ks), len(ks0))
+
+            arrs = []
+            for k in ks:
+                kim = afwImage.ImageD(k.getDimensions())
+                k.computeImage(kim, False)
+                arrs.append(kim.getArray().copy())
+            if weightSigma > 0:
+                ny, nx = arrs[0].shape
+                y, x = num.mgrid[0:ny, 0:nx]
+                weights = num.exp(-0.5 * ((x - nx//2)**2 + (y - ny//2)**2) / weightSigma**2)
+            else:
+                weights = num.ones(arrs[0].shape)
+
+            # kernel sum stays in the first term
+            self.assertAlmostEqual(num.sum(arrs[0]), 1.0)
+            for i in range(1, len(arrs)):
+                self.assertAlmostEqual(num.sum(arrs[i]), 0.0)
+
+            # orthonormal under the weighted inner product
+            for i in range(len(arrs)):
+                for j in range(i+1, len(arrs)):
+                    self.assertAlmostEqual(num.sum(weights * arrs[i] * arrs[j]), 0.0)
+                if i > 0:
+                    self.assertAlmostEqual(num.sum(weights * arrs[i] * arrs[i]), 1.0)
+
+        # via the Config
+        self.subconfigAL.alardOrthonormalize = True
+        ipDiffim.BasisCache.clear()
+        ks = ipDiffim.makeKernelBasisList(self.subconfigAL)
+        self.assertEqual(len(ks), len(ks0))
+
+        # cached separately from the plain basis
+        ks = ipDiffim.makeKernelBasisList(self.subconfigAL)
+        self.assertEqual(ipDiffim.BasisCache.getNMisses(), 1)
+        self.assertEqual(ipDiffim.BasisCache.getNHits(), 1)
+        self.subconfigAL.alardOrthonormalize = False
+        ipDiffim.makeKernelBasisList(self.subconfigAL)
+        self.assertEqual(ipDiffim.BasisCache.getNMisses(), 2)
+
+    #
+    ### Cache
+    #
+
+    def testBasisCache(self):
+        ipDiffim.BasisCache.clear()
+        ks1 = ipDiffim.makeKernelBasisList(self.subconfigAL)
+        ks2 = ipDiffim.makeKernelBasisList(self.subconfigAL)
+        self.assertEqual(ipDiffim.BasisCache.getNMisses(), 1)
+        self.assertEqual(ipDiffim.BasisCache.getNHits(), 1)
+        self.alardLuptonTest(ks2)
+        self.assertEqual(len(ks1), len(ks2))
+
+        hMat1 = ipDiffim.BasisCache.getRegularizationMatrix(self.policyDF)
+        hMat2 = ipDiffim.BasisCache.getRegularizationMatrix(self.policyDF)
+        self.assertEqual(ipDiffim.BasisCache.getNMisses(), 2)
+        self.assertEqual(ipDiffim.BasisCache.getNHits(), 2)
+        self.assertTrue(num.all(num.asarray(hMat1) == num.asarray(hMat2)))
+
+        # A different stencil is a different matrix
+        self.policyDF.set("regularizationType", "centralDifference")
+        self.policyDF.set("centralRegularizationStencil", 9)
+        ipDiffim.BasisCache.getRegularizationMatrix(self.policyDF)
+        self.assertEqual(ipDiffim.BasisCache.getNMisses(), 3)
+
+    def testBasisCachePersistence(self):
+        cacheDir = tempfile.mkdtemp()
+        try:
+            ipDiffim.BasisCache.setPersistenceDir(cacheDir)
+            ipDiffim.BasisCache.clear()
+            ks1   = ipDiffim.makeKernelBasisList(self.subconfigAL)
+            hMat1 = ipDiffim.BasisCache.getRegularizationMatrix(self.policyDF)
+
+            # Emulate a new process; objects come back from disk
+            ipDiffim.BasisCache.clear()
+            ks2   = ipDiffim.makeKernelBasisList(self.subconfigAL)
+            hMat2 = ipDiffim.BasisCache.getRegularizationMatrix(self.policyDF)
+            self.alardLuptonTest(ks2)
+            self.assertEqual(len(ks1), len(ks2))
+            for k1, k2 in zip(ks1, ks2):
+                kim1 = afwImage.ImageD(k1.getDimensions())
+                kim2 = afwImage.ImageD(k2.getDimensions())
+                k1.computeImage(kim1, False)
+                k2.computeImage(kim2, False)
+                self.assertTrue(num.all(kim1.getArray() == kim2.getArray()))
+            self.assertTrue(num.all(num.asarray(hMat1) == num.asarray(hMat2)))
+
+            # A task configured without a directory does not inherit this one
+            ipDiffim.ImagePsfMatchTask(config=self.configAL)
+            self.assertEqual(ipDiffim.BasisCache.getPersistenceDir(), "")
+        finally:
+            ipDiffim.BasisCache.setPersistenceDir("")
+            ipDiffim.BasisCache.clear()
+            shutil.rmtree(cacheDir)
+
     def testBadRegularization(self):
         try:
             self.policyDF.set("regularizationType", "foo")
@@ -264,6 +264,42 @@ class DiffimTestCases(unittest.TestCase):
                 cand = ipDiffim.cast_KernelCandidateF(cand)
                 self.assertEqual(cand.getStatus(), afwMath.SpatialCellCandidate.GOOD)
 
+    def testWorkspace(self, nCell = 3):
+        self.policy.set("kernelSolutionRetention", "normal-equations")
+        bskv = ipDiffim.BuildSingleKernelVisitorF(self.kList, self.policy)
+        bskv.setSkipBuilt(False)
+
+        sizeCellX = self.policy.get("sizeCellX")
+        sizeCellY = self.policy.get("sizeCellY")
+        kernelCellSet = afwMath.SpatialCellSet(afwGeom.Box2I(afwGeom.Point2I(0, 0),
+                                                             afwGeom.Extent2I(sizeCellX * nCell,
+                                                                              sizeCellY * nCell)),
+                                               sizeCellX,
+                                               sizeCellY)
+        for candX in range(nCell):
+            for candY in range(nCell):
+                kc = self.makeCandidate(1.0,
+                                        candX * sizeCellX + sizeCellX // 2,
+                                        candY * sizeCellY + sizeCellY // 2)
+                kernelCellSet.insertCandidate(kc)
+
+        # The first rebuild replaces the original solutions with new ones;
+        # from then on every buffer comes back to the workspace
+        workspace = bskv.getWorkspace()
+        kernelCellSet.visitCandidates(bskv, 1)
+        kernelCellSet.visitCandidates(bskv, 1)
+        nAllocations = workspace.getNAllocations()
+        nReused = workspace.getNReused()
+        kernelCellSet.visitCandidates(bskv, 1)
+        self.assertEqual(workspace.getNAllocations(), nAllocations)
+        self.assertTrue(workspace.getNReused() > nReused)
+        self.assertEqual(bskv.getNRejected(), 0)
+
+        # Idle buffers over the limit are dropped at the next allocation
+        workspace.setMaxIdleBytes(0)
+        self.assertTrue(workspace.getBytesIdle() > 0)
+        m = workspace.getMatrix(2, 2)
+        self.assertEqual(workspace.getBytesIdle(), 0)
 
     def tearDown(self):
         del self.config
@@ -163,6 +163,164 @@ class DiffimTestCases(unittest.TestCase):
         nBgTerms = int(0.5 * (bgo + 1) * (bgo + 2))
         self.assertEqual(len(spatialBgSolution), nBgTerms)
 
+    def testIncremental(self):
+        basisList = ipDiffim.makeKernelBasisList(self.subconfig)
+        self.policy.set('spatialKernelOrder', 1)
+        self.policy.set('spatialBgOrder', 0)
+        self.policy.set('fitForBackground', True)
+
+        bbox = afwGeom.Box2I(afwGeom.Point2I(0, 0),
+                             afwGeom.Extent2I(self.size*10, self.size*10))
+
+        bsikv = ipDiffim.BuildSingleKernelVisitorF(basisList, self.policy)
+        cands = []
+        for x in range(1, self.size, 10):
+            for y in range(1, self.size, 10):
+                cand = self.makeCandidate(1.0 + 0.01 * x - 0.02 * y, x, y)
+                bsikv.processCandidate(cand)
+                cands.append(cand)
+        subset = cands[::2]
+
+        bspkv = ipDiffim.BuildSpatialKernelVisitorF(basisList, bbox, self.policy)
+        for cand in cands:
+            bspkv.processCandidate(cand)
+        bspkv.solveLinearEquation()
+        self.assertEqual(bspkv.getNAdded(), len(cands))
+        self.assertEqual(bspkv.getNRemoved(), 0)
+
+        # Second pass over a subset only downdates the solution
+        for cand in subset:
+            bspkv.processCandidate(cand)
+        bspkv.solveLinearEquation()
+        self.assertEqual(bspkv.getNCandidates(), len(subset))
+        self.assertEqual(bspkv.getNAdded(), 0)
+        self.assertEqual(bspkv.getNRemoved(), len(cands) - len(subset))
+        self.assertEqual(bspkv.getKernelSolution().getNConstraints(), len(subset))
+
+        # Same as starting from scratch
+        bspkv2 = ipDiffim.BuildSpatialKernelVisitorF(basisList, bbox, self.policy)
+        for cand in subset:
+            bspkv2.processCandidate(cand)
+        bspkv2.solveLinearEquation()
+
+        sk1, sb1 = bspkv.getSolutionPair()
+        sk2, sb2 = bspkv2.getSolutionPair()
+        params1 = sk1.getSpatialParameters()
+        params2 = sk2.getSpatialParameters()
+        for b in range(len(params1)):
+            for s in range(len(params1[b])):
+                self.assertAlmostEqual(params1[b][s], params2[b][s], 6)
+        self.assertAlmostEqual(sb1.getParameters()[0], sb2.getParameters()[0], 6)
+
+        # A rebuilt candidate is replaced
+        bsikv.setSkipBuilt(False)
+        bsikv.processCandidate(subset[0])
+        for cand in subset:
+            bspkv.processCandidate(cand)
+        bspkv.solveLinearEquation()
+        self.assertEqual(bspkv.getNAdded(), 1)
+        self.assertEqual(bspkv.getNRemoved(), 1)
+
+    def testCholeskyUpdate(self):
+        basisList = ipDiffim.makeKernelBasisList(self.subconfig)
+        self.policy.set('spatialKernelOrder', 2)
+        self.policy.set('spatialBgOrder', 0)
+        self.policy.set('fitForBackground', True)
+        self.policy.set('useCholeskyForSpatialKernel', True)
+
+        bbox = afwGeom.Box2I(afwGeom.Point2I(0, 0),
+                             afwGeom.Extent2I(self.size*10, self.size*10))
+
+        bsikv = ipDiffim.BuildSingleKernelVisitorF(basisList, self.policy)
+        cands = []
+        for x in range(1, self.size, 10):
+            for y in range(1, self.size, 10):
+                cand = self.makeCandidate(1.0 + 0.01 * x - 0.02 * y, x, y)
+                bsikv.processCandidate(cand)
+                cands.append(cand)
+
+        bspkv = ipDiffim.BuildSpatialKernelVisitorF(basisList, bbox, self.policy)
+        for cand in cands:
+            bspkv.processCandidate(cand)
+        bspkv.solveLinearEquation()
+        solution = bspkv.getKernelSolution()
+        self.assertEqual(solution.getSolvedBy(), ipDiffim.KernelSolution.CHOLESKY_LLT)
+        self.assertEqual(solution.getNUpdatedSolves(), 0)
+
+        # Dropping one candidate updates the factorization
+        for cand in cands[1:]:
+            bspkv.processCandidate(cand)
+        bspkv.solveLinearEquation()
+        self.assertEqual(solution.getNUpdatedSolves(), 1)
+
+        bspkv2 = ipDiffim.BuildSpatialKernelVisitorF(basisList, bbox, self.policy)
+        for cand in cands[1:]:
+            bspkv2.processCandidate(cand)
+        bspkv2.solveLinearEquation()
+
+        params1 = bspkv.getSolutionPair()[0].getSpatialParameters()
+        params2 = bspkv2.getSolutionPair()[0].getSpatialParameters()
+        for b in range(len(params1)):
+            for s in range(len(params1[b])):
+                self.assertAlmostEqual(params1[b][s], params2[b][s], 5)
+
+    def testRebuild(self):
+        basisList = ipDiffim.makeKernelBasisList(self.subconfig)
+        self.policy.set('spatialKernelOrder', 2)
+        self.policy.set('spatialBgOrder', 0)
+        self.policy.set('fitForBackground', True)
+        self.policy.set('spatialKernelRebuildInterval', 0)
+
+        bbox = afwGeom.Box2I(afwGeom.Point2I(0, 0),
+                             afwGeom.Extent2I(self.size*10, self.size*10))
+
+        bsikv = ipDiffim.BuildSingleKernelVisitorF(basisList, self.policy)
+        cands = []
+        for x in range(1, self.size, 10):
+            for y in range(1, self.size, 10):
+                cand = self.makeCandidate(1.0 + 0.01 * x - 0.02 * y, x, y)
+                bsikv.processCandidate(cand)
+                cands.append(cand)
+
+        # Several clipping passes that drop candidates and bring them back
+        bspkv = ipDiffim.BuildSpatialKernelVisitorF(basisList, bbox, self.policy)
+        for i in range(6):
+            for cand in cands[i % 3::(i % 2) + 1]:
+                bspkv.processCandidate(cand)
+            bspkv.solveLinearEquation()
+            for cand in cands:
+                bspkv.processCandidate(cand)
+            bspkv.solveLinearEquation()
+        solution = bspkv.getKernelSolution()
+        self.assertEqual(solution.getNRebuilds(), 0)
+        self.assertEqual(solution.getNConstraints(), len(cands))
+        paramsIncr = bspkv.getSolutionPair()[0].getSpatialParameters()
+
+        bspkv2 = ipDiffim.BuildSpatialKernelVisitorF(basisList, bbox, self.policy)
+        for cand in cands:
+            bspkv2.processCandidate(cand)
+        bspkv2.solveLinearEquation()
+        paramsFresh = bspkv2.getSolutionPair()[0].getSpatialParameters()
+
+        # The incremental M only differs from a fresh build by round-off
+        drift = solution.rebuild()
+        self.assertTrue(drift >= 0.0)
+        self.assertEqual(solution.rebuild(), 0.0)
+        solution.solve()
+        paramsRebuilt = bspkv.getSolutionPair()[0].getSpatialParameters()
+        for b in range(len(paramsFresh)):
+            for s in range(len(paramsFresh[b])):
+                self.assertAlmostEqual(paramsIncr[b][s], paramsFresh[b][s], 5)
+                self.assertAlmostEqual(paramsRebuilt[b][s], paramsFresh[b][s], 10)
+
+        # Rebuilt automatically every spatialKernelRebuildInterval downdated solves
+        self.policy.set('spatialKernelRebuildInterval', 2)
+        bspkv3 = ipDiffim.BuildSpatialKernelVisitorF(basisList, bbox, self.policy)
+        for i in range(4):
+            for cand in cands[i % 2:]:
+                bspkv3.processCandidate(cand)
+            bspkv3.solveLinearEquation()
+        self.assertEqual(bspkv3.getKernelSolution().getNRebuilds(), 1)
 
 #####
         
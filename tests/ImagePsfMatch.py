@@ -234,6 +234,24 @@ class PsfMatchTestCases(unittest.TestCase):
                     if b != 4 and s != 0:
                        self.assertAlmostEqual(fitCoeffs[b][s]/fakeCoeffs[b][s], 1.0, 1)
 
+    def testInstrumentation(self):
+        tMi, sMi, sK, kcs, confake = diffimTools.makeFakeKernelSet(bgValue = 0.0, addNoise = False)
+        basisList = ipDiffim.makeKernelBasisList(confake.kernel.active)
+        confake.kernel.active.enableInstrumentation = True
+        psfMatchAL = ipDiffim.ImagePsfMatchTask(config=confake)
+
+        # Counters accumulated before the solve are neither reset nor reported
+        phase = ipDiffim.Instrumentation.SOLVE
+        ipDiffim.Instrumentation.setEnabled(False)
+        nCallsBefore = ipDiffim.Instrumentation.getNCalls(phase)
+        psfMatchAL._solve(kcs, basisList)
+        nCallsAfter = ipDiffim.Instrumentation.getNCalls(phase)
+
+        self.assertFalse(ipDiffim.Instrumentation.isEnabled())
+        self.assertTrue(nCallsAfter > nCallsBefore)
+        self.assertEqual(psfMatchAL.metadata.get("instrumentation.solve.nCalls"),
+                         nCallsAfter - nCallsBefore)
+
     def tearDown(self):
         del self.configAL
         del self.configDF
@@ -125,6 +125,35 @@ class DiffimTestCases(unittest.TestCase):
         self.runConvolveAndSubtract2(bgOrder=0)
         self.runConvolveAndSubtract2(bgOrder=2)
 
+    def testInstrumentation(self):
+        tmi = afwImage.MaskedImageF(afwGeom.Extent2I(5 * self.kSize, 5 * self.kSize))
+        tmi.set(1.0, 0x0, 1.0)
+        smi = tmi.Factory(tmi, True)
+        phase = ipDiffim.Instrumentation.RESIDUALS
+
+        ipDiffim.Instrumentation.reset()
+        ipDiffim.Instrumentation.setEnabled(False)
+        ipDiffim.convolveAndSubtract(tmi, smi, self.gaussKernel, 0.)
+        self.assertEqual(ipDiffim.Instrumentation.getNCalls(phase), 0)
+
+        ipDiffim.Instrumentation.setEnabled(True)
+        try:
+            ipDiffim.convolveAndSubtract(tmi, smi, self.gaussKernel, 0.)
+            ipDiffim.convolveAndSubtract(tmi.getImage(), smi, self.gaussKernel, 0.)
+        finally:
+            ipDiffim.Instrumentation.setEnabled(False)
+
+        counters = ipDiffim.getInstrumentation()
+        self.assertEqual(counters["residuals"]["nCalls"], 2)
+        self.assertTrue(counters["residuals"]["seconds"] >= 0.)
+        self.assertTrue(counters["residuals"]["flops"] > 0.)
+        self.assertTrue(counters["residuals"]["bytes"] > 0.)
+        self.assertEqual(counters["solve"]["nCalls"], 0)
+
+        ipDiffim.Instrumentation.reset()
+        self.assertEqual(ipDiffim.Instrumentation.getNCalls(phase), 0)
+        self.assertEqual(ipDiffim.Instrumentation.getFlops(phase), 0.)
+
 #####
         
 def suite():
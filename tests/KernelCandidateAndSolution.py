@@ -466,6 +466,44 @@ class DiffimTestCases(unittest.TestCase):
             for i in range(kImageOut.getWidth()):
                 self.assertAlmostEqual(kImageOut.get(i, j)/kImageIn.get(i, j), 1.0, 5)
 
+    def testShiftedDeltaFunction(self, imsize = 50):
+        # Convolve with an off-center delta function; the delta-function
+        # basis must recover it at the same kernel pixel (checks the
+        # orientation of the pixels read from the images)
+        gsize = self.policy.getInt("kernelSize")
+        tsize = imsize + gsize
+
+        ctr    = gsize // 2
+        shiftX = ctr + 2
+        shiftY = ctr - 1
+        shiftKernel = afwMath.DeltaFunctionKernel(gsize, gsize, afwGeom.Point2I(shiftX, shiftY))
+
+        # template with a few hot pixels, none on an axis of symmetry
+        tmi = afwImage.MaskedImageF(afwGeom.Extent2I(tsize, tsize))
+        tmi.set(0, 0x0, 1)
+        for i, j, val in ((20, 31, 100), (33, 17, 50), (25, 26, 75)):
+            tmi.set(i, j, (val, 0x0, 1))
+
+        smi = afwImage.MaskedImageF(tmi.getDimensions())
+        afwMath.convolve(smi, tmi, shiftKernel, False)
+
+        bbox = shiftKernel.shrinkBBox(smi.getBBox(afwImage.LOCAL))
+        tmi2 = afwImage.MaskedImageF(tmi, bbox, afwImage.LOCAL)
+        smi2 = afwImage.MaskedImageF(smi, bbox, afwImage.LOCAL)
+
+        kc = ipDiffim.KernelCandidateF(0.0, 0.0, tmi2, smi2, self.policy)
+        kList = ipDiffim.makeKernelBasisList(self.subconfig)
+        kc.build(kList)
+        self.assertEqual(kc.isInitialized(), True)
+
+        kImageOut = kc.getImage()
+        for j in range(kImageOut.getHeight()):
+            for i in range(kImageOut.getWidth()):
+                if (i == shiftX) and (j == shiftY):
+                    self.assertAlmostEqual(kImageOut.get(i, j), 1.0, 5)
+                else:
+                    self.assertAlmostEqual(kImageOut.get(i, j), 0.0, 5)
+
     def testZeroVariance(self, imsize = 50):
         gsize = self.policy.getInt("kernelSize")
         tsize = imsize + gsize
@@ -505,6 +543,38 @@ class DiffimTestCases(unittest.TestCase):
         self.policy.set("constantVarianceWeighting", True)
         self.testGaussian()
 
+    def testRating(self):
+        mi = afwImage.MaskedImageF(afwGeom.Extent2I(30, 30))
+        mi.set(5.0, 0x0, 1.0)
+
+        # Measured from the science image core when first asked for
+        kc = ipDiffim.makeKernelCandidate(15., 15., mi, mi, self.policy)
+        self.assertAlmostEqual(kc.getCandidateRating(), 5.0)
+
+        # Or supplied, e.g. from a catalog; sets the order within a cell
+        kc1 = ipDiffim.makeKernelCandidate(15., 15., mi, mi, self.policy, 10.0)
+        kc2 = ipDiffim.makeKernelCandidate(15., 15., mi, mi, self.policy, 20.0)
+        self.assertEqual(kc1.getCandidateRating(), 10.0)
+        kernelCellSet = afwMath.SpatialCellSet(afwGeom.Box2I(afwGeom.Point2I(0, 0), afwGeom.Extent2I(30, 30)),
+                                               30, 30)
+        kernelCellSet.insertCandidate(kc1)
+        kernelCellSet.insertCandidate(kc2)
+        ratings = [cand.getCandidateRating() for cand in kernelCellSet.getCellList()[0].begin(False)]
+        self.assertEqual(ratings, [20.0, 10.0])
+
+        # An unmeasurable core is rated last, but only the build visitor rejects it
+        bad = afwImage.MaskedImageF(afwGeom.Extent2I(30, 30))
+        bad.set(float("nan"), 0x0, 1.0)
+        kc3 = ipDiffim.makeKernelCandidate(15., 15., mi, bad, self.policy)
+        self.assertEqual(kc3.getCandidateRating(), 0.0)
+        self.assertNotEqual(kc3.getStatus(), afwMath.SpatialCellCandidate.BAD)
+        kList = ipDiffim.makeKernelBasisList(self.subconfig)
+        bskv = ipDiffim.BuildSingleKernelVisitorF(kList, self.policy)
+        bskv.processCandidate(kc3)
+        self.assertEqual(kc3.getStatus(), afwMath.SpatialCellCandidate.BAD)
+        self.assertEqual(kc3.isInitialized(), False)
+        self.assertEqual(bskv.getNRejected(), 1)
+
     def testInsert(self):
         mi = afwImage.MaskedImageF(afwGeom.Extent2I(10, 10))
         kc = ipDiffim.makeKernelCandidate(0., 0., mi, mi, self.policy)
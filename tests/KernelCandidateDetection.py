@@ -98,6 +98,41 @@ class DiffimTestCases(unittest.TestCase):
         fpList3 = kcDetect.getFootprints()
         self.assertTrue(len(fpList3) == (len(fpList1)-3))
 
+    def testCellBudget(self):
+        if not self.defDataDir:
+            print >> sys.stderr, "Warning: afwdata is not set up; not running KernelCandidateDetection.py"
+            return
+
+        bgConfig = self.subconfig.afwBackgroundConfig
+        diffimTools.backgroundSubtract(bgConfig, [self.templateImage,])
+
+        detConfig = self.subconfig.detectionConfig
+        detConfig.nReservePerCell = 1
+        kcDetect = ipDiffim.KernelCandidateDetectionF(pexConfig.makePolicy(detConfig))
+        kcDetect.apply(self.templateImage, self.scienceImage)
+        fpListAll = kcDetect.getFootprints()
+
+        sizeCell = 256
+        nStarPerCell = 2
+        kcDetect.apply(self.templateImage, self.scienceImage, sizeCell, sizeCell, nStarPerCell)
+        fpListCell = kcDetect.getFootprints()
+        self.assertTrue(len(fpListCell) != 0)
+        self.assertTrue(len(fpListCell) <= len(fpListAll))
+
+        # No cell holds more than its quota plus reserve
+        bbox = self.templateImage.getBBox()
+        counts = {}
+        for fp in fpListCell:
+            fpBBox = fp.getBBox()
+            ix = ((fpBBox.getMinX() + fpBBox.getMaxX()) // 2 - bbox.getMinX()) // sizeCell
+            iy = ((fpBBox.getMinY() + fpBBox.getMaxY()) // 2 - bbox.getMinY()) // sizeCell
+            counts[(ix, iy)] = counts.get((ix, iy), 0) + 1
+        # Footprints are binned by bbox center, as the SpatialCellSet places their candidates
+        self.assertTrue(max(counts.values()) <= nStarPerCell + detConfig.nReservePerCell)
+        self.assertTrue(len(fpListCell) <= (nStarPerCell + detConfig.nReservePerCell) *
+                        ((bbox.getWidth() + sizeCell - 1) // sizeCell) *
+                        ((bbox.getHeight() + sizeCell - 1) // sizeCell))
+
 #####
         
 def suite():
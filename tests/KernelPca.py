@@ -1,5 +1,6 @@
 #!/usr/bin/env python
 import unittest
+import numpy as num
 
 import lsst.utils.tests as tests
 import lsst.afw.image as afwImage
@@ -155,6 +156,50 @@ class DiffimTestCases(unittest.TestCase):
         self.assertAlmostEqual(eigenValues[1], 0.0)
         self.assertAlmostEqual(eigenValues[2], 0.0)
         
+    def testNComponents(self):
+        gaussKernel1 = afwMath.AnalyticKernel(21, 21, afwMath.GaussianFunction2D(2, 3))
+        gaussKernel2 = afwMath.AnalyticKernel(21, 21, afwMath.GaussianFunction2D(3, 2))
+
+        imagePcaAll = ipDiffim.KernelPcaD()
+        imagePcaTop = ipDiffim.KernelPcaD(True, 2)
+        imagePcaNone = ipDiffim.KernelPcaD(True, 0)
+        for i in range(20):
+            kImage = afwImage.ImageD(gaussKernel1.getDimensions())
+            gaussKernel1.computeImage(kImage, False)
+            kImage2 = afwImage.ImageD(gaussKernel2.getDimensions())
+            gaussKernel2.computeImage(kImage2, False)
+            kImage.scaledPlus(0.05 * i, kImage2)
+            imagePcaAll.addImage(kImage, 1.0)
+            imagePcaTop.addImage(afwImage.ImageD(kImage, True), 1.0)
+            imagePcaNone.addImage(afwImage.ImageD(kImage, True), 1.0)
+
+        imagePcaAll.analyze()
+        imagePcaTop.analyze()
+        imagePcaNone.analyze()
+
+        # Only the requested eigenimages are made; all eigenvalues are kept
+        self.assertEqual(len(imagePcaAll.getEigenImages()), 20)
+        self.assertEqual(len(imagePcaTop.getEigenImages()), 2)
+        self.assertEqual(len(imagePcaTop.getEigenValues()), 20)
+        self.assertEqual(len(imagePcaNone.getEigenImages()), 0)
+        self.assertEqual(len(imagePcaNone.getEigenValues()), 20)
+
+        # The results are held by KernelPca, not the ImagePca base class
+        self.assertEqual(len(afwImage.ImagePcaD.getEigenImages(imagePcaTop)), 0)
+        self.assertEqual(len(afwImage.ImagePcaD.getEigenValues(imagePcaTop)), 0)
+
+        for eAll, eTop in zip(imagePcaAll.getEigenValues(), imagePcaTop.getEigenValues()):
+            self.assertAlmostEqual(eAll, eTop)
+        for i in range(2):
+            arrAll = imagePcaAll.getEigenImages()[i].getArray()
+            arrTop = imagePcaTop.getEigenImages()[i].getArray()
+            self.assertTrue(num.allclose(arrAll, arrTop))
+
+    def testConstantWeight(self):
+        # Flux weighting is not supported
+        self.assertRaises(Exception, ipDiffim.KernelPcaD, False)
+        self.assertRaises(Exception, ipDiffim.KernelPcaD, False, 2)
+
     def testMeanSubtraction(self):
         kc1 = self.makeCandidate(1, 0.0, 0.0)
         kc1.build(self.kList)
@@ -141,6 +141,59 @@ class DiffimTestCases(unittest.TestCase):
 
         self.assertEqual(ksv.getNRejected(), 1)
 
+    def testRegistry(self, nCell = 3):
+        ksv = ipDiffim.makeKernelSumVisitor(self.policy)
+
+        sizeCellX = self.policy.get("sizeCellX")
+        sizeCellY = self.policy.get("sizeCellY")
+        kernelCellSet = afwMath.SpatialCellSet(afwGeom.Box2I(afwGeom.Point2I(0, 0),
+                                                             afwGeom.Extent2I(sizeCellX * nCell,
+                                                                              sizeCellY * nCell)),
+                                               sizeCellX,
+                                               sizeCellY)
+
+        # Two candidates per cell; the second (fainter) is not visited with nStarPerCell = 1
+        for candX in range(nCell):
+            for candY in range(nCell):
+                kSum = 100.0 if (candX == nCell // 2 and candY == nCell // 2) else 1.0
+                for rating in (2.0, 1.0):
+                    kc = self.makeCandidate(kSum,
+                                            candX * sizeCellX + sizeCellX // 2,
+                                            candY * sizeCellY + sizeCellY // 2)
+                    kc.setCandidateRating(rating)
+                    if rating == 2.0:
+                        kc.build(self.kList)
+                    kernelCellSet.insertCandidate(kc)
+
+        registry = ipDiffim.KernelCandidateRegistryF(kernelCellSet)
+        self.assertEqual(registry.size(), 2 * nCell * nCell)
+        self.assertEqual(registry.getNCells(), nCell * nCell)
+        self.assertEqual(len(registry.getKsum()), registry.size())
+
+        active = registry.sync(1)
+        self.assertEqual(len(active), nCell * nCell)
+        for i in active:
+            self.assertTrue(registry.getKsum()[i] in (1.0, 100.0))
+
+        ksv.resetKernelSum()
+        ksv.aggregate(registry, active)
+        ksv.processKsumDistribution()
+        ksv.reject(registry, active)
+        self.assertEqual(ksv.getNRejected(), 1)
+        self.assertEqual(registry.countStatus(afwMath.SpatialCellCandidate.BAD), 1)
+
+        # Written through to the candidate; its cell-mate is now visited, but is not built
+        nBad = 0
+        for cell in kernelCellSet.getCellList():
+            for cand in cell.begin(False):
+                if cand.getStatus() == afwMath.SpatialCellCandidate.BAD:
+                    nBad += 1
+        self.assertEqual(nBad, 1)
+        active = registry.sync(1)
+        self.assertEqual(len(active), nCell * nCell)
+        ksv.resetKernelSum()
+        self.assertRaises(Exception, ksv.aggregate, registry, active)
+
 #####
         
 def suite():
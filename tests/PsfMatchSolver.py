@@ -0,0 +1,275 @@
+#!/usr/bin/env python
+import os
+import tempfile
+import unittest
+
+import lsst.utils.tests as tests
+import lsst.afw.math as afwMath
+import lsst.ip.diffim as ipDiffim
+import lsst.ip.diffim.diffimTools as diffimTools
+import lsst.pex.logging as pexLog
+import lsst.pex.config as pexConfig
+
+pexLog.Trace_setVerbosity('lsst.ip.diffim', 3)
+
+class DiffimTestCases(unittest.TestCase):
+
+    def setUp(self):
+        self.tMi, self.sMi, self.sK, self.kcs, self.confake = diffimTools.makeFakeKernelSet(bgValue = 0.0,
+                                                                                            addNoise = False)
+        self.tMi.getVariance().set(1.0)
+        self.sMi.getVariance().set(1.0)
+        self.subconfig = self.confake.kernel.active
+        self.basisList = ipDiffim.makeKernelBasisList(self.subconfig)
+
+    def tearDown(self):
+        del self.tMi
+        del self.sMi
+        del self.sK
+        del self.kcs
+        del self.confake
+        del self.basisList
+
+    def testSolve(self):
+        policy = pexConfig.makePolicy(self.subconfig)
+        solver = ipDiffim.PsfMatchSolverF(self.basisList, policy)
+
+        # should fail, nothing solved yet
+        try:
+            solver.getSolutionPair()
+        except Exception:
+            pass
+        else:
+            self.fail()
+
+        solver.solve(self.kcs)
+        spatialKernel, spatialBackground = solver.getSolutionPair()
+        self.assertEqual(spatialKernel.getNKernelParameters(), len(self.basisList))
+        self.assertTrue(solver.getKernelSolution() is not None)
+
+        # Counters are per pass, and the last pass made it to the spatial fit
+        nPasses = solver.getNPasses()
+        self.assertTrue(nPasses >= 1)
+        for counts in (solver.getNRejectedSingle(), solver.getNRejectedKsum(), solver.getNRejectedPca(),
+                       solver.getNRejectedSpatial(), solver.getNGoodSpatial(),
+                       solver.getNAddedSpatial(), solver.getNRemovedSpatial()):
+            self.assertEqual(len(counts), nPasses)
+        self.assertTrue(solver.getNGoodSpatial()[-1] > 0)
+        self.assertTrue(solver.getNIterations() <= self.subconfig.maxSpatialIterations)
+
+    def testMatchesPython(self):
+        # The task's _solve is a thin wrapper around the solver
+        psfMatchAL = ipDiffim.ImagePsfMatchTask(config=self.confake)
+        spatialSolution, spatialKernel, spatialBackground = psfMatchAL._solve(self.kcs, self.basisList)
+
+        policy = pexConfig.makePolicy(self.subconfig)
+        solver = ipDiffim.PsfMatchSolverF(self.basisList, policy)
+        solver.solve(self.kcs)
+        spatialKernel2, spatialBackground2 = solver.getSolutionPair()
+
+        params1 = spatialKernel.getSpatialParameters()
+        params2 = spatialKernel2.getSpatialParameters()
+        for b in range(len(params1)):
+            for s in range(len(params1[b])):
+                self.assertAlmostEqual(params1[b][s], params2[b][s])
+
+    def testPca(self):
+        self.subconfig.usePcaForSpatialKernel = True
+        self.subconfig.numPrincipalComponents = 3
+        policy = pexConfig.makePolicy(self.subconfig)
+        solver = ipDiffim.PsfMatchSolverF(self.basisList, policy)
+        solver.solve(self.kcs)
+
+        spatialKernel, spatialBackground = solver.getSolutionPair()
+        spatialBasisList = solver.getSpatialBasisList()
+        self.assertTrue(len(spatialBasisList) <= 3)
+        self.assertEqual(spatialKernel.getNKernelParameters(), len(spatialBasisList))
+        self.assertTrue(isinstance(spatialKernel, afwMath.LinearCombinationKernel))
+
+    def testRetention(self):
+        nBytes = {}
+        for retention in ("full", "normal-equations", "coefficients"):
+            tMi, sMi, sK, kcs, confake = diffimTools.makeFakeKernelSet(bgValue = 0.0, addNoise = False)
+            subconfig = confake.kernel.active
+            subconfig.kernelSolutionRetention = retention
+            policy = pexConfig.makePolicy(subconfig)
+            basisList = ipDiffim.makeKernelBasisList(subconfig)
+            solver = ipDiffim.PsfMatchSolverF(basisList, policy)
+            solver.solve(kcs)
+            nBytes[retention] = solver.getBytesRetained()
+            self.assertEqual(nBytes[retention], ipDiffim.getBytesRetainedF(kcs))
+
+            # The solution survives the release
+            spatialKernel, spatialBackground = solver.getSolutionPair()
+            self.assertEqual(spatialKernel.getNKernelParameters(), len(basisList))
+
+        self.assertTrue(nBytes["full"] > nBytes["normal-equations"])
+        self.assertTrue(nBytes["normal-equations"] > nBytes["coefficients"])
+
+    def testPrior(self):
+        policy = pexConfig.makePolicy(self.subconfig)
+        solver = ipDiffim.PsfMatchSolverF(self.basisList, policy)
+        solver.solve(self.kcs)
+        spatialKernel, spatialBackground = solver.getSolutionPair()
+        self.assertFalse(solver.hasPrior())
+
+        # Same field again, screened by the first solution
+        tMi, sMi, sK, kcs, confake = diffimTools.makeFakeKernelSet(bgValue = 0.0, addNoise = False)
+        tMi.getVariance().set(1.0)
+        sMi.getVariance().set(1.0)
+        solver2 = ipDiffim.PsfMatchSolverF(self.basisList, policy)
+        solver2.setPrior(spatialKernel, spatialBackground)
+        self.assertTrue(solver2.hasPrior())
+        solver2.solve(kcs)
+        self.assertEqual(solver2.getNRejectedPrior(), 0)
+        self.assertTrue(solver2.getSkippedKsum())
+        self.assertEqual(solver2.getNRejectedKsum()[0], 0)
+
+        spatialKernel2, spatialBackground2 = solver2.getSolutionPair()
+        params1 = spatialKernel.getSpatialParameters()
+        params2 = spatialKernel2.getSpatialParameters()
+        for b in range(len(params1)):
+            for s in range(len(params1[b])):
+                self.assertAlmostEqual(params1[b][s], params2[b][s])
+
+        # Without spatialKernelClipping the prior cannot stand in for kernel sum clipping
+        self.subconfig.spatialKernelClipping = False
+        tMi, sMi, sK, kcs, confake = diffimTools.makeFakeKernelSet(bgValue = 0.0, addNoise = False)
+        tMi.getVariance().set(1.0)
+        sMi.getVariance().set(1.0)
+        solver3 = ipDiffim.PsfMatchSolverF(self.basisList, pexConfig.makePolicy(self.subconfig))
+        solver3.setPrior(spatialKernel, spatialBackground)
+        solver3.solve(kcs)
+        self.assertEqual(solver3.getNRejectedPrior(), 0)
+        self.assertFalse(solver3.getSkippedKsum())
+
+        # Nor is it skipped without a prior
+        self.assertFalse(solver.getSkippedKsum())
+
+    def testCheckpoint(self):
+        policy = pexConfig.makePolicy(self.subconfig)
+        solver = ipDiffim.PsfMatchSolverF(self.basisList, policy)
+        solver.solve(self.kcs)
+        spatialKernel, spatialBackground = solver.getSolutionPair()
+
+        fd, path = tempfile.mkstemp(suffix=".ckpt")
+        os.close(fd)
+        try:
+            solver.writeCheckpoint(path, self.kcs)
+
+            # The same cell set, not yet solved
+            tMi, sMi, sK, kcs, confake = diffimTools.makeFakeKernelSet(bgValue = 0.0, addNoise = False)
+            tMi.getVariance().set(1.0)
+            sMi.getVariance().set(1.0)
+            solver2 = ipDiffim.PsfMatchSolverF(self.basisList, policy)
+            solver2.restoreCheckpoint(path, kcs)
+            self.assertEqual(solver2.getNPasses(), 0)
+
+            spatialKernel2, spatialBackground2 = solver2.getSolutionPair()
+            params1 = spatialKernel.getSpatialParameters()
+            params2 = spatialKernel2.getSpatialParameters()
+            for b in range(len(params1)):
+                for s in range(len(params1[b])):
+                    self.assertAlmostEqual(params1[b][s], params2[b][s])
+
+            for cell1, cell2 in zip(self.kcs.getCellList(), kcs.getCellList()):
+                for cand1, cand2 in zip(cell1.begin(False), cell2.begin(False)):
+                    cand1 = ipDiffim.cast_KernelCandidateF(cand1)
+                    cand2 = ipDiffim.cast_KernelCandidateF(cand2)
+                    self.assertEqual(cand1.getStatus(), cand2.getStatus())
+                    self.assertEqual(cand1.isInitialized(), cand2.isInitialized())
+                    if cand1.isInitialized():
+                        self.assertAlmostEqual(cand1.getKsum(ipDiffim.KernelCandidateF.ORIG),
+                                               cand2.getKsum(ipDiffim.KernelCandidateF.ORIG))
+
+            # Nor do different pixels at the same positions
+            sMi *= 1.01
+            solver3 = ipDiffim.PsfMatchSolverF(self.basisList, policy)
+            self.assertRaises(Exception, solver3.restoreCheckpoint, path, kcs)
+
+            # Nor a different configuration, basis or clipping
+            tMi, sMi, sK, kcs, confake = diffimTools.makeFakeKernelSet(bgValue = 0.0, addNoise = False)
+            tMi.getVariance().set(1.0)
+            sMi.getVariance().set(1.0)
+            for field, value in (("spatialKernelOrder", self.subconfig.spatialKernelOrder + 1),
+                                 ("candidateResidualStdMax", 2 * self.subconfig.candidateResidualStdMax),
+                                 ("spatialKernelClipping", not self.subconfig.spatialKernelClipping),
+                                 ("alardSigGauss", [2 * x for x in self.subconfig.alardSigGauss])):
+                original = getattr(self.subconfig, field)
+                setattr(self.subconfig, field, value)
+                basisList = ipDiffim.makeKernelBasisList(self.subconfig)
+                solver3 = ipDiffim.PsfMatchSolverF(basisList, pexConfig.makePolicy(self.subconfig))
+                self.assertRaises(Exception, solver3.restoreCheckpoint, path, kcs)
+                setattr(self.subconfig, field, original)
+
+            # The output-only settings do not matter
+            self.subconfig.kernelCheckpointFile = "kernel-%(visit)d.ckpt"
+            solver3 = ipDiffim.PsfMatchSolverF(self.basisList, pexConfig.makePolicy(self.subconfig))
+            solver3.restoreCheckpoint(path, kcs)
+        finally:
+            os.remove(path)
+
+    def testCheckpointRegularized(self):
+        config = ipDiffim.ImagePsfMatchTask.ConfigClass()
+        config.kernel.name = "DF"
+        subconfig = config.kernel.active
+        subconfig.kernelSize = self.subconfig.kernelSize
+        subconfig.useRegularization = True
+        subconfig.spatialKernelOrder = 0
+        subconfig.usePcaForSpatialKernel = False
+        policy = pexConfig.makePolicy(subconfig)
+        basisList = ipDiffim.makeKernelBasisList(subconfig)
+        hMat = ipDiffim.makeRegularizationMatrix(policy)
+
+        solver = ipDiffim.PsfMatchSolverF(basisList, policy, hMat)
+        solver.solve(self.kcs)
+
+        fd, path = tempfile.mkstemp(suffix=".ckpt")
+        os.close(fd)
+        try:
+            solver.writeCheckpoint(path, self.kcs)
+
+            tMi, sMi, sK, kcs, confake = diffimTools.makeFakeKernelSet(bgValue = 0.0, addNoise = False)
+            tMi.getVariance().set(1.0)
+            sMi.getVariance().set(1.0)
+
+            # The regularization is part of the checkpoint
+            solver2 = ipDiffim.PsfMatchSolverF(basisList, policy)
+            self.assertRaises(Exception, solver2.restoreCheckpoint, path, kcs)
+
+            solver2 = ipDiffim.PsfMatchSolverF(basisList, policy, hMat)
+            solver2.restoreCheckpoint(path, kcs)
+            for cell1, cell2 in zip(self.kcs.getCellList(), kcs.getCellList()):
+                for cand1, cand2 in zip(cell1.begin(False), cell2.begin(False)):
+                    cand1 = ipDiffim.cast_KernelCandidateF(cand1)
+                    cand2 = ipDiffim.cast_KernelCandidateF(cand2)
+                    if cand1.isInitialized():
+                        self.assertAlmostEqual(cand1.getKsum(ipDiffim.KernelCandidateF.ORIG),
+                                               cand2.getKsum(ipDiffim.KernelCandidateF.ORIG))
+        finally:
+            os.remove(path)
+
+    def testCheckpointFile(self):
+        # One checkpoint per exposure, named from its data id
+        self.subconfig.kernelCheckpointFile = "kernel.ckpt"
+        self.assertRaises(Exception, self.subconfig.validate)
+        self.subconfig.kernelCheckpointFile = "kernel-%(visit)d-%(ccd)d.ckpt"
+        self.subconfig.validate()
+
+#####
+
+def suite():
+    """Returns a suite containing all the test cases in this module."""
+    tests.init()
+
+    suites = []
+    suites += unittest.makeSuite(DiffimTestCases)
+    suites += unittest.makeSuite(tests.MemoryTestCase)
+    return unittest.TestSuite(suites)
+
+def run(doExit=False):
+    """Run the tests"""
+    tests.run(suite(), doExit)
+
+if __name__ == "__main__":
+    run(True)
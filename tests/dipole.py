@@ -175,6 +175,85 @@ class DipoleAlgorithmTest(unittest.TestCase):
             except Exception:
                 self.fail()
 
+    def testPsfDipoleFluxCache(self):
+        psf, psfSum, exposure, s = createDipole(self.w, self.h, self.xc, self.yc)
+        results = []
+        chi2s = []
+        for oversample in (0, 4):
+            control = ipDiffim.PsfDipoleFluxControl()
+            control.psfCacheOversample = oversample
+            plugin, cat = makePluginAndCat(ipDiffim.PsfDipoleFlux, "test", control, centroid="centroid")
+            source = cat.addNew()
+            source.setFootprint(s.getFootprint())
+            plugin.measure(source, exposure)
+            results.append(source)
+            # A single chi2 evaluation never uses the cache
+            chi2s.append(plugin.chi2(source, exposure, self.xc - 1.3, self.yc - 1.3, -1000.,
+                                     self.xc + 1.3, self.yc + 1.3, 1000.))
+        self.assertEqual(chi2s[0][0], chi2s[1][0])
+        self.assertEqual(chi2s[0][1], chi2s[1][1])
+        # Interpolating the cached Psf should only perturb the fit at the sub-percent level
+        for key in ("test_pos_flux", "test_neg_flux"):
+            self.assertAlmostEqual(results[1].get(key) / results[0].get(key), 1.0, 2)
+        for key in ("test_pos_centroid_x", "test_pos_centroid_y", "test_neg_centroid_x", "test_neg_centroid_y"):
+            self.assertAlmostEqual(results[1].get(key), results[0].get(key), 1)
+
+    def testPsfDipoleFluxGradient(self):
+        psf, psfSum, exposure, s = createDipole(self.w, self.h, self.xc, self.yc)
+        control = ipDiffim.PsfDipoleFluxControl()
+        plugin, cat = makePluginAndCat(ipDiffim.PsfDipoleFlux, "test", control, centroid="centroid")
+        source = cat.addNew()
+        source.setFootprint(s.getFootprint())
+
+        # Away from the minimum, at sub-pixel centroids
+        params = [self.xc - 1.3, self.yc - 1.1, -900., self.xc + 1.2, self.yc + 1.4, 1100.]
+        grad = plugin.gradient(source, exposure, *params)
+        self.assertEqual(len(grad), len(params))
+        for i, step in enumerate((1e-3, 1e-3, 1e-1, 1e-3, 1e-3, 1e-1)):
+            hi = list(params)
+            lo = list(params)
+            hi[i] += step
+            lo[i] -= step
+            numGrad = (plugin.chi2(source, exposure, *hi)[0] - plugin.chi2(source, exposure, *lo)[0]) / (2*step)
+            self.assertTrue(numGrad != 0.0)
+            self.assertAlmostEqual(grad[i] / numGrad, 1.0, 2)
+
+    def testPsfDipoleFluxLinear(self):
+        psf, psfSum, exposure, s = createDipole(self.w, self.h, self.xc, self.yc)
+        results = []
+        for fitFluxesLinearly in (False, True):
+            control = ipDiffim.PsfDipoleFluxControl()
+            control.fitFluxesLinearly = fitFluxesLinearly
+            plugin, cat = makePluginAndCat(ipDiffim.PsfDipoleFlux, "test", control, centroid="centroid")
+            source = cat.addNew()
+            source.setFootprint(s.getFootprint())
+            plugin.measure(source, exposure)
+            results.append(source)
+        # Projecting out the fluxes should land on the same minimum
+        self.assertTrue(results[1].get("test_neg_flux") <= 0.0)
+        self.assertTrue(results[1].get("test_pos_flux") >= 0.0)
+        self.assertTrue(results[1].get("test_pos_fluxSigma") > 0.0)
+        for key in ("test_pos_flux", "test_neg_flux"):
+            self.assertAlmostEqual(results[1].get(key) / results[0].get(key), 1.0, 2)
+        for key in ("test_pos_centroid_x", "test_pos_centroid_y", "test_neg_centroid_x", "test_neg_centroid_y"):
+            self.assertAlmostEqual(results[1].get(key), results[0].get(key), 1)
+
+    def testPsfDipoleFluxMeasureAll(self):
+        control = ipDiffim.PsfDipoleFluxControl()
+        plugin, cat = makePluginAndCat(ipDiffim.PsfDipoleFlux, "test", control, centroid="centroid")
+        psf, psfSum, exposure, s = createDipole(self.w, self.h, self.xc, self.yc)
+        for i in range(4):
+            source = cat.addNew()
+            source.setFootprint(s.getFootprint())
+
+        # The batched fit matches one-at-a-time measurement, whatever the thread count
+        plugin.measureAll(cat, exposure, 3)
+        batched = [(r.get("test_pos_flux"), r.get("test_neg_flux")) for r in cat]
+        for record in cat:
+            plugin.measure(record, exposure)
+        serial = [(r.get("test_pos_flux"), r.get("test_neg_flux")) for r in cat]
+        self.assertEqual(batched, serial)
+
     def testAll(self):
         psf, psfSum, exposure, s = createDipole(self.w, self.h, self.xc, self.yc)
         self.measureDipole(s, exposure)
@@ -321,8 +400,20 @@ class DipoleAlgorithmTest(unittest.TestCase):
 
         self.assertTrue(source.get("ip_diffim_PsfDipoleFlux_chi2dof") > 0.0)
 
-    def measureDipole(self, s, exp):
+    def testPsfDipoleFluxSeedFromNaive(self):
+        psf, psfSum, exposure, s = createDipole(self.w, self.h, self.xc, self.yc)
+        source0 = self.measureDipole(s, exposure)
+        source1 = self.measureDipole(s, exposure, seedFromNaive=True)
+        # A better starting point should converge to the same minimum
+        for key in ("ip_diffim_PsfDipoleFlux_pos_flux", "ip_diffim_PsfDipoleFlux_neg_flux"):
+            self.assertAlmostEqual(source1.get(key) / source0.get(key), 1.0, 2)
+        for key in ("ip_diffim_PsfDipoleFlux_pos_centroid_x", "ip_diffim_PsfDipoleFlux_pos_centroid_y",
+                    "ip_diffim_PsfDipoleFlux_neg_centroid_x", "ip_diffim_PsfDipoleFlux_neg_centroid_y"):
+            self.assertAlmostEqual(source1.get(key), source0.get(key), 1)
+
+    def measureDipole(self, s, exp, seedFromNaive=False):
         msConfig = ipDiffim.DipoleMeasurementConfig()
+        msConfig.plugins["ip_diffim_PsfDipoleFlux"].seedFromNaive = seedFromNaive
         schema = afwTable.SourceTable.makeMinimalSchema()
         schema.addField("centroid_x", type=float)
         schema.addField("centroid_y", type=float)